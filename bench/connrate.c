@@ -0,0 +1,139 @@
+// Measures how many short-lived connections per second a server accepts and answers.
+// Every connection sends a single 'Connection: close' request and reads the response until eof.
+//
+// Usage: connrate [threads] [seconds] [port] [path]
+//
+// Run it against lwebsrv built with server.listen_shards = 1, 2, ... N to compare
+// accept throughput between a single listener and SO_REUSEPORT sharded listeners.
+
+#include <lt/io.h>
+#include <lt/str.h>
+#include <lt/mem.h>
+#include <lt/thread.h>
+#include <lt/time.h>
+
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+typedef
+struct bench_thread {
+	lt_thread_t* thread;
+	u64 connections;
+	u64 failures;
+} bench_thread_t;
+
+static u16 port = 8000;
+static lstr_t path = CLSTR("/");
+static volatile b8 done = 0;
+
+static
+b8 run_connection(char* req, usz req_len) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return 0;
+	}
+
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	struct sockaddr_in addr = {
+			.sin_family = AF_INET,
+			.sin_port = htons(port),
+			.sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		goto err;
+	}
+
+	for (usz sent = 0; sent < req_len;) {
+		isz res = send(fd, req + sent, req_len - sent, MSG_NOSIGNAL);
+		if (res <= 0) {
+			goto err;
+		}
+		sent += res;
+	}
+
+	char buf[4096];
+	isz res;
+	usz received = 0;
+	while ((res = recv(fd, buf, sizeof(buf), 0)) > 0) {
+		received += res;
+	}
+	if (res < 0 || !received) {
+		goto err;
+	}
+
+	close(fd);
+	return 1;
+
+err:
+	close(fd);
+	return 0;
+}
+
+static
+void bench_proc(bench_thread_t* t) {
+	char req[512];
+	usz req_len = lt_sprintf(req, "GET %S HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n", path);
+
+	while (!done) {
+		if (run_connection(req, req_len)) {
+			++t->connections;
+		}
+		else {
+			++t->failures;
+		}
+	}
+}
+
+int main(int argc, char** argv) {
+	u64 thread_count = 8;
+	u64 seconds = 5;
+	u64 port_arg = port;
+
+	if ((argc > 1 && lt_lstou(lt_lsfroms(argv[1]), &thread_count)) ||
+		(argc > 2 && lt_lstou(lt_lsfroms(argv[2]), &seconds)) ||
+		(argc > 3 && lt_lstou(lt_lsfroms(argv[3]), &port_arg)) ||
+		!thread_count || port_arg > 0xFFFF)
+	{
+		lt_ferrf("usage: connrate [threads] [seconds] [port] [path]\n");
+	}
+	port = port_arg;
+	if (argc > 4) {
+		path = lt_lsfroms(argv[4]);
+	}
+
+	bench_thread_t* threads = lt_malloc(lt_libc_heap, thread_count * sizeof(bench_thread_t));
+	if (!threads) {
+		lt_ferrf("failed to allocate thread array\n");
+	}
+	lt_mzero(threads, thread_count * sizeof(bench_thread_t));
+
+	u64 start = lt_hfreq_time_msec();
+	for (usz i = 0; i < thread_count; ++i) {
+		threads[i].thread = lt_thread_create((lt_thread_fn_t)bench_proc, &threads[i], lt_libc_heap);
+		if (!threads[i].thread) {
+			lt_ferrf("failed to create thread\n");
+		}
+	}
+
+	lt_sleep_msec(seconds * 1000);
+	done = 1;
+
+	u64 connections = 0, failures = 0;
+	for (usz i = 0; i < thread_count; ++i) {
+		lt_thread_join(threads[i].thread, lt_libc_heap);
+		connections += threads[i].connections;
+		failures += threads[i].failures;
+	}
+	u64 elapsed = lt_hfreq_time_msec() - start;
+
+	lt_printf("%uq connections in %uq ms (%uq failed), %uq connections/s\n",
+			connections, elapsed, failures, connections * 1000 / (elapsed ? elapsed : 1));
+
+	lt_mfree(lt_libc_heap, threads);
+	return 0;
+}
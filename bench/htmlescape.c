@@ -0,0 +1,142 @@
+// Compares the vectorized HTML escaper with lt_write_htmlencoded, which it replaces for template values,
+// first for identical output and then for throughput. The scalar build of the escaper is checked and
+// timed alongside. The input mixes plain prose, markup-heavy text and user-supplied values.
+//
+// Usage: htmlescape [iterations]
+
+#include <lt/io.h>
+#include <lt/str.h>
+#include <lt/mem.h>
+#include <lt/time.h>
+#include <lt/html.h>
+
+#include "../src/htmlescape.h"
+
+static const char* samples[] = {
+	"Lorem ipsum etiam ad sem pharetra eget id congue, tortor aptent donec magna eu habitasse et, ad enim dolor "
+	"sapien consequat luctus leo. Cubilia dictum et convallis tristique nulla scelerisque sed lobortis ullamcorper, "
+	"a feugiat cubilia dui quisque nulla phasellus curae feugiat, bibendum ante pharetra rhoncus ligula aptent.",
+
+	"if (a < b && b > c) { printf(\"%d\\n\", a); } // don't <escape> \"this\" & 'that'",
+
+	"Fish & Chips",
+	"user@example.com",
+	"/public/images/2024/holiday photos/IMG_0042.jpg",
+	"<script>alert('hi')</script>",
+};
+
+#define SAMPLE_COUNT (sizeof(samples) / sizeof(*samples))
+
+typedef
+struct output {
+	char* buf;
+	usz len;
+	usz size;
+} output_t;
+
+static
+isz write_output(output_t* out, const void* data, usz len) {
+	if (out->len + len > out->size) {
+		return -1;
+	}
+	memcpy(out->buf + out->len, data, len);
+	out->len += len;
+	return len;
+}
+
+// counts instead of storing, so the timed loops measure the escaper rather than memcpy
+static
+isz write_count(usz* total, const void* data, usz len) {
+	*total += len + ((const u8*)data)[0];
+	return len;
+}
+
+typedef isz (*escape_fn_t)(lt_write_fn_t callb, void* usr, lstr_t str);
+
+static
+b8 check_equal(escape_fn_t escape, lstr_t str) {
+	static char buf_a[LT_KB(64)], buf_b[LT_KB(64)];
+	output_t a = { .buf = buf_a, .size = sizeof(buf_a) };
+	output_t b = { .buf = buf_b, .size = sizeof(buf_b) };
+
+	escape((lt_write_fn_t)write_output, &a, str);
+	lt_write_htmlencoded((lt_write_fn_t)write_output, &b, str);
+	return a.len == b.len && memcmp(a.buf, b.buf, a.len) == 0;
+}
+
+static
+void check_all(escape_fn_t escape, const char* name, lstr_t str) {
+	if (!check_equal(escape, str)) {
+		lt_ferrf("%s output differs from lt_write_htmlencoded for '%S'\n", name, str);
+	}
+}
+
+static
+u64 time_escape(escape_fn_t escape, u64 iterations, const lstr_t* strs, usz count, usz* total) {
+	u64 start = lt_hfreq_time_nsec();
+	for (u64 i = 0; i < iterations; ++i) {
+		for (usz j = 0; j < count; ++j) {
+			escape((lt_write_fn_t)write_count, total, strs[j]);
+		}
+	}
+	return lt_hfreq_time_nsec() - start;
+}
+
+static
+u64 next_random(u64* state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+int main(int argc, char** argv) {
+	u64 iterations = 200000;
+	if (argc > 1 && lt_lstou(lt_lsfroms(argv[1]), &iterations)) {
+		lt_ferrf("usage: htmlescape [iterations]\n");
+	}
+
+	// every length and alignment up to a few vectors, with special characters at random positions
+	static char random_buf[512];
+	u64 state = 0x9E3779B97F4A7C15;
+	for (usz round = 0; round < 20000; ++round) {
+		usz offset = next_random(&state) % 64;
+		usz len = next_random(&state) % (sizeof(random_buf) - 64);
+		for (usz i = 0; i < offset + len; ++i) {
+			u64 r = next_random(&state);
+			random_buf[i] = r % 23 == 0 ? "<>&'\""[r % 5] : 'a' + r % 26;
+		}
+		lstr_t str = LSTR(random_buf + offset, len);
+		check_all(html_write_escaped, "vectorized", str);
+		check_all(html_write_escaped_scalar, "scalar", str);
+	}
+	for (usz i = 0; i < SAMPLE_COUNT; ++i) {
+		lstr_t str = lt_lsfroms((char*)samples[i]);
+		check_all(html_write_escaped, "vectorized", str);
+		check_all(html_write_escaped_scalar, "scalar", str);
+	}
+
+	lstr_t sample_strs[SAMPLE_COUNT];
+	usz bytes_per_round = 0;
+	for (usz i = 0; i < SAMPLE_COUNT; ++i) {
+		sample_strs[i] = lt_lsfroms((char*)samples[i]);
+		bytes_per_round += sample_strs[i].len;
+	}
+
+	volatile usz sink = 0;
+	usz total = 0;
+
+	u64 lt_nsec = time_escape(lt_write_htmlencoded, iterations, sample_strs, SAMPLE_COUNT, &total);
+	u64 scalar_nsec = time_escape(html_write_escaped_scalar, iterations, sample_strs, SAMPLE_COUNT, &total);
+	u64 vector_nsec = time_escape(html_write_escaped, iterations, sample_strs, SAMPLE_COUNT, &total);
+	sink += total;
+
+	u64 bytes = iterations * bytes_per_round;
+	lt_printf("output identical, %uq bytes escaped per run\n", bytes);
+	lt_printf("lt:          %uq ns total, %uq MB/s\n", lt_nsec, bytes * 1000 / (lt_nsec ? lt_nsec : 1));
+	lt_printf("scalar:      %uq ns total, %uq MB/s\n", scalar_nsec, bytes * 1000 / (scalar_nsec ? scalar_nsec : 1));
+	lt_printf("vectorized:  %uq ns total, %uq MB/s\n", vector_nsec, bytes * 1000 / (vector_nsec ? vector_nsec : 1));
+
+	(void)sink;
+	return 0;
+}
@@ -0,0 +1,89 @@
+// Times the markdown renderer over a corpus of documents, with the vectorized scanning kernels from
+// bytescan.h and with a copy of the renderer built with BYTESCAN_SCALAR (lt_md_render_scalar).
+// Both have to produce identical output.
+//
+// Usage: mdrender [iterations] [file...]
+//
+// Renders README.md if no file is given.
+
+#include <lt/io.h>
+#include <lt/str.h>
+#include <lt/mem.h>
+#include <lt/time.h>
+#include <lt/strstream.h>
+
+#include "../src/markdown.h"
+
+void lt_md_render_scalar(lstr_t markdown, lstr_t link_base, lt_write_fn_t callb, void* usr);
+
+typedef void (*render_fn_t)(lstr_t markdown, lstr_t link_base, lt_write_fn_t callb, void* usr);
+
+// counts instead of storing, so the timed loops measure the renderer rather than the output buffer
+static
+isz write_count(usz* total, const void* data, usz len) {
+	*total += len;
+	return len;
+}
+
+static
+u64 time_render(render_fn_t render, lstr_t* docs, usz doc_count, u64 iterations, usz* out_total) {
+	u64 start = lt_hfreq_time_nsec();
+	for (u64 i = 0; i < iterations; ++i) {
+		for (usz j = 0; j < doc_count; ++j) {
+			render(docs[j], CLSTR("/docs"), (lt_write_fn_t)write_count, out_total);
+		}
+	}
+	return lt_hfreq_time_nsec() - start;
+}
+
+int main(int argc, char** argv) {
+	u64 iterations = 1000;
+	if (argc > 1 && lt_lstou(lt_lsfroms(argv[1]), &iterations)) {
+		lt_ferrf("usage: mdrender [iterations] [file...]\n");
+	}
+
+	char* default_paths[] = { "README.md" };
+	char** paths = argc > 2 ? argv + 2 : default_paths;
+	usz doc_count = argc > 2 ? argc - 2 : 1;
+
+	lstr_t* docs = lt_malloc(lt_libc_heap, doc_count * sizeof(lstr_t));
+	if (!docs) {
+		lt_ferrf("failed to allocate document array\n");
+	}
+
+	usz corpus_size = 0;
+	for (usz i = 0; i < doc_count; ++i) {
+		if (lt_freadallp_utf8(lt_lsfroms(paths[i]), &docs[i], lt_libc_heap)) {
+			lt_ferrf("failed to read '%s'\n", paths[i]);
+		}
+		corpus_size += docs[i].len;
+
+		lt_strstream_t vector_out, scalar_out;
+		LT_ASSERT(lt_strstream_create(&vector_out, lt_libc_heap) == LT_SUCCESS);
+		LT_ASSERT(lt_strstream_create(&scalar_out, lt_libc_heap) == LT_SUCCESS);
+		lt_md_render(docs[i], CLSTR("/docs"), (lt_write_fn_t)lt_strstream_write, &vector_out);
+		lt_md_render_scalar(docs[i], CLSTR("/docs"), (lt_write_fn_t)lt_strstream_write, &scalar_out);
+		if (!lt_lseq(vector_out.str, scalar_out.str)) {
+			lt_ferrf("output mismatch for '%s'\n", paths[i]);
+		}
+		lt_strstream_destroy(&vector_out);
+		lt_strstream_destroy(&scalar_out);
+	}
+
+	volatile usz sink = 0;
+	usz total = 0;
+
+	u64 scalar_nsec = time_render(lt_md_render_scalar, docs, doc_count, iterations, &total);
+	sink += total;
+	total = 0;
+	u64 vector_nsec = time_render(lt_md_render, docs, doc_count, iterations, &total);
+	sink += total;
+
+	u64 bytes = iterations * corpus_size;
+	lt_printf("%uz documents, %uz bytes, output identical\n", doc_count, corpus_size);
+	lt_printf("scalar scan:      %uq ns total, %uq MB/s\n", scalar_nsec, bytes * 1000 / (scalar_nsec ? scalar_nsec : 1));
+	lt_printf("vectorized scan:  %uq ns total, %uq MB/s\n", vector_nsec, bytes * 1000 / (vector_nsec ? vector_nsec : 1));
+
+	(void)sink;
+	return 0;
+}
@@ -0,0 +1,81 @@
+// Compares the generated perfect hash in mime.c with the chain of suffix compares it replaced.
+// The chain is rebuilt from the same table and checked in table order, like the old code did.
+//
+// Usage: mimelookup [iterations]
+
+#include <lt/io.h>
+#include <lt/str.h>
+#include <lt/mem.h>
+#include <lt/time.h>
+
+#include "../src/mime.h"
+
+static lstr_t* suffixes;
+
+static
+lstr_t mime_type_chain(lstr_t path, lstr_t def) {
+	for (usz i = 0; i < mime_table_count; ++i) {
+		if (lt_lssuffix(path, suffixes[i])) {
+			return mime_table[i].mime_type;
+		}
+	}
+	return def;
+}
+
+static const char* paths[] = {
+	"/public/favicon.png",
+	"/index.html",
+	"/css/style.css",
+	"/js/main.js",
+	"/img/photo.jpg",
+	"/fonts/inter.woff2",
+	"/downloads/archive.zip",
+	"/docs/readme.md",
+	"/src/server.c",
+	"/unknown.extension",
+};
+
+#define PATH_COUNT (sizeof(paths) / sizeof(*paths))
+
+int main(int argc, char** argv) {
+	u64 iterations = 1000000;
+	if (argc > 1 && lt_lstou(lt_lsfroms(argv[1]), &iterations)) {
+		lt_ferrf("usage: mimelookup [iterations]\n");
+	}
+
+	suffixes = lt_malloc(lt_libc_heap, mime_table_count * sizeof(lstr_t));
+	if (!suffixes) {
+		lt_ferrf("failed to allocate suffix table\n");
+	}
+	for (usz i = 0; i < mime_table_count; ++i) {
+		suffixes[i] = lt_lsbuild(lt_libc_heap, ".%S", mime_table[i].extension);
+	}
+
+	lstr_t path_strs[PATH_COUNT];
+	for (usz i = 0; i < PATH_COUNT; ++i) {
+		path_strs[i] = lt_lsfroms((char*)paths[i]);
+	}
+
+	// accumulate the results so the lookups can not be optimized out
+	volatile usz sink = 0;
+	lstr_t def = CLSTR("application/octet-stream");
+
+	u64 start = lt_hfreq_time_nsec();
+	for (u64 i = 0; i < iterations; ++i) {
+		sink += mime_type_chain(path_strs[i % PATH_COUNT], def).len;
+	}
+	u64 chain_nsec = lt_hfreq_time_nsec() - start;
+
+	start = lt_hfreq_time_nsec();
+	for (u64 i = 0; i < iterations; ++i) {
+		sink += mime_type_or_default(path_strs[i % PATH_COUNT], def).len;
+	}
+	u64 hash_nsec = lt_hfreq_time_nsec() - start;
+
+	lt_printf("%uq lookups over %uz table entries\n", iterations, mime_table_count);
+	lt_printf("suffix chain:  %uq ns total, %uq ps/lookup\n", chain_nsec, chain_nsec * 1000 / (iterations ? iterations : 1));
+	lt_printf("perfect hash:  %uq ns total, %uq ps/lookup\n", hash_nsec, hash_nsec * 1000 / (iterations ? iterations : 1));
+
+	(void)sink;
+	return 0;
+}
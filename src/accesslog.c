@@ -0,0 +1,290 @@
+#include <lt/io.h>
+#include <lt/mem.h>
+#include <lt/str.h>
+#include <lt/http.h>
+#include <lt/thread.h>
+#include <lt/strstream.h>
+
+#include "accesslog.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define WRITER_IDLE_MSEC 10
+#define WRITER_BATCH_SIZE 256
+
+u64 access_log_time_nsec(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (u64)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+lt_err_t access_log_create(access_log_t out_log[static 1], usz ring_count, usz ring_size) {
+	LT_ASSERT(ring_size && (ring_size & (ring_size - 1)) == 0);
+
+	out_log->fd = -1;
+	out_log->file_size = 0;
+	out_log->done = 0;
+	out_log->writer_thread = NULL;
+
+	out_log->rings = lt_malloc(lt_libc_heap, ring_count * sizeof(access_ring_t));
+	if (!out_log->rings) {
+		return LT_ERR_OUT_OF_MEMORY;
+	}
+	lt_mzero(out_log->rings, ring_count * sizeof(access_ring_t));
+	out_log->ring_count = ring_count;
+
+	for (usz i = 0; i < ring_count; ++i) {
+		access_ring_t* ring = &out_log->rings[i];
+		ring->records = lt_malloc(lt_libc_heap, ring_size * sizeof(access_record_t));
+		if (!ring->records) {
+			access_log_destroy(out_log);
+			return LT_ERR_OUT_OF_MEMORY;
+		}
+		ring->mask = ring_size - 1;
+	}
+	return LT_SUCCESS;
+}
+
+// returns NULL if the ring is full, records are dropped rather than stalling the producer
+access_record_t* access_ring_reserve(access_ring_t ring[static 1]) {
+	usz head = ring->head;
+	if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) > ring->mask) {
+		__atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+	return &ring->records[head & ring->mask];
+}
+
+void access_ring_commit(access_ring_t ring[static 1]) {
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+void access_record_set_text(access_record_t record[static 1], lstr_t text) {
+	usz len = lt_min(text.len, sizeof(record->text));
+	memcpy(record->text, text.str, len);
+	record->text_len = len;
+}
+
+// write function that appends to the text of a record, whatever does not fit is cut off
+isz access_record_write_text(access_record_t record[static 1], const void* data, usz len) {
+	usz avail = sizeof(record->text) - lt_min(record->text_len, sizeof(record->text));
+	usz copy = lt_min(len, avail);
+	memcpy(record->text + record->text_len, data, copy);
+	record->text_len += copy;
+	return len;
+}
+
+void access_record_write(lt_write_fn_t callb, void* usr, const access_record_t record[static 1]) {
+	time_t sec = record->time_nsec / 1000000000;
+	struct tm tm;
+	gmtime_r(&sec, &tm);
+
+	char time_buf[32];
+	usz time_len = strftime(time_buf, sizeof(time_buf), "%Y-%m-%d %H:%M:%S", &tm);
+	lstr_t time_str = LSTR(time_buf, time_len);
+	lstr_t text = LSTR((char*)record->text, lt_min(record->text_len, sizeof(record->text)));
+	u32 addr = record->addr;
+
+	switch (record->type) {
+	case ACCESS_ACCEPT:
+		lt_io_printf(callb, usr, "%S [C_%hd] accepted incoming connection from %ub.%ub.%ub.%ub:%uw\n", time_str, addr,
+				(addr >> 24), (addr >> 16) & 0xFF, (addr >> 8) & 0xFF, addr & 0xFF, record->port);
+		break;
+
+	case ACCESS_REQUEST:
+		lt_io_printf(callb, usr, "%S [C_%hd] HTTP/%uw.%uw %S %S %uw %udus\n", time_str, addr,
+				record->version_major, record->version_minor, lt_http_method_str(record->method), text,
+				record->status, record->duration_usec);
+		break;
+
+	case ACCESS_ERROR:
+		lt_io_printf(callb, usr, "%S [C_%hd] %S\n", time_str, addr, text);
+		break;
+
+	default:
+		lt_io_printf(callb, usr, "%S invalid record type %ub\n", time_str, record->type);
+		break;
+	}
+}
+
+static
+b8 write_all(int fd, const void* data, usz size) {
+	const u8* it = data;
+	while (size) {
+		isz res = write(fd, it, size);
+		if (res < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return 0;
+		}
+		it += res;
+		size -= res;
+	}
+	return 1;
+}
+
+static
+lt_err_t open_log_file(access_log_t log[static 1]) {
+	char path[LT_PATH_MAX];
+	lt_sprintf(path, "%S%c", log->path, 0);
+
+	log->fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (log->fd < 0) {
+		return lt_errno();
+	}
+
+	struct stat st;
+	log->file_size = fstat(log->fd, &st) == 0 ? st.st_size : 0;
+	if (log->file_size == 0) {
+		write_all(log->fd, ACCESS_LOG_MAGIC, 8);
+		log->file_size = 8;
+	}
+	return LT_SUCCESS;
+}
+
+// shifts 'path.N-1' to 'path.N' down to 'path' to 'path.1', the oldest file falls off the end
+static
+void rotate_log_file(access_log_t log[static 1]) {
+	close(log->fd);
+	log->fd = -1;
+
+	char from[LT_PATH_MAX], to[LT_PATH_MAX];
+	for (usz i = log->rotate_count; i > 0; --i) {
+		if (i == 1) {
+			lt_sprintf(from, "%S%c", log->path, 0);
+		}
+		else {
+			lt_sprintf(from, "%S.%uz%c", log->path, i - 1, 0);
+		}
+		lt_sprintf(to, "%S.%uz%c", log->path, i, 0);
+		rename(from, to);
+	}
+
+	lt_err_t err;
+	if ((err = open_log_file(log))) {
+		lt_werrf("failed to reopen access log '%S': %S\n", log->path, lt_err_str(err));
+	}
+}
+
+static
+void write_binary(access_log_t log[static 1], const access_record_t* records, usz count) {
+	if (log->fd < 0) {
+		return;
+	}
+	if (log->max_file_size && log->file_size + count * sizeof(access_record_t) > log->max_file_size) {
+		rotate_log_file(log);
+		if (log->fd < 0) {
+			return;
+		}
+	}
+	if (write_all(log->fd, records, count * sizeof(access_record_t))) {
+		log->file_size += count * sizeof(access_record_t);
+	}
+}
+
+static
+usz drain_ring(access_log_t log[static 1], access_ring_t ring[static 1], lt_strstream_t ss[static 1]) {
+	usz tail = ring->tail;
+	usz head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	usz count = lt_min(head - tail, WRITER_BATCH_SIZE);
+
+	for (usz i = 0; i < count;) {
+		// records are contiguous up to the end of the ring
+		usz index = (tail + i) & ring->mask;
+		usz run = lt_min(count - i, ring->mask + 1 - index);
+
+		if (log->sink == ACCESS_LOG_FILE) {
+			write_binary(log, &ring->records[index], run);
+		}
+		else {
+			for (usz j = 0; j < run; ++j) {
+				access_record_write((lt_write_fn_t)lt_strstream_write, ss, &ring->records[index + j]);
+			}
+		}
+		i += run;
+	}
+
+	__atomic_store_n(&ring->tail, tail + count, __ATOMIC_RELEASE);
+	return count;
+}
+
+static
+void writer_proc(access_log_t* log) {
+	lt_strstream_t ss;
+	LT_ASSERT(lt_strstream_create(&ss, lt_libc_heap) == LT_SUCCESS);
+
+	usz reported_drops = 0;
+
+	for (;;) {
+		b8 done = log->done;
+
+		usz count = 0, dropped = 0;
+		for (usz i = 0; i < log->ring_count; ++i) {
+			count += drain_ring(log, &log->rings[i], &ss);
+			dropped += __atomic_load_n(&log->rings[i].dropped, __ATOMIC_RELAXED);
+		}
+
+		if (dropped != reported_drops) {
+			lt_io_printf((lt_write_fn_t)lt_strstream_write, &ss, "access log ring overflow, %uz records dropped in total\n", dropped);
+			reported_drops = dropped;
+		}
+		if (ss.str.len) {
+			write_all(STDERR_FILENO, ss.str.str, ss.str.len);
+			lt_strstream_clear(&ss);
+		}
+
+		if (!count) {
+			// one last pass after the flag was set catches everything logged before the producers stopped
+			if (done) {
+				break;
+			}
+			lt_sleep_msec(WRITER_IDLE_MSEC);
+		}
+	}
+
+	lt_strstream_destroy(&ss);
+}
+
+lt_err_t access_log_start(access_log_t log[static 1]) {
+	lt_err_t err;
+
+	if (log->sink == ACCESS_LOG_NONE) {
+		return LT_SUCCESS;
+	}
+	if (log->sink == ACCESS_LOG_FILE && (err = open_log_file(log))) {
+		return err;
+	}
+
+	log->writer_thread = lt_thread_create((lt_thread_fn_t)writer_proc, log, lt_libc_heap);
+	if (!log->writer_thread) {
+		return LT_ERR_UNKNOWN;
+	}
+	return LT_SUCCESS;
+}
+
+void access_log_destroy(access_log_t log[static 1]) {
+	if (log->writer_thread) {
+		log->done = 1;
+		lt_thread_join(log->writer_thread, lt_libc_heap);
+		log->writer_thread = NULL;
+	}
+	if (log->fd >= 0) {
+		close(log->fd);
+		log->fd = -1;
+	}
+
+	for (usz i = 0; i < log->ring_count; ++i) {
+		if (log->rings[i].records) {
+			lt_mfree(lt_libc_heap, log->rings[i].records);
+		}
+	}
+	lt_mfree(lt_libc_heap, log->rings);
+	log->rings = NULL;
+	log->ring_count = 0;
+}
@@ -0,0 +1,85 @@
+#ifndef ACCESSLOG_H
+#define ACCESSLOG_H 1
+
+#include <lt/lt.h>
+#include <lt/io.h>
+#include <lt/thread.h>
+
+// accesslog.c
+
+typedef
+enum access_log_sink {
+	ACCESS_LOG_STDERR = 0, // formatted text
+	ACCESS_LOG_FILE,       // binary records, rotated by size, see tools/logdecode.c
+	ACCESS_LOG_NONE,
+} access_log_sink_t;
+
+typedef
+enum access_record_type {
+	ACCESS_ACCEPT = 1,
+	ACCESS_REQUEST,
+	ACCESS_ERROR,
+} access_record_type_t;
+
+#define ACCESS_LOG_MAGIC "LWSLOG01"
+#define ACCESS_RECORD_SIZE 128
+
+// fixed size so that rings and files can be indexed directly. the file format is the in-memory layout,
+// logs are meant to be decoded on the machine that wrote them.
+typedef
+struct access_record {
+	u64 time_nsec; // CLOCK_REALTIME
+	u32 duration_usec;
+	u32 addr;
+	u16 port;
+	u16 status;
+	u8 type;
+	u8 method;
+	u8 version_major;
+	u8 version_minor;
+	u16 text_len;
+	char text[ACCESS_RECORD_SIZE - 26]; // request target or error message, truncated
+} access_record_t;
+
+_Static_assert(sizeof(access_record_t) == ACCESS_RECORD_SIZE, "access_record_t must be ACCESS_RECORD_SIZE bytes");
+
+// single-producer/single-consumer ring, every thread that logs owns one
+typedef
+struct access_ring {
+	access_record_t* records;
+	usz mask;
+	volatile usz head;
+	volatile usz tail;
+	volatile usz dropped;
+} access_ring_t;
+
+typedef
+struct access_log {
+	access_log_sink_t sink;
+	lstr_t path;
+	usz max_file_size;
+	usz rotate_count;
+
+	access_ring_t* rings;
+	usz ring_count;
+
+	int fd;
+	usz file_size;
+	volatile b8 done;
+	lt_thread_t* writer_thread;
+} access_log_t;
+
+lt_err_t access_log_create(access_log_t out_log[static 1], usz ring_count, usz ring_size);
+void access_log_destroy(access_log_t log[static 1]);
+lt_err_t access_log_start(access_log_t log[static 1]);
+
+access_record_t* access_ring_reserve(access_ring_t ring[static 1]);
+void access_ring_commit(access_ring_t ring[static 1]);
+
+void access_record_set_text(access_record_t record[static 1], lstr_t text);
+isz access_record_write_text(access_record_t record[static 1], const void* data, usz len);
+void access_record_write(lt_write_fn_t callb, void* usr, const access_record_t record[static 1]);
+
+u64 access_log_time_nsec(void);
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef BYTESCAN_H
+#define BYTESCAN_H 1
+
+#include <lt/lt.h>
+
+#include <string.h>
+
+// BYTESCAN_SCALAR forces the byte-at-a-time loops, bench/mdrender builds a copy of the markdown renderer with it
+#if defined(__AVX2__) && !defined(BYTESCAN_SCALAR)
+#	include <immintrin.h>
+#	define BYTESCAN_AVX2 1
+#elif defined(__ARM_NEON) && defined(__aarch64__) && !defined(BYTESCAN_SCALAR)
+#	include <arm_neon.h>
+#	define BYTESCAN_NEON 1
+#endif
+
+// a set of byte values that can be classified 32 (AVX2) or 16 (NEON) at a time with two table lookups.
+// the high nibbles of all members can fall into at most 8 distinct values.
+typedef
+struct byte_set {
+	u8 lo[16]; // for every low nibble, the high nibble groups that have a member with it
+	u8 hi[16]; // the group bit of every high nibble
+	b8 member[256];
+} byte_set_t;
+
+static LT_INLINE
+void byte_set_init(byte_set_t set[static 1], const char* chars) {
+	memset(set, 0, sizeof(*set));
+
+	u8 groups = 0;
+	for (const u8* it = (const u8*)chars; *it; ++it) {
+		u8 hi = *it >> 4, lo = *it & 0x0F;
+		if (!set->hi[hi]) {
+			LT_ASSERT(groups < 8);
+			set->hi[hi] = 1 << groups++;
+		}
+		set->lo[lo] |= set->hi[hi];
+		set->member[*it] = 1;
+	}
+}
+
+// returns the number of leading bytes for which membership differs from stop_at_member
+static LT_INLINE
+usz byte_set_scan_(const byte_set_t set[static 1], const char* str, usz len, b8 stop_at_member) {
+	usz i = 0;
+
+#if defined(BYTESCAN_AVX2)
+	const __m256i lo_tab = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)set->lo));
+	const __m256i hi_tab = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)set->hi));
+	const __m256i nibble = _mm256_set1_epi8(0x0F);
+
+	for (; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(str + i));
+		__m256i lo = _mm256_shuffle_epi8(lo_tab, _mm256_and_si256(v, nibble));
+		__m256i hi = _mm256_shuffle_epi8(hi_tab, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+		u32 miss = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(lo, hi), _mm256_setzero_si256()));
+		u32 stop = stop_at_member ? ~miss : miss;
+		if (stop) {
+			return i + __builtin_ctz(stop);
+		}
+	}
+#elif defined(BYTESCAN_NEON)
+	const uint8x16_t lo_tab = vld1q_u8(set->lo);
+	const uint8x16_t hi_tab = vld1q_u8(set->hi);
+	const uint8x16_t nibble = vdupq_n_u8(0x0F);
+
+	for (; i + 16 <= len; i += 16) {
+		uint8x16_t v = vld1q_u8((const u8*)str + i);
+		uint8x16_t hit = vtstq_u8(vqtbl1q_u8(lo_tab, vandq_u8(v, nibble)), vqtbl1q_u8(hi_tab, vshrq_n_u8(v, 4)));
+		if (!stop_at_member) {
+			hit = vmvnq_u8(hit);
+		}
+		// narrows every byte to a nibble, the first set nibble is the first stop
+		u64 stop = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(hit), 4)), 0);
+		if (stop) {
+			return i + (__builtin_ctzll(stop) >> 2);
+		}
+	}
+#endif
+
+	while (i < len && set->member[(u8)str[i]] != stop_at_member) {
+		++i;
+	}
+	return i;
+}
+
+// returns the number of leading bytes that are not in the set
+static LT_INLINE
+usz byte_set_span(const byte_set_t set[static 1], const char* str, usz len) {
+	return byte_set_scan_(set, str, len, 1);
+}
+
+// returns the number of leading bytes that are in the set
+static LT_INLINE
+usz byte_set_span_members(const byte_set_t set[static 1], const char* str, usz len) {
+	return byte_set_scan_(set, str, len, 0);
+}
+
+// returns the offset of the first c, or len
+static LT_INLINE
+usz byte_find(const char* str, usz len, char c) {
+#ifdef BYTESCAN_SCALAR
+	usz i = 0;
+	while (i < len && str[i] != c) {
+		++i;
+	}
+	return i;
+#else
+	// libc's memchr is vectorized already
+	const char* found = memchr(str, c, len);
+	return found ? (usz)(found - str) : len;
+#endif
+}
+
+// returns the offset of the first occurrence of needle, or len
+static LT_INLINE
+usz byte_find_str(const char* str, usz len, lstr_t needle) {
+	if (!needle.len) {
+		return 0;
+	}
+
+	usz i = 0;
+	while (i + needle.len <= len) {
+		i += byte_find(str + i, len - i - needle.len + 1, needle.str[0]);
+		if (i + needle.len > len) {
+			break;
+		}
+		if (memcmp(str + i, needle.str, needle.len) == 0) {
+			return i;
+		}
+		++i;
+	}
+	return len;
+}
+
+#endif
@@ -0,0 +1,174 @@
+#include <lt/mem.h>
+#include <lt/str.h>
+
+#include "clockcache.h"
+
+lt_err_t clock_cache_create(clock_cache_t out_cache[static 1], usz bucket_count, usz max_size) {
+	lt_mzero(out_cache, sizeof(*out_cache));
+
+	out_cache->buckets = lt_malloc(lt_libc_heap, bucket_count * sizeof(clock_entry_t*));
+	if (!out_cache->buckets) {
+		return LT_ERR_OUT_OF_MEMORY;
+	}
+	lt_mzero(out_cache->buckets, bucket_count * sizeof(clock_entry_t*));
+	out_cache->bucket_mask = bucket_count - 1;
+
+	out_cache->clock = lt_darr_create(clock_entry_t*, 256, lt_libc_heap);
+	if (!out_cache->clock) {
+		lt_mfree(lt_libc_heap, out_cache->buckets);
+		return LT_ERR_OUT_OF_MEMORY;
+	}
+
+	pthread_rwlock_init(&out_cache->lock, NULL);
+	out_cache->max_size = max_size;
+	return LT_SUCCESS;
+}
+
+void clock_entry_release(clock_entry_t* entry) {
+	if (__atomic_sub_fetch(&entry->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+		lt_mfree(lt_libc_heap, entry);
+	}
+}
+
+void clock_cache_destroy(clock_cache_t cache[static 1]) {
+	for (usz i = 0; i < lt_darr_count(cache->clock); ++i) {
+		clock_entry_release(cache->clock[i]);
+	}
+	lt_darr_destroy(cache->clock);
+	lt_mfree(lt_libc_heap, cache->buckets);
+	pthread_rwlock_destroy(&cache->lock);
+}
+
+// must be called with the write lock held. the last entry of the clock array takes the place of the removed one.
+static
+void unlink_entry(clock_cache_t cache[static 1], clock_entry_t* entry) {
+	clock_entry_t** it = &cache->buckets[entry->hash & cache->bucket_mask];
+	while (*it != entry) {
+		it = &(*it)->next;
+	}
+	*it = entry->next;
+
+	clock_entry_t* last = cache->clock[lt_darr_count(cache->clock) - 1];
+	cache->clock[entry->clock_index] = last;
+	last->clock_index = entry->clock_index;
+	lt_darr_pop(cache->clock);
+	if (cache->clock_hand >= lt_darr_count(cache->clock)) {
+		cache->clock_hand = 0;
+	}
+
+	cache->size -= entry->footprint;
+	clock_entry_release(entry);
+}
+
+// must be called with the write lock held
+static
+void evict_for(clock_cache_t cache[static 1], usz size) {
+	while (cache->size + size > cache->max_size && lt_darr_count(cache->clock)) {
+		clock_entry_t* entry = cache->clock[cache->clock_hand];
+		if (__atomic_exchange_n(&entry->referenced, 0, __ATOMIC_RELAXED)) {
+			cache->clock_hand = (cache->clock_hand + 1) % lt_darr_count(cache->clock);
+			continue;
+		}
+
+		unlink_entry(cache, entry);
+		__atomic_fetch_add(&cache->evictions, 1, __ATOMIC_RELAXED);
+	}
+}
+
+static
+clock_entry_t* find_entry(clock_cache_t cache[static 1], u32 hash, lstr_t key) {
+	for (clock_entry_t* it = cache->buckets[hash & cache->bucket_mask]; it; it = it->next) {
+		if (it->hash == hash && lt_lseq(it->key, key)) {
+			return it;
+		}
+	}
+	return NULL;
+}
+
+// returns the entry with a reference for the caller. expired entries are reported as misses,
+// and replaced by the next insert with the same key.
+clock_entry_t* clock_cache_get(clock_cache_t cache[static 1], lstr_t key, u64 now_msec) {
+	u32 hash = lt_hashls(key);
+
+	pthread_rwlock_rdlock(&cache->lock);
+	clock_entry_t* entry = find_entry(cache, hash, key);
+	if (entry && entry->expires_msec && entry->expires_msec <= now_msec) {
+		entry = NULL;
+	}
+	if (entry) {
+		__atomic_fetch_add(&entry->refs, 1, __ATOMIC_RELAXED);
+		if (!entry->referenced) {
+			__atomic_store_n(&entry->referenced, 1, __ATOMIC_RELAXED);
+		}
+	}
+	pthread_rwlock_unlock(&cache->lock);
+
+	__atomic_fetch_add(entry ? &cache->hits : &cache->misses, 1, __ATOMIC_RELAXED);
+	return entry;
+}
+
+// entry has to hold two references, one for the cache and one for the caller, and its hash, key and footprint
+// have to be set. the returned entry holds one reference for the caller. if an entry with the same key exists,
+// it is either replaced or returned instead of entry.
+// generation has to be read before the contents of entry were, an entry created against an older
+// generation might be outdated and is returned without being cached.
+clock_entry_t* clock_cache_insert(clock_cache_t cache[static 1], clock_entry_t* entry, u64 generation, b8 replace) {
+	pthread_rwlock_wrlock(&cache->lock);
+
+	if (__atomic_load_n(&cache->generation, __ATOMIC_ACQUIRE) != generation) {
+		pthread_rwlock_unlock(&cache->lock);
+		entry->refs = 1;
+		return entry;
+	}
+
+	clock_entry_t* existing = find_entry(cache, entry->hash, entry->key);
+	if (existing && !replace) {
+		__atomic_fetch_add(&existing->refs, 1, __ATOMIC_RELAXED);
+		pthread_rwlock_unlock(&cache->lock);
+		lt_mfree(lt_libc_heap, entry);
+		return existing;
+	}
+	if (existing) {
+		unlink_entry(cache, existing);
+	}
+
+	evict_for(cache, entry->footprint);
+
+	usz bucket = entry->hash & cache->bucket_mask;
+	entry->next = cache->buckets[bucket];
+	cache->buckets[bucket] = entry;
+	entry->clock_index = lt_darr_count(cache->clock);
+	lt_darr_push(cache->clock, entry);
+	cache->size += entry->footprint;
+
+	pthread_rwlock_unlock(&cache->lock);
+	return entry;
+}
+
+void clock_cache_remove(clock_cache_t cache[static 1], lstr_t key) {
+	pthread_rwlock_wrlock(&cache->lock);
+	__atomic_fetch_add(&cache->generation, 1, __ATOMIC_RELEASE);
+
+	clock_entry_t* entry = find_entry(cache, lt_hashls(key), key);
+	if (entry) {
+		unlink_entry(cache, entry);
+	}
+
+	pthread_rwlock_unlock(&cache->lock);
+}
+
+// removes every entry match returns true for, match is called with the write lock held
+void clock_cache_remove_if(clock_cache_t cache[static 1], clock_match_fn_t match, void* usr) {
+	pthread_rwlock_wrlock(&cache->lock);
+	__atomic_fetch_add(&cache->generation, 1, __ATOMIC_RELEASE);
+
+	for (usz i = 0; i < lt_darr_count(cache->clock);) {
+		if (match(cache->clock[i], usr)) {
+			unlink_entry(cache, cache->clock[i]); // swaps the last entry into slot i
+			continue;
+		}
+		++i;
+	}
+
+	pthread_rwlock_unlock(&cache->lock);
+}
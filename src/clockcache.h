@@ -0,0 +1,62 @@
+#ifndef CLOCKCACHE_H
+#define CLOCKCACHE_H 1
+
+#include <lt/lt.h>
+#include <lt/darr.h>
+
+#include <pthread.h>
+
+// clockcache.c
+
+typedef struct clock_entry clock_entry_t;
+
+// placed at the start of the entries of a cache, which are allocated from lt_libc_heap in one block
+typedef
+struct clock_entry {
+	clock_entry_t* next;
+	u32 hash;
+	volatile u32 refs;
+	volatile b8 referenced;
+	usz clock_index; // position in the clock array, so that unlinking does not have to search it
+	usz footprint;
+	u64 expires_msec; // 0 if the entry is only removed explicitly or by eviction
+	lstr_t key;
+} clock_entry_t;
+
+// size-bounded hash table of refcounted entries, evicted with the CLOCK algorithm. lookups only
+// take the read side of the lock. generation is bumped by every removal, see clock_cache_insert.
+typedef
+struct clock_cache {
+	pthread_rwlock_t lock;
+	clock_entry_t** buckets;
+	usz bucket_mask;
+
+	lt_darr(clock_entry_t*) clock;
+	usz clock_hand;
+
+	usz size;
+	usz max_size;
+
+	volatile u64 generation;
+	volatile usz hits;
+	volatile usz misses;
+	volatile usz evictions;
+} clock_cache_t;
+
+typedef b8 (*clock_match_fn_t)(const clock_entry_t* entry, void* usr);
+
+lt_err_t clock_cache_create(clock_cache_t out_cache[static 1], usz bucket_count, usz max_size);
+void clock_cache_destroy(clock_cache_t cache[static 1]);
+
+clock_entry_t* clock_cache_get(clock_cache_t cache[static 1], lstr_t key, u64 now_msec);
+clock_entry_t* clock_cache_insert(clock_cache_t cache[static 1], clock_entry_t* entry, u64 generation, b8 replace);
+void clock_cache_remove(clock_cache_t cache[static 1], lstr_t key);
+void clock_cache_remove_if(clock_cache_t cache[static 1], clock_match_fn_t match, void* usr);
+
+static LT_INLINE
+u64 clock_cache_generation(clock_cache_t cache[static 1]) {
+	return __atomic_load_n(&cache->generation, __ATOMIC_ACQUIRE);
+}
+void clock_entry_release(clock_entry_t* entry);
+
+#endif
@@ -0,0 +1,245 @@
+#include <lt/io.h>
+#include <lt/str.h>
+
+#include "server.h"
+
+#include <sys/stat.h>
+
+#define FNV_OFFSET 0xCBF29CE484222325
+#define FNV_PRIME 0x100000001B3
+
+static
+u64 fnv1a(u64 hash, lstr_t str) {
+	for (usz i = 0; i < str.len; ++i) {
+		hash = (hash ^ (u8)str.str[i]) * FNV_PRIME;
+	}
+	return hash;
+}
+
+static
+u64 hash_pair(lstr_t key, lstr_t val) {
+	u64 hash = fnv1a(FNV_OFFSET, key);
+	hash = (hash ^ 0xFF) * FNV_PRIME; // separator, so that ('ab', 'c') and ('a', 'bc') differ
+	return fnv1a(hash, val);
+}
+
+static const char weekdays[7][4] = { "Thu", "Fri", "Sat", "Sun", "Mon", "Tue", "Wed" };
+static const char months[12][4] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+// days since 1970-01-01 of a proleptic gregorian date
+static
+i64 days_from_civil(i64 y, i64 m, i64 d) {
+	y -= m <= 2;
+	i64 era = (y >= 0 ? y : y - 399) / 400;
+	i64 yoe = y - era * 400;
+	i64 doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	i64 doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + doe - 719468;
+}
+
+static
+void civil_from_days(i64 z, i64 out_y[static 1], i64 out_m[static 1], i64 out_d[static 1]) {
+	z += 719468;
+	i64 era = (z >= 0 ? z : z - 146096) / 146097;
+	i64 doe = z - era * 146097;
+	i64 yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	i64 doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	i64 mp = (5 * doy + 2) / 153;
+	*out_d = doy - (153 * mp + 2) / 5 + 1;
+	*out_m = mp < 10 ? mp + 3 : mp - 9;
+	*out_y = yoe + era * 400 + (*out_m <= 2);
+}
+
+// IMF-fixdate, 'Sun, 06 Nov 1994 08:49:37 GMT'
+static
+lstr_t format_http_date(connection_t* conn, i64 sec) {
+	if (sec < 0) {
+		return NLSTR();
+	}
+
+	i64 days = sec / 86400, rem = sec % 86400;
+	i64 y, m, d;
+	civil_from_days(days, &y, &m, &d);
+
+	char* buf = lt_amalloc(conn->arena, 32);
+	if (!buf) {
+		return NLSTR();
+	}
+	usz len = lt_sprintf(buf, "%s, %c%c %s %iq %c%c:%c%c:%c%c GMT",
+			weekdays[days % 7], '0' + (char)(d / 10), '0' + (char)(d % 10), months[m - 1], y,
+			'0' + (char)(rem / 36000), '0' + (char)(rem / 3600 % 10),
+			'0' + (char)(rem / 600 % 6), '0' + (char)(rem / 60 % 10),
+			'0' + (char)(rem % 60 / 10), '0' + (char)(rem % 10));
+	return LSTR(buf, len);
+}
+
+static
+b8 parse_digits(char** it, char* end, usz count, i64 out_val[static 1]) {
+	i64 val = 0;
+	for (usz i = 0; i < count; ++i, ++*it) {
+		if (*it >= end || **it < '0' || **it > '9') {
+			return 0;
+		}
+		val = val * 10 + (**it - '0');
+	}
+	*out_val = val;
+	return 1;
+}
+
+static
+b8 parse_char(char** it, char* end, char c) {
+	if (*it >= end || **it != c) {
+		return 0;
+	}
+	++*it;
+	return 1;
+}
+
+// only IMF-fixdate is accepted, the obsolete formats are not sent by any current client
+b8 srv_parse_http_date(lstr_t str, i64 out_sec[static 1]) {
+	if (str.len != 29) {
+		return 0;
+	}
+
+	char* it = str.str + 5, *end = str.str + str.len;
+	i64 y, m = 0, d, hh, mm, ss;
+
+	if (!parse_digits(&it, end, 2, &d) || !parse_char(&it, end, ' ')) {
+		return 0;
+	}
+	for (usz i = 0; i < 12; ++i) {
+		if (memcmp(it, months[i], 3) == 0) {
+			m = i + 1;
+		}
+	}
+	it += 3;
+	if (!m || !parse_char(&it, end, ' ') || !parse_digits(&it, end, 4, &y) || !parse_char(&it, end, ' ') ||
+		!parse_digits(&it, end, 2, &hh) || !parse_char(&it, end, ':') ||
+		!parse_digits(&it, end, 2, &mm) || !parse_char(&it, end, ':') ||
+		!parse_digits(&it, end, 2, &ss) || memcmp(it, " GMT", 4) != 0)
+	{
+		return 0;
+	}
+
+	*out_sec = days_from_civil(y, m, d) * 86400 + hh * 3600 + mm * 60 + ss;
+	return 1;
+}
+
+static
+lstr_t opaque_tag(lstr_t tag) {
+	tag = lt_lstrim(tag);
+	if (lt_lsprefix(tag, CLSTR("W/"))) {
+		tag = LSTR(tag.str + 2, tag.len - 2);
+	}
+	return tag;
+}
+
+// If-None-Match uses the weak comparison function
+static
+b8 etag_list_matches(lstr_t list, lstr_t etag) {
+	etag = opaque_tag(etag);
+
+	for (char* it = list.str, *end = it + list.len; it < end;) {
+		char* start = it;
+		b8 quoted = 0;
+		while (it < end && (quoted || *it != ',')) {
+			if (*it == '"') {
+				quoted = !quoted;
+			}
+			++it;
+		}
+		lstr_t tag = lt_lstrim(lt_lsfrom_range(start, it++));
+
+		if (lt_lseq(tag, CLSTR("*")) || lt_lseq(opaque_tag(tag), etag)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void srv_set_validators(connection_t* conn, lstr_t etag, i64 mtime_sec) {
+	if (etag.len) {
+		lt_http_add_header(&conn->response, CLSTR("ETag"), etag);
+	}
+	if (mtime_sec >= 0) {
+		lstr_t date = format_http_date(conn, mtime_sec);
+		if (date.len) {
+			lt_http_add_header(&conn->response, CLSTR("Last-Modified"), date);
+		}
+	}
+}
+
+// evaluates If-None-Match/If-Modified-Since, and turns the response into a '304 Not Modified' if the
+// client's copy is still valid. validators that are not known can be passed as NLSTR() and -1 respectively.
+b8 srv_not_modified(connection_t* conn, lstr_t etag, i64 mtime_sec) {
+	lt_http_method_t method = conn->request.request_method;
+	if (method != LT_HTTP_GET && method != LT_HTTP_HEAD) {
+		return 0;
+	}
+
+	b8 not_modified = 0;
+
+	lstr_t* if_none_match = lt_http_find_header(&conn->request, CLSTR("If-None-Match"));
+	lstr_t* if_modified_since = lt_http_find_header(&conn->request, CLSTR("If-Modified-Since"));
+	i64 since;
+
+	// If-Modified-Since is ignored when If-None-Match is present
+	if (if_none_match) {
+		not_modified = etag.len && etag_list_matches(*if_none_match, etag);
+	}
+	else if (if_modified_since && mtime_sec >= 0 && srv_parse_http_date(lt_lstrim(*if_modified_since), &since)) {
+		not_modified = mtime_sec <= since;
+	}
+
+	if (not_modified) {
+		conn->response.response_status_code = 304;
+		conn->response.response_status_msg = CLSTR("Not Modified");
+		conn->response.body = NLSTR();
+	}
+	return not_modified;
+}
+
+// opt-in validation for template responses whose output only depends on the template itself, the
+// variables set with srv_set_var and the uri parameters. sets an ETag derived from all of these and
+// returns 1 if the client already has the current version, in which case rendering can be skipped.
+b8 srv_etag_template(connection_t* conn, lstr_t template_path) {
+	u64 hash = fnv1a(FNV_OFFSET, template_path);
+
+	// a compiled-in template is what gets rendered, so the file on disk does not matter
+	const compiled_entry_t* aot = template_find_compiled(conn, template_path);
+	if (aot) {
+		hash ^= aot->hash;
+	}
+	else {
+		char cpath[LT_PATH_MAX];
+		if (template_path.len >= sizeof(cpath)) {
+			return 0;
+		}
+		memcpy(cpath, template_path.str, template_path.len);
+		cpath[template_path.len] = 0;
+
+		struct stat st;
+		if (stat(cpath, &st) < 0) {
+			return 0;
+		}
+		hash ^= (u64)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+	}
+
+	// includes that are loaded at runtime are not tracked, so the process start time stands in for a
+	// deployment of new templates
+	hash = (hash ^ conn->server->start_time_nsec) * FNV_PRIME;
+
+	// summing the pair hashes makes the result independent of insertion order
+	u64 vars_hash = 0;
+	for (variable_t* var = conn->first_var; var; var = var->next) {
+		vars_hash += hash_pair(var->key, var->val);
+	}
+	for (usz i = 0; i < conn->uri.param_count; ++i) {
+		vars_hash += hash_pair(conn->uri.params[i].key, conn->uri.params[i].val) * FNV_PRIME;
+	}
+	hash = fnv1a(hash, LSTR((char*)&vars_hash, sizeof(vars_hash)));
+
+	lstr_t etag = lt_lsbuild(&conn->arena->interf, "\"t%hq\"", hash);
+	srv_set_validators(conn, etag, -1);
+	return srv_not_modified(conn, etag, -1);
+}
@@ -0,0 +1,515 @@
+#include <lt/strstream.h>
+#include <lt/mem.h>
+#include <lt/str.h>
+#include <lt/io.h>
+
+#include "dirindex.h"
+#include "htmlescape.h"
+
+static
+isz compare_names(lstr_t a, lstr_t b) {
+	int cmp = memcmp(a.str, b.str, a.len < b.len ? a.len : b.len);
+	if (cmp) {
+		return cmp;
+	}
+	return (isz)a.len - (isz)b.len;
+}
+
+// returns the position of the child with the given name, or where it would have to be inserted
+static
+usz find_child(const dir_node_t dir[static 1], lstr_t name, b8 out_found[static 1]) {
+	usz lo = 0, hi = dir->child_count;
+	while (lo < hi) {
+		usz mid = lo + (hi - lo) / 2;
+		isz cmp = compare_names(dir->children[mid]->name, name);
+		if (cmp == 0) {
+			*out_found = 1;
+			return mid;
+		}
+		if (cmp < 0) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	*out_found = 0;
+	return lo;
+}
+
+static
+b8 insert_child(dir_node_t dir[static 1], usz pos, dir_node_t* child) {
+	dir_node_t** children = lt_mrealloc(lt_libc_heap, dir->children, (dir->child_count + 1) * sizeof(dir_node_t*));
+	if (!children) {
+		return 0;
+	}
+	dir->children = children;
+
+	memmove(children + pos + 1, children + pos, (dir->child_count - pos) * sizeof(dir_node_t*));
+	children[pos] = child;
+	++dir->child_count;
+	return 1;
+}
+
+static
+void mark_dirty(dir_node_t* dir) {
+	while (dir && !dir->dirty) {
+		dir->dirty = 1;
+		dir = dir->parent;
+	}
+}
+
+static
+dir_node_t* node_create(dir_index_t index[static 1], dir_node_t* parent, lstr_t name, lstr_t path, b8 is_dir) {
+	dir_node_t* node = lt_malloc(lt_libc_heap, sizeof(dir_node_t));
+	if (!node) {
+		return NULL;
+	}
+
+	*node = (dir_node_t){
+			.index = index,
+			.parent = parent,
+			.name = lt_strdup(lt_libc_heap, name),
+			.path = lt_strdup(lt_libc_heap, path),
+			.level = parent && parent->parent ? parent->level + 1 : 0,
+			.is_dir = is_dir,
+			.wd = -1,
+			.dirty = is_dir };
+	return node;
+}
+
+static
+void remove_watch(dir_index_set_t set[static 1], dir_node_t node[static 1]) {
+	fs_watch_remove(set->watcher, &set->sub, node);
+	node->wd = -1;
+}
+
+static
+void node_destroy(dir_index_set_t set[static 1], dir_node_t* node) {
+	for (usz i = 0; i < node->child_count; ++i) {
+		node_destroy(set, node->children[i]);
+	}
+	if (node->wd >= 0) {
+		remove_watch(set, node);
+	}
+
+	if (node->children) {
+		lt_mfree(lt_libc_heap, node->children);
+	}
+	if (node->html.str) {
+		lt_mfree(lt_libc_heap, node->html.str);
+	}
+	lt_mfree(lt_libc_heap, node->name.str);
+	lt_mfree(lt_libc_heap, node->path.str);
+	lt_mfree(lt_libc_heap, node);
+}
+
+static
+void clear_children(dir_index_set_t set[static 1], dir_node_t dir[static 1]) {
+	for (usz i = 0; i < dir->child_count; ++i) {
+		node_destroy(set, dir->children[i]);
+	}
+	dir->child_count = 0;
+	mark_dirty(dir);
+}
+
+static
+void add_watch(dir_index_set_t set[static 1], dir_node_t dir[static 1]) {
+	if (!set->watcher) {
+		return;
+	}
+
+	lt_err_t err;
+	int wd;
+	if ((err = fs_watch_dir(set->watcher, dir->path, &wd))) {
+		lt_werrf("failed to watch '%S': %S\n", dir->path, lt_err_str(err));
+		return;
+	}
+	dir->wd = wd;
+	fs_watch_push(set->watcher, &set->sub, wd, dir);
+}
+
+// the name and size of a file are escaped and formatted once, when it is added or changes
+static
+b8 render_file(dir_index_t index[static 1], dir_node_t file[static 1]) {
+	lt_stat_t stat;
+	// the file was removed between listing and stat, the event for that drops it again
+	if (lt_lstatp(file->path, &stat)) {
+		return 0;
+	}
+
+	lt_strstream_t ss;
+	if (lt_strstream_create(&ss, lt_libc_heap)) {
+		return 0;
+	}
+
+	lstr_t link = LSTR(file->path.str + index->target.len + 1, file->path.len - index->target.len - 1);
+	lt_io_printf((lt_write_fn_t)lt_strstream_write, &ss, "<p class='file' style='padding-left: %uzpx'><a href='%S/", 16 * file->level + 2, index->route);
+	html_write_escaped((lt_write_fn_t)lt_strstream_write, &ss, link);
+	lt_strstream_writels(&ss, CLSTR("'>"));
+	html_write_escaped((lt_write_fn_t)lt_strstream_write, &ss, file->name);
+	lt_io_printf((lt_write_fn_t)lt_strstream_write, &ss, "</a><span>%mz</span><p>\n", stat.size);
+
+	if (file->html.str) {
+		lt_mfree(lt_libc_heap, file->html.str);
+	}
+	file->html = ss.str;
+	return 1;
+}
+
+static
+void scan_dir(dir_index_set_t set[static 1], dir_index_t index[static 1], dir_node_t dir[static 1]);
+
+static
+dir_node_t* load_entry(dir_index_set_t set[static 1], dir_index_t index[static 1], dir_node_t dir[static 1], lstr_t name, b8 is_dir) {
+	if (is_dir && dir->parent && dir->level + 2 >= DIR_INDEX_MAX_DEPTH) {
+		lt_werrf("max recursion depth reached, ignoring directory '%S'\n", name);
+		return NULL;
+	}
+
+	lstr_t path = lt_lsbuild(lt_libc_heap, "%S/%S", dir->path, name);
+	dir_node_t* node = node_create(index, dir, name, path, is_dir);
+	lt_mfree(lt_libc_heap, path.str);
+	if (!node) {
+		return NULL;
+	}
+
+	if (is_dir) {
+		add_watch(set, node);
+		scan_dir(set, index, node);
+	}
+	else if (!render_file(index, node)) {
+		node_destroy(set, node);
+		return NULL;
+	}
+	return node;
+}
+
+static
+void scan_dir(dir_index_set_t set[static 1], dir_index_t index[static 1], dir_node_t dir[static 1]) {
+	lt_dir_t* d = lt_dopenp(dir->path, lt_libc_heap);
+	if (!d) {
+		lt_werrf("failed to open directory '%S'\n", dir->path);
+		return;
+	}
+
+	lt_dirent_t* ent;
+	while ((ent = lt_dread(d))) {
+		if (lt_lseq(ent->name, CLSTR(".")) || lt_lseq(ent->name, CLSTR(".."))) {
+			continue;
+		}
+		if (ent->type != LT_DIRENT_DIR && ent->type != LT_DIRENT_FILE) {
+			continue;
+		}
+
+		b8 found;
+		usz pos = find_child(dir, ent->name, &found);
+		if (found) {
+			continue;
+		}
+
+		dir_node_t* child = load_entry(set, index, dir, ent->name, ent->type == LT_DIRENT_DIR);
+		if (child && !insert_child(dir, pos, child)) {
+			node_destroy(set, child);
+		}
+	}
+	lt_dclose(d, lt_libc_heap);
+
+	mark_dirty(dir);
+}
+
+// rebuilds the html of every changed directory, unchanged subtrees are copied as they are
+static
+void render_dir(dir_node_t dir[static 1]) {
+	if (!dir->dirty) {
+		return;
+	}
+
+	lt_strstream_t ss;
+	if (lt_strstream_create(&ss, lt_libc_heap)) {
+		return;
+	}
+
+	if (dir->parent) {
+		lt_io_printf((lt_write_fn_t)lt_strstream_write, &ss, "<details><summary class=\"dir text-cyan\" style=\"padding-left: %uzpx\">", 16 * dir->level + 2);
+		html_write_escaped((lt_write_fn_t)lt_strstream_write, &ss, dir->name);
+		lt_strstream_writels(&ss, CLSTR("</summary>\n"));
+	}
+
+	for (usz i = 0; i < dir->child_count; ++i) {
+		dir_node_t* child = dir->children[i];
+		if (child->is_dir) {
+			render_dir(child);
+		}
+		lt_strstream_writels(&ss, child->html);
+	}
+
+	if (dir->parent) {
+		lt_strstream_writels(&ss, CLSTR("</details>"));
+	}
+	else if (!dir->child_count) {
+		lt_strstream_writels(&ss, CLSTR("<p class='bg-normal text-center'>No files available</p>"));
+	}
+
+	if (dir->html.str) {
+		lt_mfree(lt_libc_heap, dir->html.str);
+	}
+	dir->html = ss.str;
+	dir->dirty = 0;
+}
+
+// renders the tree and hands the result over to the root's html, the root itself is never reused
+static
+compiled_template_t* render_snapshot(dir_index_t index[static 1]) {
+	dir_node_t* root = index->root;
+	render_dir(root);
+	compiled_template_t* snapshot = template_from_text(root->html);
+	root->html = NLSTR();
+	return snapshot;
+}
+
+// must be called with the update lock held
+static
+void publish(dir_index_set_t set[static 1], dir_index_t index[static 1]) {
+	compiled_template_t* snapshot = render_snapshot(index);
+	if (!snapshot) {
+		mark_dirty(index->root);
+		return;
+	}
+
+	pthread_rwlock_wrlock(&set->lock);
+	compiled_template_t* old = index->snapshot;
+	index->snapshot = snapshot;
+	pthread_rwlock_unlock(&set->lock);
+
+	if (old) {
+		template_cache_release(old);
+	}
+	__atomic_add_fetch(&set->rebuilds, 1, __ATOMIC_RELAXED);
+}
+
+static
+void handle_event(dir_index_set_t set[static 1], dir_index_t index[static 1], dir_node_t dir[static 1], const struct inotify_event* ev) {
+	if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+		// subdirectories are removed through the event of their parent
+		if (!dir->parent) {
+			lt_werrf("mapped directory '%S' was removed\n", dir->path);
+			clear_children(set, dir);
+		}
+		return;
+	}
+
+	if (!ev->len) {
+		return;
+	}
+
+	lstr_t name = lt_lsfroms((char*)ev->name);
+	b8 found;
+	usz pos = find_child(dir, name, &found);
+
+	if (found && (ev->mask & (IN_DELETE | IN_MOVED_FROM | IN_CREATE | IN_MOVED_TO))) {
+		node_destroy(set, dir->children[pos]);
+		memmove(dir->children + pos, dir->children + pos + 1, (dir->child_count - pos - 1) * sizeof(dir_node_t*));
+		--dir->child_count;
+		found = 0;
+		mark_dirty(dir);
+	}
+
+	if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+		dir_node_t* child = load_entry(set, index, dir, name, (ev->mask & IN_ISDIR) != 0);
+		if (child && !insert_child(dir, pos, child)) {
+			node_destroy(set, child);
+		}
+		mark_dirty(dir);
+	}
+	else if (found && (ev->mask & (IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB)) && !dir->children[pos]->is_dir) {
+		render_file(index, dir->children[pos]);
+		mark_dirty(dir);
+	}
+}
+
+static
+void rescan_all(dir_index_set_t set[static 1]) {
+	for (usz i = 0; i < lt_darr_count(set->indexes); ++i) {
+		dir_node_t* root = set->indexes[i]->root;
+		clear_children(set, root);
+		scan_dir(set, set->indexes[i], root);
+	}
+}
+
+static
+void on_event(fs_subscriber_t* sub, void* usr, const struct inotify_event* ev) {
+	dir_node_t* dir = usr;
+	handle_event((dir_index_set_t*)sub, dir->index, dir, ev);
+}
+
+static
+void on_removed(fs_subscriber_t* sub, void* usr) {
+	((dir_node_t*)usr)->wd = -1;
+}
+
+static
+void on_overflow(fs_subscriber_t* sub) {
+	rescan_all((dir_index_set_t*)sub);
+}
+
+static
+void begin_events(fs_subscriber_t* sub) {
+	pthread_mutex_lock(&((dir_index_set_t*)sub)->update_lock);
+}
+
+// a batch of events results in one new snapshot per changed index
+static
+void end_events(fs_subscriber_t* sub) {
+	dir_index_set_t* set = (dir_index_set_t*)sub;
+
+	for (usz i = 0; i < lt_darr_count(set->indexes); ++i) {
+		dir_index_t* index = set->indexes[i];
+		if (index->root->dirty) {
+			publish(set, index);
+		}
+	}
+
+	pthread_mutex_unlock(&set->update_lock);
+}
+
+// without a watcher every request walks the directory, like it did before the index existed
+lt_err_t dir_index_set_create(dir_index_set_t out_set[static 1], fs_watcher_t* watcher) {
+	lt_mzero(out_set, sizeof(*out_set));
+	pthread_mutex_init(&out_set->update_lock, NULL);
+	pthread_rwlock_init(&out_set->lock, NULL);
+
+	out_set->indexes = lt_darr_create(dir_index_t*, 16, lt_libc_heap);
+	if (!out_set->indexes) {
+		dir_index_set_destroy(out_set);
+		return LT_ERR_OUT_OF_MEMORY;
+	}
+
+	if (watcher) {
+		out_set->sub = (fs_subscriber_t){
+				.begin = begin_events,
+				.end = end_events,
+				.on_event = on_event,
+				.on_removed = on_removed,
+				.on_overflow = on_overflow };
+		out_set->watcher = watcher;
+		fs_watcher_subscribe(watcher, &out_set->sub);
+	}
+	return LT_SUCCESS;
+}
+
+static
+void index_destroy(dir_index_set_t set[static 1], dir_index_t* index) {
+	if (index->root) {
+		node_destroy(set, index->root);
+	}
+	if (index->snapshot) {
+		template_cache_release(index->snapshot);
+	}
+	lt_mfree(lt_libc_heap, index->route.str);
+	lt_mfree(lt_libc_heap, index->target.str);
+	lt_mfree(lt_libc_heap, index);
+}
+
+// the watcher has to be stopped first
+void dir_index_set_destroy(dir_index_set_t set[static 1]) {
+	if (set->indexes) {
+		for (usz i = 0; i < lt_darr_count(set->indexes); ++i) {
+			index_destroy(set, set->indexes[i]);
+		}
+		lt_darr_destroy(set->indexes);
+	}
+	if (set->watcher) {
+		fs_watcher_unsubscribe(set->watcher, &set->sub);
+	}
+
+	pthread_rwlock_destroy(&set->lock);
+	pthread_mutex_destroy(&set->update_lock);
+}
+
+// must be called with the read or write lock held
+static
+compiled_template_t* find_snapshot(dir_index_set_t set[static 1], lstr_t route, lstr_t target) {
+	for (usz i = 0; i < lt_darr_count(set->indexes); ++i) {
+		dir_index_t* index = set->indexes[i];
+		if (lt_lseq(index->target, target) && lt_lseq(index->route, route)) {
+			__atomic_add_fetch(&index->snapshot->refs, 1, __ATOMIC_RELAXED);
+			return index->snapshot;
+		}
+	}
+	return NULL;
+}
+
+static
+dir_index_t* index_create(dir_index_set_t set[static 1], lstr_t route, lstr_t target) {
+	dir_index_t* index = lt_malloc(lt_libc_heap, sizeof(dir_index_t));
+	if (!index) {
+		return NULL;
+	}
+	*index = (dir_index_t){
+			.route = lt_strdup(lt_libc_heap, route),
+			.target = lt_strdup(lt_libc_heap, target) };
+
+	index->root = node_create(index, NULL, NLSTR(), target, 1);
+	if (!index->root) {
+		index_destroy(set, index);
+		return NULL;
+	}
+	add_watch(set, index->root);
+	scan_dir(set, index, index->root);
+
+	index->snapshot = render_snapshot(index);
+	if (!index->snapshot) {
+		index_destroy(set, index);
+		return NULL;
+	}
+	return index;
+}
+
+// returns the rendered listing of target, with links below route. the result has to be released with
+// template_cache_release, or written with template_write_text.
+compiled_template_t* dir_index_get(dir_index_set_t set[static 1], lstr_t route, lstr_t target) {
+	pthread_rwlock_rdlock(&set->lock);
+	compiled_template_t* snapshot = find_snapshot(set, route, target);
+	pthread_rwlock_unlock(&set->lock);
+	if (snapshot) {
+		return snapshot;
+	}
+
+	// the tree is only built for this request if it can not be kept up to date
+	if (!set->watcher) {
+		dir_index_t* index = index_create(set, route, target);
+		if (!index) {
+			return NULL;
+		}
+		snapshot = index->snapshot;
+		index->snapshot = NULL;
+		index_destroy(set, index);
+		return snapshot;
+	}
+
+	pthread_mutex_lock(&set->update_lock);
+
+	// another request may have built the index while this one waited for the lock
+	pthread_rwlock_rdlock(&set->lock);
+	snapshot = find_snapshot(set, route, target);
+	pthread_rwlock_unlock(&set->lock);
+	if (snapshot) {
+		goto done;
+	}
+
+	dir_index_t* index = index_create(set, route, target);
+	if (!index) {
+		goto done;
+	}
+	snapshot = index->snapshot;
+	__atomic_add_fetch(&snapshot->refs, 1, __ATOMIC_RELAXED);
+
+	pthread_rwlock_wrlock(&set->lock);
+	lt_darr_push(set->indexes, index);
+	pthread_rwlock_unlock(&set->lock);
+
+done:
+	pthread_mutex_unlock(&set->update_lock);
+	return snapshot;
+}
@@ -0,0 +1,64 @@
+#ifndef DIRINDEX_H
+#define DIRINDEX_H 1
+
+#include <lt/lt.h>
+#include <lt/darr.h>
+
+#include <pthread.h>
+
+#include "fswatch.h"
+#include "template.h"
+
+// dirindex.c
+
+#define DIR_INDEX_MAX_DEPTH 16
+
+typedef struct dir_node dir_node_t;
+typedef struct dir_index dir_index_t;
+
+typedef
+struct dir_node {
+	dir_index_t* index;
+	dir_node_t* parent;
+	dir_node_t** children; // sorted by name
+	usz child_count;
+
+	lstr_t name;
+	lstr_t path;
+	usz level; // 0 for the entries of the mapped directory
+	b8 is_dir;
+	int wd; // -1 if the directory is not watched
+
+	lstr_t html; // the file's line, or a directory's whole subtree
+	b8 dirty; // html of a directory has to be rebuilt
+} dir_node_t;
+
+typedef
+struct dir_index {
+	lstr_t route;
+	lstr_t target;
+	dir_node_t* root;
+	compiled_template_t* snapshot; // rendered tree, replaced whenever the tree changes
+} dir_index_t;
+
+// in-memory copies of directory trees, kept up to date through inotify. every change rebuilds only the
+// html of the directories on the path to it, the rendered tree is published as a text-only template.
+typedef
+struct dir_index_set {
+	fs_subscriber_t sub; // every watched directory is a watch of its node
+	fs_watcher_t* watcher; // NULL if trees can not be kept up to date
+
+	pthread_mutex_t update_lock; // held while trees are built or changed
+	pthread_rwlock_t lock; // protects the index list and the published snapshots
+
+	lt_darr(dir_index_t*) indexes;
+
+	volatile usz rebuilds;
+} dir_index_set_t;
+
+lt_err_t dir_index_set_create(dir_index_set_t out_set[static 1], fs_watcher_t* watcher);
+void dir_index_set_destroy(dir_index_set_t set[static 1]);
+
+compiled_template_t* dir_index_get(dir_index_set_t set[static 1], lstr_t route, lstr_t target);
+
+#endif
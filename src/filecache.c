@@ -0,0 +1,232 @@
+#include <lt/io.h>
+#include <lt/mem.h>
+#include <lt/str.h>
+
+#include "filecache.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define BUCKET_COUNT 4096
+
+static void on_event(fs_subscriber_t* sub, void* usr, const struct inotify_event* ev);
+static void on_removed(fs_subscriber_t* sub, void* usr);
+static void on_overflow(fs_subscriber_t* sub);
+
+lt_err_t file_cache_create(file_cache_t out_cache[static 1], fs_watcher_t* watcher, usz max_size, usz max_entry_size) {
+	lt_err_t err;
+
+	lt_mzero(out_cache, sizeof(*out_cache));
+
+	if ((err = clock_cache_create(&out_cache->store, BUCKET_COUNT, max_size))) {
+		return err;
+	}
+
+	out_cache->sub = (fs_subscriber_t){ .on_event = on_event, .on_removed = on_removed, .on_overflow = on_overflow };
+	out_cache->watcher = watcher;
+	fs_watcher_subscribe(watcher, &out_cache->sub);
+
+	out_cache->max_entry_size = max_entry_size;
+	return LT_SUCCESS;
+}
+
+void file_cache_destroy(file_cache_t cache[static 1]) {
+	fs_watcher_unsubscribe(cache->watcher, &cache->sub);
+	clock_cache_destroy(&cache->store);
+}
+
+file_cache_entry_t* file_cache_get(file_cache_t cache[static 1], lstr_t path) {
+	return (file_cache_entry_t*)clock_cache_get(&cache->store, path, 0);
+}
+
+// generation has to be read before the file is opened, any invalidation after that point
+// might concern a newer version of the file than the one that is loaded
+file_cache_entry_t* file_cache_load(file_cache_t cache[static 1], lstr_t path, int fd, u64 generation) {
+	struct stat st;
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || (usz)st.st_size > cache->max_entry_size || (usz)st.st_size > cache->store.max_size) {
+		return NULL;
+	}
+
+	file_cache_entry_t* entry = lt_malloc(lt_libc_heap, sizeof(file_cache_entry_t) + path.len + st.st_size);
+	if (!entry) {
+		return NULL;
+	}
+	*entry = (file_cache_entry_t) {
+			.base = {
+				.hash = lt_hashls(path),
+				.refs = 2, // one for the cache, one for the caller
+				.footprint = sizeof(file_cache_entry_t) + path.len + st.st_size,
+				.key = LSTR((char*)(entry + 1), path.len) },
+			.data = LSTR((char*)(entry + 1) + path.len, st.st_size),
+			.inode = st.st_ino,
+			.mtime_nsec = (u64)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec };
+	memcpy(entry->base.key.str, path.str, path.len);
+
+	for (usz read_size = 0; read_size < entry->data.len;) {
+		isz res = pread(fd, entry->data.str + read_size, entry->data.len - read_size, read_size);
+		if (res < 0 && errno == EINTR) {
+			continue;
+		}
+		if (res <= 0) {
+			lt_mfree(lt_libc_heap, entry);
+			return NULL;
+		}
+		read_size += res;
+	}
+
+	// if another worker loaded the same file first, its entry is returned
+	return (file_cache_entry_t*)clock_cache_insert(&cache->store, &entry->base, generation, 0);
+}
+
+void file_cache_mark_missing(file_cache_t cache[static 1], lstr_t path, u64 generation) {
+	file_cache_entry_t* entry = lt_malloc(lt_libc_heap, sizeof(file_cache_entry_t) + path.len);
+	if (!entry) {
+		return;
+	}
+	*entry = (file_cache_entry_t) {
+			.base = {
+				.hash = lt_hashls(path),
+				.refs = 2,
+				.footprint = sizeof(file_cache_entry_t) + path.len,
+				.key = LSTR((char*)(entry + 1), path.len) },
+			.missing = 1 };
+	memcpy(entry->base.key.str, path.str, path.len);
+
+	clock_entry_release(clock_cache_insert(&cache->store, &entry->base, generation, 0));
+}
+
+void file_cache_release(file_cache_t cache[static 1], file_cache_entry_t* entry) {
+	clock_entry_release(&entry->base);
+}
+
+static
+b8 has_prefix(const clock_entry_t* entry, void* usr) {
+	return lt_lsprefix(entry->key, *(lstr_t*)usr);
+}
+
+static
+void invalidate(file_cache_t cache[static 1], lstr_t path, b8 prefix) {
+	if (!prefix) {
+		clock_cache_remove(&cache->store, path);
+	}
+	else {
+		clock_cache_remove_if(&cache->store, has_prefix, &path);
+	}
+}
+
+// every path the cache sees is built here, so that keys of requested files and the paths of inotify
+// events are spelled the same. dir is a normalized mapping target, see srv_map_, or is built from one.
+lstr_t file_cache_join(lt_alloc_t* alloc, lstr_t dir, lstr_t name) {
+	if (lt_lseq(dir, CLSTR("."))) {
+		return lt_lsbuild(alloc, "%S", name);
+	}
+	if (dir.len && dir.str[dir.len - 1] == '/') {
+		return lt_lsbuild(alloc, "%S%S", dir, name);
+	}
+	return lt_lsbuild(alloc, "%S/%S", dir, name);
+}
+
+static
+b8 same_path(void* usr, void* ctx) {
+	return lt_lseq(((file_watch_t*)usr)->path, *(lstr_t*)ctx);
+}
+
+static
+lt_err_t add_watch(file_cache_t cache[static 1], lstr_t dir, b8 recursive) {
+	lt_err_t err;
+
+	int wd;
+	if ((err = fs_watch_dir(cache->watcher, dir, &wd))) {
+		return err;
+	}
+
+	file_watch_t* watch = fs_watch_find(cache->watcher, &cache->sub, wd, same_path, &dir);
+	if (watch) {
+		watch->recursive |= recursive;
+	}
+	else {
+		watch = lt_malloc(lt_libc_heap, sizeof(file_watch_t) + dir.len);
+		if (!watch) {
+			return LT_ERR_OUT_OF_MEMORY;
+		}
+		*watch = (file_watch_t){ .recursive = recursive, .path = LSTR((char*)(watch + 1), dir.len) };
+		memcpy(watch->path.str, dir.str, dir.len);
+		fs_watch_push(cache->watcher, &cache->sub, wd, watch);
+	}
+
+	if (!recursive) {
+		return LT_SUCCESS;
+	}
+
+	lt_dir_t* d = lt_dopenp(dir, lt_libc_heap);
+	if (!d) {
+		return LT_ERR_UNKNOWN;
+	}
+
+	lt_dirent_t* ent;
+	while ((ent = lt_dread(d))) {
+		if (ent->type != LT_DIRENT_DIR || lt_lseq(ent->name, CLSTR(".")) || lt_lseq(ent->name, CLSTR(".."))) {
+			continue;
+		}
+
+		lstr_t subdir = file_cache_join(lt_libc_heap, dir, ent->name);
+		err = add_watch(cache, subdir, 1);
+		if (err) {
+			lt_werrf("failed to watch '%S': %S\n", subdir, lt_err_str(err));
+		}
+		lt_mfree(lt_libc_heap, subdir.str);
+	}
+	lt_dclose(d, lt_libc_heap);
+	return LT_SUCCESS;
+}
+
+lt_err_t file_cache_watch(file_cache_t cache[static 1], lstr_t dir, b8 recursive) {
+	return add_watch(cache, dir, recursive);
+}
+
+// the event is delivered once for every spelling of the directory, entries are keyed by each of them
+static
+void on_event(fs_subscriber_t* sub, void* usr, const struct inotify_event* ev) {
+	file_cache_t* cache = (file_cache_t*)sub;
+	lstr_t dir = ((file_watch_t*)usr)->path;
+	b8 recursive = ((file_watch_t*)usr)->recursive;
+
+	if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+		lstr_t prefix = file_cache_join(lt_libc_heap, dir, CLSTR(""));
+		invalidate(cache, prefix, 1);
+		lt_mfree(lt_libc_heap, prefix.str);
+		return;
+	}
+
+	if (!ev->len) {
+		return;
+	}
+
+	lstr_t path = file_cache_join(lt_libc_heap, dir, lt_lsfroms((char*)ev->name));
+	invalidate(cache, path, 0);
+
+	if (ev->mask & IN_ISDIR) {
+		lstr_t prefix = lt_lsbuild(lt_libc_heap, "%S/", path);
+		invalidate(cache, prefix, 1);
+		lt_mfree(lt_libc_heap, prefix.str);
+
+		if (recursive && (ev->mask & (IN_CREATE | IN_MOVED_TO))) {
+			lt_err_t err = add_watch(cache, path, 1);
+			if (err) {
+				lt_werrf("failed to watch '%S': %S\n", path, lt_err_str(err));
+			}
+		}
+	}
+	lt_mfree(lt_libc_heap, path.str);
+}
+
+static
+void on_removed(fs_subscriber_t* sub, void* usr) {
+	lt_mfree(lt_libc_heap, usr);
+}
+
+static
+void on_overflow(fs_subscriber_t* sub) {
+	invalidate((file_cache_t*)sub, NLSTR(), 1);
+}
@@ -0,0 +1,56 @@
+#ifndef FILECACHE_H
+#define FILECACHE_H 1
+
+#include <lt/lt.h>
+#include <lt/io.h>
+
+#include "clockcache.h"
+#include "fswatch.h"
+
+// filecache.c
+
+typedef
+struct file_cache_entry {
+	clock_entry_t base; // keyed by path
+	b8 missing;
+	lstr_t data;
+
+	u64 inode;
+	u64 mtime_nsec;
+} file_cache_entry_t;
+
+// a directory reached through several spellings has one watch per spelling, all with the same wd
+typedef
+struct file_watch {
+	b8 recursive;
+	lstr_t path;
+} file_watch_t;
+
+// size-bounded cache of whole files, evicted with the CLOCK algorithm.
+// entries are invalidated from the events of watcher.
+typedef
+struct file_cache {
+	fs_subscriber_t sub;
+	fs_watcher_t* watcher;
+
+	clock_cache_t store;
+	usz max_entry_size;
+} file_cache_t;
+
+lt_err_t file_cache_create(file_cache_t out_cache[static 1], fs_watcher_t* watcher, usz max_size, usz max_entry_size);
+void file_cache_destroy(file_cache_t cache[static 1]);
+
+lstr_t file_cache_join(lt_alloc_t* alloc, lstr_t dir, lstr_t name);
+
+lt_err_t file_cache_watch(file_cache_t cache[static 1], lstr_t dir, b8 recursive);
+
+file_cache_entry_t* file_cache_get(file_cache_t cache[static 1], lstr_t path);
+file_cache_entry_t* file_cache_load(file_cache_t cache[static 1], lstr_t path, int fd, u64 generation);
+void file_cache_mark_missing(file_cache_t cache[static 1], lstr_t path, u64 generation);
+static LT_INLINE
+u64 file_cache_generation(file_cache_t cache[static 1]) {
+	return clock_cache_generation(&cache->store);
+}
+void file_cache_release(file_cache_t cache[static 1], file_cache_entry_t* entry);
+
+#endif
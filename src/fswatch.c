@@ -0,0 +1,258 @@
+#include <lt/io.h>
+#include <lt/mem.h>
+#include <lt/str.h>
+#include <lt/thread.h>
+
+#include "fswatch.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+lt_err_t fs_watcher_create(fs_watcher_t out_watcher[static 1]) {
+	lt_err_t err;
+
+	lt_mzero(out_watcher, sizeof(*out_watcher));
+	out_watcher->inotify_fd = -1;
+
+	// subscribers add and remove watches from their callbacks, which run with the lock held
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&out_watcher->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	out_watcher->watches = lt_darr_create(fs_watch_t, 256, lt_libc_heap);
+	out_watcher->matches = lt_darr_create(fs_watch_t, 16, lt_libc_heap);
+	out_watcher->subscribers = lt_darr_create(fs_subscriber_t*, 4, lt_libc_heap);
+	if (!out_watcher->watches || !out_watcher->matches || !out_watcher->subscribers) {
+		fs_watcher_destroy(out_watcher);
+		return LT_ERR_OUT_OF_MEMORY;
+	}
+
+	out_watcher->inotify_fd = inotify_init1(IN_CLOEXEC);
+	if (out_watcher->inotify_fd < 0) {
+		err = lt_errno();
+		fs_watcher_destroy(out_watcher);
+		return err;
+	}
+	return LT_SUCCESS;
+}
+
+void fs_watcher_destroy(fs_watcher_t watcher[static 1]) {
+	fs_watcher_stop(watcher);
+
+	if (watcher->inotify_fd >= 0) {
+		close(watcher->inotify_fd);
+	}
+	if (watcher->watches) {
+		lt_darr_destroy(watcher->watches);
+	}
+	if (watcher->matches) {
+		lt_darr_destroy(watcher->matches);
+	}
+	if (watcher->subscribers) {
+		lt_darr_destroy(watcher->subscribers);
+	}
+	pthread_mutex_destroy(&watcher->lock);
+}
+
+// must be called before the watcher is started
+void fs_watcher_subscribe(fs_watcher_t watcher[static 1], fs_subscriber_t* sub) {
+	lt_darr_push(watcher->subscribers, sub);
+}
+
+static
+b8 wd_in_use(fs_watcher_t watcher[static 1], int wd) {
+	for (usz i = 0; i < lt_darr_count(watcher->watches); ++i) {
+		if (watcher->watches[i].wd == wd) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// must be called with the lock held. the last watch takes the place of the removed one.
+static
+void unlink_watch(fs_watcher_t watcher[static 1], usz i) {
+	int wd = watcher->watches[i].wd;
+	watcher->watches[i] = watcher->watches[lt_darr_count(watcher->watches) - 1];
+	lt_darr_pop(watcher->watches);
+
+	if (!wd_in_use(watcher, wd)) {
+		inotify_rm_watch(watcher->inotify_fd, wd);
+	}
+}
+
+// removes every watch of sub, on_removed is called for each of them. must not be called while the watcher is running.
+void fs_watcher_unsubscribe(fs_watcher_t watcher[static 1], fs_subscriber_t* sub) {
+	pthread_mutex_lock(&watcher->lock);
+	for (usz i = 0; i < lt_darr_count(watcher->watches);) {
+		fs_watch_t watch = watcher->watches[i];
+		if (watch.sub == sub) {
+			unlink_watch(watcher, i);
+			sub->on_removed(sub, watch.usr);
+			continue;
+		}
+		++i;
+	}
+	pthread_mutex_unlock(&watcher->lock);
+
+	for (usz i = 0; i < lt_darr_count(watcher->subscribers); ++i) {
+		if (watcher->subscribers[i] == sub) {
+			watcher->subscribers[i] = watcher->subscribers[lt_darr_count(watcher->subscribers) - 1];
+			lt_darr_pop(watcher->subscribers);
+			break;
+		}
+	}
+}
+
+// starts watching dir, or returns the wd it is already watched with. the watch is only
+// kept for a subscriber once it is pushed with fs_watch_push.
+lt_err_t fs_watch_dir(fs_watcher_t watcher[static 1], lstr_t dir, int out_wd[static 1]) {
+	char cpath[LT_PATH_MAX];
+	if (dir.len >= sizeof(cpath)) {
+		return LT_ERR_OVERFLOW;
+	}
+	memcpy(cpath, dir.str, dir.len);
+	cpath[dir.len] = 0;
+
+	// every subscriber uses the same mask, adding a watch never narrows the one of another
+	int wd = inotify_add_watch(watcher->inotify_fd, cpath, FS_WATCH_MASK | IN_ONLYDIR);
+	if (wd < 0) {
+		return lt_errno();
+	}
+	*out_wd = wd;
+	return LT_SUCCESS;
+}
+
+void fs_watch_push(fs_watcher_t watcher[static 1], fs_subscriber_t* sub, int wd, void* usr) {
+	pthread_mutex_lock(&watcher->lock);
+	lt_darr_push(watcher->watches, (fs_watch_t){ .wd = wd, .sub = sub, .usr = usr });
+	pthread_mutex_unlock(&watcher->lock);
+}
+
+// returns the usr pointer of the first watch of sub on wd that match returns true for
+void* fs_watch_find(fs_watcher_t watcher[static 1], fs_subscriber_t* sub, int wd, fs_watch_match_fn_t match, void* ctx) {
+	void* usr = NULL;
+
+	pthread_mutex_lock(&watcher->lock);
+	for (usz i = 0; i < lt_darr_count(watcher->watches); ++i) {
+		fs_watch_t* watch = &watcher->watches[i];
+		if (watch->wd == wd && watch->sub == sub && match(watch->usr, ctx)) {
+			usr = watch->usr;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&watcher->lock);
+	return usr;
+}
+
+// the directory stays watched as long as any other watch shares its wd
+void fs_watch_remove(fs_watcher_t watcher[static 1], fs_subscriber_t* sub, void* usr) {
+	pthread_mutex_lock(&watcher->lock);
+	for (usz i = 0; i < lt_darr_count(watcher->watches); ++i) {
+		if (watcher->watches[i].sub == sub && watcher->watches[i].usr == usr) {
+			unlink_watch(watcher, i);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&watcher->lock);
+}
+
+// must be called with the lock held
+static
+void dispatch_event(fs_watcher_t watcher[static 1], const struct inotify_event* ev) {
+	// handling an event adds and removes watches, so the matching ones are collected first
+	lt_darr_clear(watcher->matches);
+	for (usz i = 0; i < lt_darr_count(watcher->watches); ++i) {
+		if (watcher->watches[i].wd == ev->wd) {
+			lt_darr_push(watcher->matches, watcher->watches[i]);
+		}
+	}
+
+	// the kernel already dropped the watch, the wd must not be removed a second time
+	if (ev->mask & IN_IGNORED) {
+		for (usz i = 0; i < lt_darr_count(watcher->watches);) {
+			if (watcher->watches[i].wd == ev->wd) {
+				watcher->watches[i] = watcher->watches[lt_darr_count(watcher->watches) - 1];
+				lt_darr_pop(watcher->watches);
+				continue;
+			}
+			++i;
+		}
+
+		for (usz i = 0; i < lt_darr_count(watcher->matches); ++i) {
+			fs_watch_t* match = &watcher->matches[i];
+			match->sub->on_removed(match->sub, match->usr);
+		}
+		return;
+	}
+
+	for (usz i = 0; i < lt_darr_count(watcher->matches); ++i) {
+		fs_watch_t* match = &watcher->matches[i];
+		match->sub->on_event(match->sub, match->usr, ev);
+	}
+}
+
+static
+void watch_proc(fs_watcher_t* watcher) {
+	char buf[LT_KB(16)] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+	for (;;) {
+		isz len = read(watcher->inotify_fd, buf, sizeof(buf));
+		if (len < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			lt_werrf("failed to read inotify events: %S\n", lt_err_str(lt_errno()));
+			return;
+		}
+
+		// subscribers take their own locks in begin, before the watch list is locked. requests that
+		// add watches hold the same locks, so taking them in the other order could deadlock.
+		for (usz i = 0; i < lt_darr_count(watcher->subscribers); ++i) {
+			fs_subscriber_t* sub = watcher->subscribers[i];
+			if (sub->begin) {
+				sub->begin(sub);
+			}
+		}
+		pthread_mutex_lock(&watcher->lock);
+
+		for (char* it = buf; it < buf + len;) {
+			struct inotify_event* ev = (struct inotify_event*)it;
+			it += sizeof(struct inotify_event) + ev->len;
+
+			if (ev->mask & IN_Q_OVERFLOW) {
+				for (usz i = 0; i < lt_darr_count(watcher->subscribers); ++i) {
+					watcher->subscribers[i]->on_overflow(watcher->subscribers[i]);
+				}
+				continue;
+			}
+			dispatch_event(watcher, ev);
+		}
+
+		pthread_mutex_unlock(&watcher->lock);
+		for (usz i = 0; i < lt_darr_count(watcher->subscribers); ++i) {
+			fs_subscriber_t* sub = watcher->subscribers[i];
+			if (sub->end) {
+				sub->end(sub);
+			}
+		}
+	}
+}
+
+lt_err_t fs_watcher_start(fs_watcher_t watcher[static 1]) {
+	watcher->thread = lt_thread_create((lt_thread_fn_t)watch_proc, watcher, lt_libc_heap);
+	if (!watcher->thread) {
+		return LT_ERR_UNKNOWN;
+	}
+	return LT_SUCCESS;
+}
+
+void fs_watcher_stop(fs_watcher_t watcher[static 1]) {
+	if (watcher->thread) {
+		lt_thread_cancel(watcher->thread);
+		lt_thread_join(watcher->thread, lt_libc_heap);
+		watcher->thread = NULL;
+	}
+}
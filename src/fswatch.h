@@ -0,0 +1,66 @@
+#ifndef FSWATCH_H
+#define FSWATCH_H 1
+
+#include <lt/lt.h>
+#include <lt/darr.h>
+#include <lt/thread.h>
+
+#include <pthread.h>
+#include <sys/inotify.h>
+
+// fswatch.c
+
+#define FS_WATCH_MASK (IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+typedef struct fs_subscriber fs_subscriber_t;
+
+// placed at the start of the structures that receive events. callbacks are called from the watcher thread, on_event
+// and on_removed with the watch list locked, so they are free to add and remove watches. on_removed is also called
+// by fs_watcher_unsubscribe.
+typedef
+struct fs_subscriber {
+	void (*begin)(fs_subscriber_t* sub); // before every batch of events, may be NULL
+	void (*end)(fs_subscriber_t* sub); // after every batch of events, may be NULL
+	void (*on_event)(fs_subscriber_t* sub, void* usr, const struct inotify_event* ev);
+	void (*on_removed)(fs_subscriber_t* sub, void* usr); // the watched directory is gone, or sub unsubscribed
+	void (*on_overflow)(fs_subscriber_t* sub); // events were lost, everything has to be reloaded
+} fs_subscriber_t;
+
+// a directory can be watched by several subscribers, and by one subscriber under several spellings.
+// inotify hands out one wd per directory, so those watches all share it.
+typedef
+struct fs_watch {
+	int wd;
+	fs_subscriber_t* sub;
+	void* usr;
+} fs_watch_t;
+
+// one inotify instance and thread, shared by the file cache and the directory index
+typedef
+struct fs_watcher {
+	pthread_mutex_t lock; // recursive, protects watches
+	lt_darr(fs_watch_t) watches;
+	lt_darr(fs_watch_t) matches; // only used by the watcher thread
+	lt_darr(fs_subscriber_t*) subscribers; // fixed while the thread runs
+
+	int inotify_fd;
+	lt_thread_t* thread;
+} fs_watcher_t;
+
+typedef b8 (*fs_watch_match_fn_t)(void* usr, void* ctx);
+
+lt_err_t fs_watcher_create(fs_watcher_t out_watcher[static 1]);
+void fs_watcher_destroy(fs_watcher_t watcher[static 1]);
+
+lt_err_t fs_watcher_start(fs_watcher_t watcher[static 1]);
+void fs_watcher_stop(fs_watcher_t watcher[static 1]);
+
+void fs_watcher_subscribe(fs_watcher_t watcher[static 1], fs_subscriber_t* sub);
+void fs_watcher_unsubscribe(fs_watcher_t watcher[static 1], fs_subscriber_t* sub);
+
+lt_err_t fs_watch_dir(fs_watcher_t watcher[static 1], lstr_t dir, int out_wd[static 1]);
+void fs_watch_push(fs_watcher_t watcher[static 1], fs_subscriber_t* sub, int wd, void* usr);
+void* fs_watch_find(fs_watcher_t watcher[static 1], fs_subscriber_t* sub, int wd, fs_watch_match_fn_t match, void* ctx);
+void fs_watch_remove(fs_watcher_t watcher[static 1], fs_subscriber_t* sub, void* usr);
+
+#endif
@@ -0,0 +1,125 @@
+#include <lt/html.h>
+#include <lt/mem.h>
+
+#include "htmlescape.h"
+#include "bytescan.h"
+
+// escapes exactly what lt_write_htmlencoded escapes, which template values and most of markdown.c were written
+// with before. runs without any escaped byte are written with one call, finding the end of a run goes through
+// byte_set_span, which is vectorized where possible.
+
+#define MAX_ENTITY_LEN 16
+
+static lstr_t entities[256];
+static b8 escaped[256];
+static char entity_data[256 * MAX_ENTITY_LEN];
+
+static byte_set_t special_chars;
+static b8 use_byte_set; // byte_set_t covers at most 8 high nibbles, and can not contain 0
+
+typedef
+struct probe {
+	char buf[MAX_ENTITY_LEN];
+	usz len;
+} probe_t;
+
+static
+isz write_probe(probe_t* probe, const void* data, usz len) {
+	if (probe->len + len > sizeof(probe->buf)) {
+		return -1;
+	}
+	memcpy(probe->buf + probe->len, data, len);
+	probe->len += len;
+	return len;
+}
+
+// the table is taken from lt instead of being spelled out, so that the output stays the same as lt's,
+// '\'' included, whichever entities it uses
+__attribute__((constructor))
+static
+void init_entities(void) {
+	char specials[256];
+	usz special_count = 0;
+	u16 high_nibbles = 0;
+
+	for (usz c = 0; c < 256; ++c) {
+		probe_t probe = { .len = 0 };
+		lt_write_htmlencoded_char8((lt_write_fn_t)write_probe, &probe, (char)c);
+		if (probe.len == 1 && (u8)probe.buf[0] == c) {
+			continue;
+		}
+
+		char* data = entity_data + c * MAX_ENTITY_LEN;
+		memcpy(data, probe.buf, probe.len);
+		entities[c] = LSTR(data, probe.len);
+		escaped[c] = 1;
+
+		if (c) {
+			specials[special_count++] = c;
+		}
+		high_nibbles |= 1 << (c >> 4);
+	}
+	specials[special_count] = 0;
+
+	use_byte_set = !escaped[0] && __builtin_popcount(high_nibbles) <= 8;
+	if (use_byte_set) {
+		byte_set_init(&special_chars, specials);
+	}
+}
+
+usz html_clean_prefix_scalar(const char* str, usz len) {
+	for (usz i = 0; i < len; ++i) {
+		if (escaped[(u8)str[i]]) {
+			return i;
+		}
+	}
+	return len;
+}
+
+usz html_clean_prefix(const char* str, usz len) {
+	if (!use_byte_set) {
+		return html_clean_prefix_scalar(str, len);
+	}
+	return byte_set_span(&special_chars, str, len);
+}
+
+isz html_write_escaped(lt_write_fn_t callb, void* usr, lstr_t str) {
+	isz written = 0;
+	for (const char* it = str.str, *end = it + str.len; it < end;) {
+		usz clean = html_clean_prefix(it, end - it);
+		if (clean) {
+			callb(usr, it, clean);
+			written += clean;
+			it += clean;
+			if (it >= end) {
+				break;
+			}
+		}
+
+		lstr_t entity = entities[(u8)*it++];
+		callb(usr, entity.str, entity.len);
+		written += entity.len;
+	}
+	return written;
+}
+
+// reference implementation for bench/htmlescape
+isz html_write_escaped_scalar(lt_write_fn_t callb, void* usr, lstr_t str) {
+	isz written = 0;
+	for (const char* it = str.str, *end = it + str.len; it < end;) {
+		usz clean = html_clean_prefix_scalar(it, end - it);
+		if (clean) {
+			callb(usr, it, clean);
+			written += clean;
+			it += clean;
+			if (it >= end) {
+				break;
+			}
+		}
+
+		lstr_t entity = entities[(u8)*it++];
+		callb(usr, entity.str, entity.len);
+		written += entity.len;
+	}
+	return written;
+}
@@ -0,0 +1,15 @@
+#ifndef HTMLESCAPE_H
+#define HTMLESCAPE_H 1
+
+#include <lt/lt.h>
+#include <lt/io.h>
+
+// htmlescape.c
+
+usz html_clean_prefix(const char* str, usz len);
+usz html_clean_prefix_scalar(const char* str, usz len);
+
+isz html_write_escaped(lt_write_fn_t callb, void* usr, lstr_t str);
+isz html_write_escaped_scalar(lt_write_fn_t callb, void* usr, lstr_t str);
+
+#endif
@@ -12,17 +12,13 @@ void on_404(connection_t* conn) {
 	conn->response.response_status_msg = CLSTR("Not found");
 }
 
-b8 on_request(connection_t* conn) {
-
-	// filetree for ./public
-	if (is_route(conn, "/public")) {
-		srv_set_var(conn, CLSTR("map_route"), CLSTR("/public"));
-		srv_set_var(conn, CLSTR("map_target"), CLSTR("./public"));
-		conn->response.body = load_template("./pages/public.tmpl", conn);
-		return 1;
-	}
-
-	return 0;
+// filetree for ./public
+b8 on_public(connection_t* conn) {
+	srv_set_var(conn, CLSTR("map_route"), CLSTR("/public"));
+	srv_set_var(conn, CLSTR("map_target"), CLSTR("./public"));
+	conn->response_mime_type = CLSTR("text/html; charset=UTF-8");
+	// the file tree can get long, so the page is streamed rather than rendered into a string
+	return respond_template("./pages/public.tmpl", conn) == LT_SUCCESS;
 }
 
 int main(int argc, char** argv) {
@@ -34,12 +30,13 @@ int main(int argc, char** argv) {
 // 			.key_path = CLSTR("MY_PRIVKEY_DOT_PEM"),
 // 			.cert_chain_path = CLSTR("MY_CERT_CHAIN_DOT_PEM"),
 			.port = 8000,
-			.on_request = on_request,
 			.on_404 = on_404 };
 
 	srv_map(&server, "/favicon.ico", "./public/favicon.png");
+	srv_route(&server, "/public", on_public);
 
-	srv_map(&server, "/", "./pages/index.tmpl");
+	srv_map(&server, "/readme", "./README.md");
+	srv_map(&server, "/", "./pages/index.tmpl", .etag = 1, .cache = PAGE_CACHE_TTL);
 	srv_map(&server, "/", "./public");
 
 	srv_start(&server);
@@ -56,7 +53,14 @@ int main(int argc, char** argv) {
 		}
 
 		if ((key & LT_TERM_KEY_MASK) == 's' || (key & LT_TERM_KEY_MASK) == 'S') {
-
+			srv_stats_t stats;
+			srv_get_stats(&server, &stats);
+			lt_printf("connections: %uz active, %uz pending, %uz rejected, %uz dropped\n",
+					stats.active_connections, stats.pending_connections, stats.rejected_connections, stats.dropped_connections);
+			lt_printf("file cache: %uz hits, %uz misses, %uz evictions, %mz cached\n",
+					stats.file_cache_hits, stats.file_cache_misses, stats.file_cache_evictions, stats.file_cache_size);
+			lt_printf("page cache: %uz hits, %uz misses, %uz evictions, %mz cached\n",
+					stats.page_cache_hits, stats.page_cache_misses, stats.page_cache_evictions, stats.page_cache_size);
 		}
 	}
 	return 0;
@@ -1,7 +1,9 @@
 #include <lt/ctype.h>
 #include <lt/io.h>
 #include <lt/str.h>
-#include <lt/html.h>
+
+#include "htmlescape.h"
+#include "bytescan.h"
 
 static LT_INLINE
 b8 str_pending(char* it, char* end, lstr_t str) {
@@ -40,18 +42,14 @@ b8 consume_if_char_pending(char** it, char* end, char c) {
 static
 lstr_t consume_until_char(char** it, char* end, char c) {
 	char* start = *it;
-	while (*it < end && **it != c) {
-		++*it;
-	}
+	*it += byte_find(*it, end - *it, c);
 	return lt_lsfrom_range(start, (*it)++);
 }
 
 static
 lstr_t consume_until_str(char** it, char* end, lstr_t str) {
 	char* start = *it;
-	while (*it < end && !str_pending(*it, end, str)) {
-		++*it;
-	}
+	*it += byte_find_str(*it, end - *it, str);
 	lstr_t consumed = lt_lsfrom_range(start, *it);
 	*it += str.len;
 	return consumed;
@@ -66,21 +64,13 @@ void skip_space(char** it, char* end) {
 
 #include <lt/time.h>
 
-static b8 special_char_tab[256] = {
-	['<'] = 1,
-	['>'] = 1,
-	['&'] = 1,
-	['\''] = 1,
-	['"'] = 1,
-	['\n'] = 1,
-	['`'] = 1,
-	['!'] = 1,
-	['['] = 1,
-	['\\'] = 1,
-	['*'] = 1,
-	['_'] = 1,
-	['~'] = 1,
-};
+static byte_set_t special_chars;
+
+__attribute__((constructor))
+static
+void init_special_chars(void) {
+	byte_set_init(&special_chars, "<>&'\"\n`![\\*_~");
+}
 
 void lt_md_render(lstr_t markdown, lstr_t link_base, lt_write_fn_t callb, void* usr) {
 	b8 quote = 0;
@@ -116,7 +106,7 @@ void lt_md_render(lstr_t markdown, lstr_t link_base, lt_write_fn_t callb, void*
 		if (heading) {
 			lstr_t line = consume_until_char(&it, end, '\n');
 			lt_io_printf(callb, usr, "<h%uz>%r#", heading, heading);
-			lt_write_htmlencoded(callb, usr, line);
+			html_write_escaped(callb, usr, line);
 			lt_io_printf(callb, usr, "</h%uz>\n", heading);
 			continue;
 		}
@@ -124,7 +114,7 @@ void lt_md_render(lstr_t markdown, lstr_t link_base, lt_write_fn_t callb, void*
 		if (consume_if_char_pending(&it, end, '|')) {
 			lstr_t line = consume_until_char(&it, end, '\n');
  			lt_writes(callb, usr, "<pre style='font-family: monospace'>|");
- 			lt_write_htmlencoded(callb, usr, line);
+ 			html_write_escaped(callb, usr, line);
  			lt_writes(callb, usr, "</pre>\n");
  			continue;
 		}
@@ -149,7 +139,7 @@ void lt_md_render(lstr_t markdown, lstr_t link_base, lt_write_fn_t callb, void*
 			switch (c) {
 			case '\\':
 				if (it < end) {
-					lt_write_htmlencoded_char8(callb, usr, *it++);
+					html_write_escaped(callb, usr, LSTR(it++, 1));
 				}
 				break;
 
@@ -178,16 +168,16 @@ void lt_md_render(lstr_t markdown, lstr_t link_base, lt_write_fn_t callb, void*
 
 				if (image) {
 					lt_io_printf(callb, usr, "<span><img src='%S%s", link_pfx, pfx_slash);
-					lt_write_htmlencoded(callb, usr, link);
+					html_write_escaped(callb, usr, link);
 					lt_writes(callb, usr, "'><span class='tooltip'>");
-					lt_write_htmlencoded(callb, usr, name);
+					html_write_escaped(callb, usr, name);
 					lt_writes(callb, usr, "</span></span>");
 				}
 				else {
 					lt_io_printf(callb, usr, "<a href='%S%s", link_pfx, pfx_slash);
-					lt_write_htmlencoded(callb, usr, link);
+					html_write_escaped(callb, usr, link);
 					callb(usr, "'>", 2);
-					lt_write_htmlencoded(callb, usr, name);
+					html_write_escaped(callb, usr, name);
 					callb(usr, "</a>", 4);
 				}
 			}	break;
@@ -208,7 +198,7 @@ void lt_md_render(lstr_t markdown, lstr_t link_base, lt_write_fn_t callb, void*
 
 				lstr_t code = consume_until_str(&it, end, LSTR("```", tilde_count));
 				lt_io_printf(callb, usr, "<pre class='%scode'>", add_attribs);
-				lt_write_htmlencoded(callb, usr, code);
+				html_write_escaped(callb, usr, code);
 				callb(usr, "</pre>", 6);
 			}	break;
 
@@ -216,19 +206,19 @@ void lt_md_render(lstr_t markdown, lstr_t link_base, lt_write_fn_t callb, void*
 				if (consume_if_str_pending(&it, end, CLSTR("**"))) {
 					lstr_t text = consume_until_str(&it, end, CLSTR("***"));
 					callb(usr, "<i><b>", 6);
-					lt_write_htmlencoded(callb, usr, text);
+					html_write_escaped(callb, usr, text);
 					callb(usr, "</b></i>", 8);
 				}
 				else if (consume_if_char_pending(&it, end, '*')) {
 					lstr_t text = consume_until_str(&it, end, CLSTR("**"));
 					callb(usr, "<b>", 3);
-					lt_write_htmlencoded(callb, usr, text);
+					html_write_escaped(callb, usr, text);
 					callb(usr, "</b>", 4);
 				}
 				else {
 					lstr_t text = consume_until_char(&it, end, '*');
 					callb(usr, "<i>", 3);
-					lt_write_htmlencoded(callb, usr, text);
+					html_write_escaped(callb, usr, text);
 					callb(usr, "</i>", 4);
 				}
 				break;
@@ -239,7 +229,7 @@ void lt_md_render(lstr_t markdown, lstr_t link_base, lt_write_fn_t callb, void*
 				if (consume_if_char_pending(&it, end, '~')) {
 					lstr_t text = consume_until_str(&it, end, CLSTR("~~"));
 					callb(usr, "<s>", 3);
-					lt_write_htmlencoded(callb, usr, text);
+					html_write_escaped(callb, usr, text);
 					callb(usr, "</s>", 4);
 				}
 				else {
@@ -254,9 +244,7 @@ void lt_md_render(lstr_t markdown, lstr_t link_base, lt_write_fn_t callb, void*
 			case '"': callb(usr, "&quot;", 6); break;
 			default:
 				char* start = it - 1;
-				while (it < end && !special_char_tab[(u8)*it]) {
-					++it;
-				}
+				it += byte_set_span(&special_chars, it, end - it);
 				callb(usr, start, it - start);
 				break;
 			}
@@ -0,0 +1,175 @@
+#include <lt/strstream.h>
+#include <lt/mem.h>
+#include <lt/str.h>
+#include <lt/io.h>
+
+#include "server.h"
+#include "template.h"
+#include "markdown.h"
+
+// rendered documents live in their own template cache, as templates made of a single text run.
+// they are revalidated like template files, and scatter list responses can hold them while they are sent.
+
+static
+compiled_template_t* load_markdown(lstr_t source, void* usr) {
+	lstr_t link_base = *(lstr_t*)usr;
+
+	lt_strstream_t ss;
+	if (lt_strstream_create(&ss, lt_libc_heap)) {
+		return NULL;
+	}
+	lt_md_render(source, link_base, (lt_write_fn_t)lt_strstream_write, &ss);
+	return template_from_text(ss.str);
+}
+
+// links are rendered relative to link_base, so a file that is mapped under two routes is cached twice
+static
+lt_err_t find_document(server_t* server, lstr_t path, lstr_t link_base, compiled_template_t* out[static 1]) {
+	char key_buf[LT_PATH_MAX * 2];
+	if (path.len + 1 + link_base.len > sizeof(key_buf)) {
+		return LT_ERR_NOT_FOUND;
+	}
+	memcpy(key_buf, path.str, path.len);
+	key_buf[path.len] = '\n';
+	memcpy(key_buf + path.len + 1, link_base.str, link_base.len);
+	lstr_t key = LSTR(key_buf, path.len + 1 + link_base.len);
+
+	return template_cache_load(&server->markdown_cache, key, path, load_markdown, &link_base, out);
+}
+
+// writes the document named by the markdown_path variable, see srv_respond_markdown
+template_stream(markdown) {
+	lstr_t* path = srv_get_var(conn, CLSTR("markdown_path"));
+	lstr_t* link_base = srv_get_var(conn, CLSTR("markdown_link_base"));
+	if (!path) {
+		return;
+	}
+
+	lt_err_t err;
+	compiled_template_t* doc;
+	if ((err = find_document(conn->server, *path, link_base ? *link_base : NLSTR(), &doc))) {
+		srv_log_error(conn, CLSTR("failed to render"), *path, err);
+		return;
+	}
+
+	template_write_text(__callb, __usr, conn, doc);
+}
+
+static
+lstr_t strip_extension(lstr_t name) {
+	if (lt_lssuffix(name, CLSTR(".md"))) {
+		name.len -= 3;
+	}
+	return name;
+}
+
+static
+lstr_t last_segment(lstr_t path) {
+	for (usz i = path.len; i > 0; --i) {
+		if (path.str[i - 1] == '/') {
+			return LSTR(path.str + i, path.len - i);
+		}
+	}
+	return path;
+}
+
+static
+lstr_t parent_path(lstr_t path) {
+	for (usz i = path.len; i > 0; --i) {
+		if (path.str[i - 1] == '/') {
+			return LSTR(path.str, i - 1);
+		}
+	}
+	return NLSTR();
+}
+
+// renders the markdown file at path into the body of template, which places it with 'call markdown;'.
+// the variables markdown_path, markdown_link_base and markdown_name are set for the template.
+// returns LT_ERR_NOT_FOUND if the document does not exist.
+lt_err_t srv_respond_markdown(connection_t* conn, lstr_t path, lstr_t link_base, lstr_t template) {
+	// rendered before the template runs, so that a missing document can still be answered with a 404
+	lt_err_t err;
+	compiled_template_t* doc;
+	if ((err = find_document(conn->server, path, link_base, &doc))) {
+		return err;
+	}
+	template_cache_release(doc);
+
+	lstr_t name = last_segment(path);
+	if (lt_lseq(name, CLSTR("index.md"))) {
+		lstr_t dir = last_segment(parent_path(path));
+		name = dir.len ? dir : name;
+	}
+
+	srv_set_var(conn, CLSTR("markdown_path"), path);
+	srv_set_var(conn, CLSTR("markdown_link_base"), link_base);
+	srv_set_var(conn, CLSTR("markdown_name"), strip_extension(name));
+
+	// a template that can not be loaded was logged by template_cache_get already
+	if ((err = template_render_file_iov(template, conn, SRV_IOV_STREAM_THRESHOLD)) && err != LT_ERR_NOT_FOUND) {
+		srv_log_error(conn, CLSTR("failed to render markdown template"), template, err);
+	}
+	return LT_SUCCESS;
+}
+
+static
+lt_err_t respond_document(connection_t* conn, route_mapping_t* m, lstr_t file) {
+	lstr_t route = lt_lseq(m->route, CLSTR("/")) ? NLSTR() : m->route;
+	lstr_t dir = parent_path(file);
+
+	lstr_t path = file_cache_join(&conn->arena->interf, m->target, file);
+	lstr_t link_base = dir.len ? lt_lsbuild(&conn->arena->interf, "%S/%S", route, dir) : route;
+	return srv_respond_markdown(conn, path, link_base, m->template);
+}
+
+// '/docs/guide' is served from 'guide.md' or 'guide/index.md' below the mapped directory, '/docs/guide.md'
+// from 'guide.md' directly. every other file with an extension is served as it is, for images and the like.
+void srv_handle_markdown_mapping(connection_t* conn, route_mapping_t* m) {
+	lt_err_t err;
+
+	conn->response_mime_type = m->mime_type;
+
+	if (!m->prefix) {
+		err = srv_respond_markdown(conn, m->target, parent_path(m->route), m->template);
+		goto done;
+	}
+
+	lstr_t file = LSTR(conn->uri.page.str + m->route.len, conn->uri.page.len - m->route.len);
+	while (file.len && file.str[0] == '/') {
+		++file.str;
+		--file.len;
+	}
+	while (file.len && file.str[file.len - 1] == '/') {
+		--file.len;
+	}
+
+	if (lt_lssuffix(file, CLSTR(".md"))) {
+		err = respond_document(conn, m, file);
+		goto done;
+	}
+
+	lstr_t name = last_segment(file);
+	if (name.len && memchr(name.str, '.', name.len)) {
+		srv_handle_dir_mapping(conn, m->route, m->target, NLSTR());
+		return;
+	}
+
+	if (file.len) {
+		lstr_t doc = lt_lsbuild(&conn->arena->interf, "%S.md", file);
+		if ((err = respond_document(conn, m, doc)) != LT_ERR_NOT_FOUND) {
+			goto done;
+		}
+	}
+
+	lstr_t index = file.len ? lt_lsbuild(&conn->arena->interf, "%S/index.md", file) : CLSTR("index.md");
+	err = respond_document(conn, m, index);
+
+done:
+	if (!err) {
+		return;
+	}
+	if (err != LT_ERR_NOT_FOUND) {
+		srv_log_error(conn, CLSTR("failed to render"), conn->uri.page, err);
+	}
+	conn->server->on_404(conn);
+}
@@ -1,148 +1,88 @@
 #include <lt/str.h>
+#include <lt/mem.h>
 
-lstr_t mime_type_or_default(lstr_t path, lstr_t def) {
-#define map_mime(extension, mime) if (lt_lssuffix(path, CLSTR(extension))) return CLSTR(mime)
-
-	map_mime(".aac", "audio/aac");
-	map_mime(".abw", "application/x-abiword");
-	map_mime(".apng", "image/apng");
-	map_mime(".arc", "application/x-freearc");
-	map_mime(".avif", "image/avif");
-	map_mime(".avi", "video/x-msvideo");
-	map_mime(".azw", "application/vnd.amazon.ebook");
-	map_mime(".bin", "application/octet-stream");
-	map_mime(".bmp", "image/bmp");
-	map_mime(".bz", "application/x-bzip");
-	map_mime(".bz2", "application/x-bzip2");
-	map_mime(".cda", "application/x-cdf");
-	map_mime(".conf", "text/plain");
-	map_mime(".csh", "application/x-csh");
-	map_mime(".css", "text/css");
-	map_mime(".csv", "text/csv");
-	map_mime(".doc", "application/msword");
-	map_mime(".docx", "application/vnd.openxmlformats-officedocument.wordprocessingml.document");
-	map_mime(".eot", "application/vnd.ms-fontobject");
-	map_mime(".epub", "application/epub+zip");
-	map_mime(".exe", "application/vnd.microsoft.portable-executable");
-	map_mime(".flac", "audio/flac");
-	map_mime(".gz", "application/gzip");
-	map_mime(".gif", "image/gif");
-	map_mime(".htm", "text/html");
-	map_mime(".html", "text/html");
-	map_mime(".ico", "image/vnd.microsoft.icon");
-	map_mime(".ics", "text/calendar");
-	map_mime(".ini", "text/plain");
-	map_mime(".jar", "application/java-archive");
-	map_mime(".jpeg", "image/jpeg");
-	map_mime(".jpg", "image/jpeg");
-	map_mime(".js", "text/javascript");
-	map_mime(".json", "application/json");
-	map_mime(".jsonld", "application/ld+json");
-	map_mime(".log", "text/plain");
-	map_mime(".mid", "audio/midi");
-	map_mime(".midi", "audio/midi");
-	map_mime(".mjs", "text/javascript");
-	map_mime(".mkv", "video/x-matroska");
-	map_mime(".mov", "video/quicktime");
-	map_mime(".mp3", "audio/mp3");
-	map_mime(".mp4", "video/mp4");
-	map_mime(".mpeg", "video/mpeg");
-	map_mime(".mpkg", "application/vnd.apple.installer+xml");
-	map_mime(".odp", "aplication/vnd.oasis.opendocument.presentation");
-	map_mime(".ods", "aplication/vnd.oasis.opendocument.spreadsheet");
-	map_mime(".odt", "aplication/vnd.oasis.opendocument.text");
-	map_mime(".oga", "audio/ogg");
-	map_mime(".ogg", "audio/ogg");
-	map_mime(".ogv", "video/ogg");
-	map_mime(".ogx", "application/ogg");
-	map_mime(".opus", "audio/opus");
-	map_mime(".otf", "font/otf");
-	map_mime(".png", "image/png");
-	map_mime(".pdf", "application/pdf");
-	map_mime(".php", "application/x-httpd-php");
-	map_mime(".ppt", "application/vnd.ms-powerpoint");
-	map_mime(".pptx", "application/vnd.openxmlformats-officedocuments.presentationml.presentation");
-	map_mime(".rar", "application/vnd.rar");
-	map_mime(".rtf", "application/rtf");
-	map_mime(".sh", "application/x-sh");
-	map_mime(".svg", "image/svg+xml");
-	map_mime(".tar", "application/x-tar");
-	map_mime(".tif", "image/tiff");
-	map_mime(".tiff", "image/tiff");
-	map_mime(".ts", "video/mp2t");
-	map_mime(".ttf", "font/ttf");
-	map_mime(".txt", "text/plain");
-	map_mime(".vsd", "application/vnd.visio");
-	map_mime(".wav", "audio/wav");
-	map_mime(".weba", "audio/webm");
-	map_mime(".webm", "video/webm");
-	map_mime(".webp", "image/webp");
-	map_mime(".woff", "font/woff");
-	map_mime(".woff2", "font/woff2");
-	map_mime(".xhtml", "application/xhtml+xml");
-	map_mime(".xls", "application/vnd.ms-excel");
-	map_mime(".xlsx", "application/vnd.openxmlformats-officedocuments.spreadsheetml.sheet");
-	map_mime(".xml", "application/xml");
-	map_mime(".xul", "application/vnd.mozilla.xul+xml");
-	map_mime(".zip", "application/zip");
-	map_mime(".3gp", "video/3gpp");
-	map_mime(".3g2", "video/3gpp2");
-	map_mime(".7z", "application/x-7z-compressed");
-
-	// C
-	map_mime(".c", "text/plain");
-	map_mime(".h", "text/plain");
-
-	// C++
-	map_mime(".c++", "text/plain");
-	map_mime(".cc", "text/plain");
-	map_mime(".cp", "text/plain");
-	map_mime(".cpp", "text/plain");
-	map_mime(".cppm", "text/plain");
-	map_mime(".cxx", "text/plain");
-	map_mime(".hh", "text/plain");
-	map_mime(".hpp", "text/plain");
-	map_mime(".h++", "text/plain");
-
-	// GNU Make
-	map_mime("makefile", "text/plain");
-
-	// Git
-	map_mime(".gitignore", "text/plain");
-	map_mime(".gitmodules", "text/plain");
-	map_mime(".gitattributes", "text/plain");
-
-	// LICENSE
-	map_mime("LICENSE", "text/plain");
-
-	// Rust
-	map_mime(".rs", "text/plain");
+#include "mime.h"
 
-	// Zig
-	map_mime(".zig", "text/plain");
+#include "mime_table.c"
 
-	// Onyx
-	map_mime(".nyx", "text/plain");
-
-	// C#
-	map_mime(".cs", "text/plain");
-	map_mime(".cshtml", "text/plain");
-	map_mime(".c#", "text/plain");
-	map_mime(".razor", "text/plain");
-
-	// Haskell
-	map_mime(".hs", "text/plain");
-	map_mime(".lhs", "text/plain");
-
-	// Python
-	map_mime(".py", "text/plain");
+// the part of the file name after the last '.', or the whole name if there is none ('makefile', 'LICENSE')
+lstr_t mime_extension(lstr_t path) {
+	char* end = path.str + path.len;
+	char* it = end;
+	while (it > path.str && it[-1] != '/' && it[-1] != '.') {
+		--it;
+	}
+	return lt_lsfrom_range(it, end);
+}
 
-	// Editor project files
-	map_mime(".sln", "text/plain");
-	map_mime(".csproj", "text/plain");
+// types added with mime_register, checked before the generated table so that they can override it
+static mime_entry_t* custom_types = NULL;
+static usz custom_mask = 0;
+static usz custom_count = 0;
+
+static
+mime_entry_t* custom_slot(mime_entry_t* table, usz mask, lstr_t ext) {
+	usz i = mime_hash(ext.str, ext.len, 0) & mask;
+	while (table[i].extension.len && !lt_lseq_nocase(table[i].extension, ext)) {
+		i = (i + 1) & mask;
+	}
+	return &table[i];
+}
 
-	map_mime(".iso", "application/octet-stream");
+// not synchronized with lookups, all types have to be registered before the server is started
+void mime_register(lstr_t extension, lstr_t mime_type) {
+	if (extension.len && extension.str[0] == '.') {
+		++extension.str;
+		--extension.len;
+	}
+	if (!extension.len || extension.len > MIME_MAX_EXTENSION) {
+		return;
+	}
+
+	// keep the load factor at or below 1/2
+	if ((custom_count + 1) * 2 > custom_mask + 1 || !custom_types) {
+		usz size = custom_types ? (custom_mask + 1) * 2 : 16;
+		mime_entry_t* table = lt_malloc(lt_libc_heap, size * sizeof(mime_entry_t));
+		LT_ASSERT(table);
+		lt_mzero(table, size * sizeof(mime_entry_t));
+
+		for (usz i = 0; custom_types && i <= custom_mask; ++i) {
+			if (custom_types[i].extension.len) {
+				*custom_slot(table, size - 1, custom_types[i].extension) = custom_types[i];
+			}
+		}
+		if (custom_types) {
+			lt_mfree(lt_libc_heap, custom_types);
+		}
+		custom_types = table;
+		custom_mask = size - 1;
+	}
+
+	mime_entry_t* slot = custom_slot(custom_types, custom_mask, extension);
+	if (!slot->extension.len) {
+		++custom_count;
+	}
+	*slot = (mime_entry_t){ extension, mime_type };
+}
 
+lstr_t mime_type_or_default(lstr_t path, lstr_t def) {
+	lstr_t ext = mime_extension(path);
+	if (!ext.len || ext.len > MIME_MAX_EXTENSION) {
+		return def;
+	}
+
+	if (custom_count) {
+		mime_entry_t* slot = custom_slot(custom_types, custom_mask, ext);
+		if (slot->extension.len) {
+			return slot->mime_type;
+		}
+	}
+
+	u32 seed = mime_seeds[mime_hash(ext.str, ext.len, 0) & (MIME_BUCKET_COUNT - 1)];
+	const mime_entry_t* entry = &mime_slots[mime_hash(ext.str, ext.len, seed) & (MIME_SLOT_COUNT - 1)];
+	if (entry->extension.len == ext.len && lt_lseq_nocase(entry->extension, ext)) {
+		return entry->mime_type;
+	}
 	return def;
 }
 
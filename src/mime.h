@@ -3,7 +3,42 @@
 
 #include <lt/lt.h>
 
+typedef
+struct mime_entry {
+	lstr_t extension;
+	lstr_t mime_type;
+} mime_entry_t;
+
+// mime.c
+
+#define MIME_MAX_EXTENSION 16
+
 lstr_t mime_type_or_default(lstr_t path, lstr_t def);
 lstr_t mime_type(lstr_t path);
 
+lstr_t mime_extension(lstr_t path);
+
+void mime_register(lstr_t extension, lstr_t mime_type);
+
+// generated from mime.tbl by tools/mimegen, in table order
+extern const mime_entry_t mime_table[];
+extern const usz mime_table_count;
+
+// shared with the generator, which searches for seeds that make it collision-free over the table
+static inline
+u32 mime_hash(const char* str, usz len, u32 seed) {
+	u32 hash = 0x811C9DC5 ^ (seed * 0x9E3779B9);
+	for (usz i = 0; i < len; ++i) {
+		u8 c = str[i];
+		if (c >= 'A' && c <= 'Z') {
+			c += 'a' - 'A';
+		}
+		hash = (hash ^ c) * 0x01000193;
+	}
+	hash ^= hash >> 15;
+	hash *= 0x2C1B3C6D;
+	hash ^= hash >> 12;
+	return hash;
+}
+
 #endif
@@ -0,0 +1,66 @@
+#include <lt/mem.h>
+#include <lt/str.h>
+
+#include "pagecache.h"
+
+#define BUCKET_COUNT 1024
+
+lt_err_t page_cache_create(page_cache_t out_cache[static 1], usz max_size) {
+	return clock_cache_create(&out_cache->store, BUCKET_COUNT, max_size);
+}
+
+void page_cache_release(page_cache_entry_t* entry) {
+	clock_entry_release(&entry->base);
+}
+
+void page_cache_destroy(page_cache_t cache[static 1]) {
+	clock_cache_destroy(&cache->store);
+}
+
+page_cache_entry_t* page_cache_get(page_cache_t cache[static 1], lstr_t key, u64 now_msec) {
+	return (page_cache_entry_t*)clock_cache_get(&cache->store, key, now_msec);
+}
+
+// copies the body into a new entry and returns it with a reference for the caller, or NULL if it does not fit.
+// generation has to be read before rendering started, a purge in the meantime keeps the body out of the cache.
+page_cache_entry_t* page_cache_insert(page_cache_t cache[static 1], u32 mapping, lstr_t key, const struct iovec* iov, usz count, usz size, u64 expires_msec, u64 generation) {
+	usz footprint = sizeof(page_cache_entry_t) + key.len + size;
+	if (footprint > cache->store.max_size) {
+		return NULL;
+	}
+
+	page_cache_entry_t* entry = lt_malloc(lt_libc_heap, footprint);
+	if (!entry) {
+		return NULL;
+	}
+	*entry = (page_cache_entry_t) {
+			.base = {
+				.hash = lt_hashls(key),
+				.refs = 2, // one for the cache, one for the caller
+				.footprint = footprint,
+				.expires_msec = expires_msec,
+				.key = LSTR((char*)(entry + 1), key.len) },
+			.mapping = mapping,
+			.body = LSTR((char*)(entry + 1) + key.len, size) };
+	memcpy(entry->base.key.str, key.str, key.len);
+
+	char* it = entry->body.str;
+	for (usz i = 0; i < count; ++i) {
+		memcpy(it, iov[i].iov_base, iov[i].iov_len);
+		it += iov[i].iov_len;
+	}
+
+	// the existing entry has expired or was rendered concurrently, the newer one wins
+	return (page_cache_entry_t*)clock_cache_insert(&cache->store, &entry->base, generation, 1);
+}
+
+static
+b8 of_mapping(const clock_entry_t* entry, void* usr) {
+	u32 mapping = *(u32*)usr;
+	return mapping == PAGE_CACHE_ALL || ((const page_cache_entry_t*)entry)->mapping == mapping;
+}
+
+// removes all entries of one mapping, or every entry with PAGE_CACHE_ALL
+void page_cache_purge(page_cache_t cache[static 1], u32 mapping) {
+	clock_cache_remove_if(&cache->store, of_mapping, &mapping);
+}
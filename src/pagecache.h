@@ -0,0 +1,41 @@
+#ifndef PAGECACHE_H
+#define PAGECACHE_H 1
+
+#include <lt/lt.h>
+
+#include "clockcache.h"
+
+#include <sys/uio.h>
+
+// pagecache.c
+
+typedef
+struct page_cache_entry {
+	clock_entry_t base; // keyed by the page key, expires_msec is 0 if the entry is only removed by a purge
+	u32 mapping;
+	lstr_t body;
+} page_cache_entry_t;
+
+#define PAGE_CACHE_ALL ((u32)-1)
+#define PAGE_CACHE_MAX_KEY_SIZE 1024
+
+// rendered response bodies by key, bounded in size and evicted with the CLOCK algorithm like the file cache
+typedef
+struct page_cache {
+	clock_cache_t store;
+} page_cache_t;
+
+lt_err_t page_cache_create(page_cache_t out_cache[static 1], usz max_size);
+void page_cache_destroy(page_cache_t cache[static 1]);
+
+page_cache_entry_t* page_cache_get(page_cache_t cache[static 1], lstr_t key, u64 now_msec);
+page_cache_entry_t* page_cache_insert(page_cache_t cache[static 1], u32 mapping, lstr_t key, const struct iovec* iov, usz count, usz size, u64 expires_msec, u64 generation);
+static LT_INLINE
+u64 page_cache_generation(page_cache_t cache[static 1]) {
+	return clock_cache_generation(&cache->store);
+}
+void page_cache_release(page_cache_entry_t* entry);
+
+void page_cache_purge(page_cache_t cache[static 1], u32 mapping);
+
+#endif
@@ -0,0 +1,146 @@
+#include <lt/mem.h>
+
+#include "pool.h"
+
+#define TAG_SHIFT 32
+#define SLOT_MASK 0xFFFFFFFF
+
+lt_err_t slot_pool_create(slot_pool_t out_pool[static 1], usz count, lt_alloc_t alloc[static 1]) {
+	LT_ASSERT(count < SLOT_NONE);
+
+	u32* next = lt_malloc(alloc, count * sizeof(u32));
+	if (!next) {
+		return LT_ERR_OUT_OF_MEMORY;
+	}
+	for (usz i = 0; i < count; ++i) {
+		next[i] = i + 1;
+	}
+	if (count) {
+		next[count - 1] = SLOT_NONE;
+	}
+
+	*out_pool = (slot_pool_t) {
+			.head = count ? 0 : SLOT_NONE,
+			.next = next,
+			.count = count,
+			.free_count = count };
+	return LT_SUCCESS;
+}
+
+void slot_pool_destroy(const slot_pool_t pool[static 1], lt_alloc_t alloc[static 1]) {
+	lt_mfree(alloc, (u32*)pool->next);
+}
+
+u32 slot_pool_pop(slot_pool_t pool[static 1]) {
+	u64 head = __atomic_load_n(&pool->head, __ATOMIC_ACQUIRE);
+	for (;;) {
+		u32 slot = head & SLOT_MASK;
+		if (slot == SLOT_NONE) {
+			return SLOT_NONE;
+		}
+
+		// next may be stale if another thread popped the slot first, the tag makes the cas fail in that case
+		u32 next = __atomic_load_n(&pool->next[slot], __ATOMIC_RELAXED);
+		u64 new_head = ((head >> TAG_SHIFT) + 1) << TAG_SHIFT | next;
+		if (__atomic_compare_exchange_n(&pool->head, &head, new_head, 1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			__atomic_fetch_sub(&pool->free_count, 1, __ATOMIC_RELAXED);
+			return slot;
+		}
+	}
+}
+
+void slot_pool_push(slot_pool_t pool[static 1], u32 slot) {
+	LT_ASSERT(slot < pool->count);
+
+	u64 head = __atomic_load_n(&pool->head, __ATOMIC_RELAXED);
+	for (;;) {
+		__atomic_store_n(&pool->next[slot], (u32)(head & SLOT_MASK), __ATOMIC_RELAXED);
+		u64 new_head = ((head >> TAG_SHIFT) + 1) << TAG_SHIFT | slot;
+		if (__atomic_compare_exchange_n(&pool->head, &head, new_head, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+			__atomic_fetch_add(&pool->free_count, 1, __ATOMIC_RELAXED);
+			return;
+		}
+	}
+}
+
+lt_err_t accept_queue_create(accept_queue_t out_queue[static 1], usz size, lt_alloc_t alloc[static 1]) {
+	usz pow2 = 2;
+	while (pow2 < size) {
+		pow2 <<= 1;
+	}
+
+	accept_cell_t* cells = lt_malloc(alloc, pow2 * sizeof(accept_cell_t));
+	if (!cells) {
+		return LT_ERR_OUT_OF_MEMORY;
+	}
+	for (usz i = 0; i < pow2; ++i) {
+		cells[i].seq = i;
+	}
+
+	*out_queue = (accept_queue_t) {
+			.cells = cells,
+			.mask = pow2 - 1,
+			.head = 0,
+			.tail = 0 };
+	return LT_SUCCESS;
+}
+
+void accept_queue_destroy(const accept_queue_t queue[static 1], lt_alloc_t alloc[static 1]) {
+	lt_mfree(alloc, queue->cells);
+}
+
+b8 accept_queue_push(accept_queue_t queue[static 1], const pending_conn_t conn[static 1]) {
+	usz pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+	accept_cell_t* cell;
+	for (;;) {
+		cell = &queue->cells[pos & queue->mask];
+		usz seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		isz diff = (isz)seq - (isz)pos;
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&queue->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;
+			}
+		}
+		else if (diff < 0) {
+			return 0;
+		}
+		else {
+			pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+		}
+	}
+
+	cell->conn = *conn;
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+b8 accept_queue_pop(accept_queue_t queue[static 1], pending_conn_t out_conn[static 1]) {
+	usz pos = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+	accept_cell_t* cell;
+	for (;;) {
+		cell = &queue->cells[pos & queue->mask];
+		usz seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		isz diff = (isz)seq - (isz)(pos + 1);
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&queue->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;
+			}
+		}
+		else if (diff < 0) {
+			return 0;
+		}
+		else {
+			pos = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+		}
+	}
+
+	*out_conn = cell->conn;
+	__atomic_store_n(&cell->seq, pos + queue->mask + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+usz accept_queue_depth(const accept_queue_t queue[static 1]) {
+	usz tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+	usz head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+	return tail > head ? tail - head : 0;
+}
@@ -0,0 +1,54 @@
+#ifndef POOL_H
+#define POOL_H 1
+
+#include <lt/net.h>
+
+// pool.c
+
+#define SLOT_NONE (~(u32)0)
+
+// lock-free free-list of slot indices.
+// the head packs a modification tag in the upper 32 bits to make it ABA-safe.
+typedef
+struct slot_pool {
+	volatile u64 head;
+	volatile u32* next;
+	usz count;
+	volatile usz free_count;
+} slot_pool_t;
+
+lt_err_t slot_pool_create(slot_pool_t out_pool[static 1], usz count, lt_alloc_t alloc[static 1]);
+void slot_pool_destroy(const slot_pool_t pool[static 1], lt_alloc_t alloc[static 1]);
+
+u32 slot_pool_pop(slot_pool_t pool[static 1]);
+void slot_pool_push(slot_pool_t pool[static 1], u32 slot);
+
+typedef
+struct pending_conn {
+	lt_socket_t* socket;
+	lt_sockaddr_t addr;
+} pending_conn_t;
+
+typedef
+struct accept_cell {
+	volatile usz seq;
+	pending_conn_t conn;
+} accept_cell_t;
+
+// bounded multi-producer/multi-consumer queue of accepted sockets waiting for a free slot
+typedef
+struct accept_queue {
+	accept_cell_t* cells;
+	usz mask;
+	volatile usz head;
+	volatile usz tail;
+} accept_queue_t;
+
+lt_err_t accept_queue_create(accept_queue_t out_queue[static 1], usz size, lt_alloc_t alloc[static 1]);
+void accept_queue_destroy(const accept_queue_t queue[static 1], lt_alloc_t alloc[static 1]);
+
+b8 accept_queue_push(accept_queue_t queue[static 1], const pending_conn_t conn[static 1]);
+b8 accept_queue_pop(accept_queue_t queue[static 1], pending_conn_t out_conn[static 1]);
+usz accept_queue_depth(const accept_queue_t queue[static 1]);
+
+#endif
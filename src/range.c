@@ -0,0 +1,197 @@
+#include <lt/io.h>
+#include <lt/str.h>
+
+#include "server.h"
+
+static
+b8 parse_u64(char** it, char* end, u64 out_val[static 1]) {
+	char* start = *it;
+	u64 val = 0;
+	while (*it < end && **it >= '0' && **it <= '9') {
+		u64 next = val * 10 + (u64)(**it - '0');
+		if (next < val) {
+			return 0;
+		}
+		val = next;
+		++*it;
+	}
+	*out_val = val;
+	return *it != start;
+}
+
+// parses a single 'first-last', 'first-' or '-suffix' spec. returns 0 for syntax errors, sets *out_size to 0
+// for specs that are valid but not satisfiable.
+static
+b8 parse_range_spec(lstr_t spec, u64 full_size, byte_range_t out_range[static 1]) {
+	char* it = spec.str, *end = it + spec.len;
+	u64 first, last;
+
+	if (it < end && *it == '-') {
+		++it;
+		if (!parse_u64(&it, end, &last) || it != end) {
+			return 0;
+		}
+		if (last > full_size) {
+			last = full_size;
+		}
+		*out_range = (byte_range_t){ full_size - last, last };
+		return 1;
+	}
+
+	if (!parse_u64(&it, end, &first) || it >= end || *it++ != '-') {
+		return 0;
+	}
+	if (it == end) {
+		last = full_size - 1;
+	}
+	else if (!parse_u64(&it, end, &last) || it != end || last < first) {
+		return 0;
+	}
+
+	if (first >= full_size) {
+		*out_range = (byte_range_t){ 0, 0 };
+		return 1;
+	}
+	if (last >= full_size) {
+		last = full_size - 1;
+	}
+	*out_range = (byte_range_t){ first, last - first + 1 };
+	return 1;
+}
+
+static
+void sort_ranges(byte_range_t* ranges, usz count) {
+	for (usz i = 1; i < count; ++i) {
+		byte_range_t range = ranges[i];
+		usz j = i;
+		for (; j && ranges[j - 1].offset > range.offset; --j) {
+			ranges[j] = ranges[j - 1];
+		}
+		ranges[j] = range;
+	}
+}
+
+// If-Range requires the strong comparison function, a date is only accepted if it exactly matches Last-Modified
+static
+b8 if_range_matches(lstr_t if_range, lstr_t etag, i64 mtime_sec) {
+	if_range = lt_lstrim(if_range);
+	if (if_range.len && if_range.str[0] == '"') {
+		return etag.len && lt_lseq(if_range, etag);
+	}
+
+	i64 date;
+	return mtime_sec >= 0 && srv_parse_http_date(if_range, &date) && date == mtime_sec;
+}
+
+static
+void set_content_range(connection_t* conn, lstr_t range) {
+	lt_http_add_header(&conn->response, CLSTR("Content-Range"), range);
+}
+
+// narrows a complete '200 OK' response down to the byte ranges requested by the client. malformed or
+// unsatisfiable-in-part range headers fall back to the full response, as the spec allows.
+void srv_apply_range(connection_t* conn, lstr_t etag, i64 mtime_sec) {
+	lt_http_add_header(&conn->response, CLSTR("Accept-Ranges"), CLSTR("bytes"));
+
+	if (conn->request.request_method != LT_HTTP_GET || conn->response.response_status_code != 200) {
+		return;
+	}
+
+	lstr_t* range_header = lt_http_find_header(&conn->request, CLSTR("Range"));
+	if (!range_header) {
+		return;
+	}
+
+	lstr_t* if_range = lt_http_find_header(&conn->request, CLSTR("If-Range"));
+	if (if_range && !if_range_matches(*if_range, etag, mtime_sec)) {
+		return;
+	}
+
+	lstr_t spec = lt_lstrim(*range_header);
+	if (!lt_lsprefix(spec, CLSTR("bytes="))) {
+		return;
+	}
+	spec = LSTR(spec.str + 6, spec.len - 6);
+
+	response_file_t* file = &conn->response_file;
+	u64 full_size = file->fd >= 0 ? file->size : conn->response.body.len;
+
+	byte_range_t ranges[SRV_MAX_RANGES];
+	usz range_count = 0;
+
+	for (char* it = spec.str, *end = it + spec.len; it < end;) {
+		char* start = it;
+		while (it < end && *it != ',') {
+			++it;
+		}
+		lstr_t part = lt_lstrim(lt_lsfrom_range(start, it++));
+		if (!part.len) {
+			continue;
+		}
+
+		byte_range_t range;
+		if (!parse_range_spec(part, full_size, &range)) {
+			return;
+		}
+		if (!range.size) {
+			continue;
+		}
+		// excessive range counts are a known amplification vector, serve the whole file instead
+		if (range_count >= SRV_MAX_RANGES) {
+			return;
+		}
+		ranges[range_count++] = range;
+	}
+
+	if (!range_count) {
+		srv_release_body(conn);
+		conn->response.response_status_code = 416;
+		conn->response.response_status_msg = CLSTR("Range Not Satisfiable");
+		conn->response.body = NLSTR();
+		conn->response_mime_type = CLSTR("text/plain");
+		set_content_range(conn, lt_lsbuild(&conn->arena->interf, "bytes */%uq", full_size));
+		return;
+	}
+
+	// merge overlapping and adjacent ranges so no byte is sent twice
+	sort_ranges(ranges, range_count);
+	usz merged_count = 1;
+	for (usz i = 1; i < range_count; ++i) {
+		byte_range_t* prev = &ranges[merged_count - 1];
+		u64 prev_end = prev->offset + prev->size;
+		if (ranges[i].offset <= prev_end) {
+			u64 end = ranges[i].offset + ranges[i].size;
+			if (end > prev_end) {
+				prev->size = end - prev->offset;
+			}
+			continue;
+		}
+		ranges[merged_count++] = ranges[i];
+	}
+
+	conn->response.response_status_code = 206;
+	conn->response.response_status_msg = CLSTR("Partial Content");
+
+	if (merged_count == 1) {
+		byte_range_t range = ranges[0];
+		set_content_range(conn, lt_lsbuild(&conn->arena->interf, "bytes %uq-%uq/%uq", range.offset, range.offset + range.size - 1, full_size));
+		if (file->fd >= 0) {
+			file->offset += range.offset;
+			file->size = range.size;
+		}
+		else {
+			conn->response.body = LSTR(conn->response.body.str + range.offset, range.size);
+		}
+		return;
+	}
+
+	byte_range_t* stored = lt_amalloc(conn->arena, merged_count * sizeof(byte_range_t));
+	if (!stored) {
+		conn->response.response_status_code = 200;
+		conn->response.response_status_msg = CLSTR("OK");
+		return;
+	}
+	memcpy(stored, ranges, merged_count * sizeof(byte_range_t));
+	conn->response_ranges = stored;
+	conn->response_range_count = merged_count;
+}
@@ -7,17 +7,12 @@
 #include "template.h"
 
 lstr_t load_template(lstr_t path, connection_t* conn) {
-	lt_err_t err;
-
-	lstr_t template;
-	if ((err = lt_freadallp_utf8(path, &template, lt_libc_heap))) {
-		lt_werrf("failed to read template file '%S'\n", path);
-		return NLSTR();
-	}
+	return template_render_file_str(path, conn);
+}
 
-	lstr_t generated = template_render_str(template, conn);
-	lt_mfree(lt_libc_heap, template.str);
-	return generated;
+// renders into the response instead of a string, so that large pages are streamed, see template_render_file_iov
+lt_err_t respond_template(lstr_t path, connection_t* conn) {
+	return template_render_file_iov(path, conn, SRV_IOV_STREAM_THRESHOLD);
 }
 
 lstr_t load_text(lstr_t path) {
@@ -6,6 +6,7 @@
 #include "fwd.h"
 
 lstr_t load_template(lstr_t path, connection_t* conn);
+lt_err_t respond_template(lstr_t path, connection_t* conn);
 lstr_t load_text(lstr_t path);
 lstr_t load_raw(lstr_t path);
 
@@ -14,6 +15,11 @@ lstr_t load_template_cstr(char* path, connection_t* conn) {
 	return load_template(lt_lsfroms(path), conn);
 }
 
+static LT_INLINE
+lt_err_t respond_template_cstr(char* path, connection_t* conn) {
+	return respond_template(lt_lsfroms(path), conn);
+}
+
 static LT_INLINE
 lstr_t load_text_cstr(char* path) {
 	return load_text(lt_lsfroms(path));
@@ -29,6 +35,11 @@ lstr_t load_raw_cstr(char* path) {
 		lstr_t: load_template \
 		)((path), (conn))) \
 
+#define respond_template(path, conn) (_Generic((path), \
+		char*: respond_template_cstr, \
+		lstr_t: respond_template \
+		)((path), (conn))) \
+
 #define load_text(path) (_Generic((path), \
 		char*: load_text_cstr, \
 		lstr_t: load_text \
@@ -0,0 +1,774 @@
+#include <lt/io.h>
+#include <lt/mem.h>
+#include <lt/str.h>
+#include <lt/darr.h>
+#include <lt/strstream.h>
+
+#include "server.h"
+#include "bytescan.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define FILE_CHUNK_SIZE LT_KB(64)
+
+#ifndef IOV_MAX
+#	define IOV_MAX 1024
+#endif
+
+static
+b8 wait_fd(int fd, short events, int timeout_msec) {
+	struct pollfd pfd = { .fd = fd, .events = events };
+	int res;
+	while ((res = poll(&pfd, 1, timeout_msec)) < 0 && errno == EINTR)
+		;
+	return res > 0;
+}
+
+static
+b8 would_block(int fd, short events, int timeout_msec) {
+	if (errno == EINTR) {
+		return 1;
+	}
+	return (errno == EAGAIN || errno == EWOULDBLOCK) && wait_fd(fd, events, timeout_msec);
+}
+
+// reads are bounded by the request deadline, so a client trickling in its request can not hold a worker
+static
+int read_timeout(connection_t* conn) {
+	if (!conn->read_deadline_msec) {
+		return SRV_IO_TIMEOUT_MSEC;
+	}
+	u64 now = timer_now_msec();
+	return now < conn->read_deadline_msec ? (int)lt_min(conn->read_deadline_msec - now, SRV_IO_TIMEOUT_MSEC) : 0;
+}
+
+isz conn_recv(connection_t* conn, void* data, usz size) {
+	for (;;) {
+		isz res = recv(conn->fd, data, size, 0);
+		if (res >= 0) {
+			return res;
+		}
+		if (!would_block(conn->fd, POLLIN, read_timeout(conn))) {
+			return -1;
+		}
+	}
+}
+
+isz conn_send(connection_t* conn, const void* data, usz size) {
+	const u8* it = data;
+	usz remain = size;
+
+	while (remain) {
+		isz res = send(conn->fd, it, remain, MSG_NOSIGNAL);
+		if (res >= 0) {
+			it += res;
+			remain -= res;
+		}
+		else if (!would_block(conn->fd, POLLOUT, SRV_IO_TIMEOUT_MSEC)) {
+			return -1;
+		}
+	}
+	return size;
+}
+
+static
+b8 conn_is_plain(connection_t* conn) {
+	return conn->write_callb == (lt_write_fn_t)conn_send;
+}
+
+// reads through the per-connection buffer, so that any bytes received beyond the end of the current
+// request stay available for the next one instead of being lost to the parser
+isz conn_recv_buffered(connection_t* conn, void* data, usz size) {
+	// the ssl receive function blocks until the full size has been read, so read-ahead is not possible there
+	if (!conn_is_plain(conn)) {
+		return conn->read_callb(conn->callb_usr, data, size);
+	}
+
+	if (conn->recv_pos == conn->recv_len) {
+		if (!conn->recv_buf && !(conn->recv_buf = lt_malloc(lt_libc_heap, SRV_RECV_BUFFER_SIZE))) {
+			return -1;
+		}
+
+		// large requests bypass the buffer
+		if (size >= SRV_RECV_BUFFER_SIZE) {
+			return conn_recv(conn, data, size);
+		}
+
+		isz res = conn_recv(conn, conn->recv_buf, SRV_RECV_BUFFER_SIZE);
+		if (res <= 0) {
+			return res;
+		}
+		conn->recv_pos = 0;
+		conn->recv_len = res;
+	}
+
+	usz avail = lt_min(size, conn->recv_len - conn->recv_pos);
+	memcpy(data, conn->recv_buf + conn->recv_pos, avail);
+	conn->recv_pos += avail;
+	return avail;
+}
+
+// returns the value of the Content-Length header in head, or 0 if there is none
+static
+u64 find_content_length(lstr_t head) {
+	static const lstr_t key = CLSTR("content-length:");
+
+	for (usz i = byte_find(head.str, head.len, '\n') + 1; i < head.len; i += byte_find(head.str + i, head.len - i, '\n') + 1) {
+		if (head.len - i < key.len || !lt_lseq_nocase(LSTR(head.str + i, key.len), key)) {
+			continue;
+		}
+
+		u64 len = 0;
+		for (i += key.len; i < head.len && (head.str[i] == ' ' || head.str[i] == '\t'); ++i)
+			;
+		for (; i < head.len && head.str[i] >= '0' && head.str[i] <= '9'; ++i) {
+			len = len * 10 + (head.str[i] - '0');
+		}
+		return len;
+	}
+	return 0;
+}
+
+// checks the received bytes for a complete request, the head is only searched from offset scan_from on
+static
+request_status_t buffered_request_from(connection_t* conn, usz scan_from) {
+	if (conn->recv_pos == conn->recv_len) {
+		return REQUEST_NONE;
+	}
+
+	u8* start = conn->recv_buf + conn->recv_pos;
+	usz avail = conn->recv_len - conn->recv_pos;
+
+	for (usz i = scan_from > 3 ? scan_from - 3 : 0; i < avail; ++i) {
+		i += byte_find((char*)start + i, avail - i, '\n');
+		if (i >= avail || i < 3 || memcmp(start + i - 3, "\r\n\r\n", 4) != 0) {
+			continue;
+		}
+
+		// bodies that fit into the buffer are awaited as well, larger ones are read by the parser with
+		// reads bounded by the header deadline
+		usz head_len = i + 1;
+		u64 body_len = find_content_length(LSTR((char*)start, head_len));
+		if (body_len <= SRV_RECV_BUFFER_SIZE - head_len && avail < head_len + body_len) {
+			return REQUEST_PARTIAL;
+		}
+		return REQUEST_READY;
+	}
+
+	return avail == SRV_RECV_BUFFER_SIZE ? REQUEST_TOO_LARGE : REQUEST_PARTIAL;
+}
+
+request_status_t conn_buffered_request(connection_t* conn) {
+	return buffered_request_from(conn, 0);
+}
+
+// reads whatever the client has sent so far, without waiting for more. a client that trickles in its
+// request costs one short read per event instead of a blocked worker, the timer sweep closes it once
+// its header deadline has passed. the ssl layer can only read blocking, so https requests are always
+// reported as ready, and the worker's io guard ends the parse once the header deadline has passed.
+request_status_t conn_recv_request(connection_t* conn) {
+	if (!conn_is_plain(conn)) {
+		return REQUEST_READY;
+	}
+
+	if (!conn->recv_buf && !(conn->recv_buf = lt_malloc(lt_libc_heap, SRV_RECV_BUFFER_SIZE))) {
+		return REQUEST_CLOSED;
+	}
+
+	// move the start of a partial request to the front, to make room for the rest
+	if (conn->recv_pos) {
+		memmove(conn->recv_buf, conn->recv_buf + conn->recv_pos, conn->recv_len - conn->recv_pos);
+		conn->recv_len -= conn->recv_pos;
+		conn->recv_pos = 0;
+	}
+
+	usz scanned = conn->recv_len;
+	isz res;
+	while ((res = recv(conn->fd, conn->recv_buf + conn->recv_len, SRV_RECV_BUFFER_SIZE - conn->recv_len, 0)) < 0 && errno == EINTR)
+		;
+
+	if (res < 0) {
+		return errno == EAGAIN || errno == EWOULDBLOCK ? buffered_request_from(conn, scanned) : REQUEST_CLOSED;
+	}
+	conn->recv_len += res;
+
+	request_status_t status = buffered_request_from(conn, scanned);
+	// a client may shut down its side right after sending the request, which is still answered
+	if (!res && status != REQUEST_READY) {
+		return REQUEST_CLOSED;
+	}
+	return status;
+}
+
+void conn_free_buffers(connection_t* conn) {
+	if (conn->recv_buf) {
+		lt_mfree(lt_libc_heap, conn->recv_buf);
+		conn->recv_buf = NULL;
+	}
+	if (conn->send_buf) {
+		lt_mfree(lt_libc_heap, conn->send_buf);
+		conn->send_buf = NULL;
+	}
+	conn->recv_pos = 0;
+	conn->recv_len = 0;
+	conn->send_len = 0;
+	conn->send_batch = 0;
+}
+
+// writes all buffers, modifying the iovec array in the process
+static
+b8 conn_write_direct(connection_t* conn, struct iovec* iov, usz count) {
+	if (!conn_is_plain(conn)) {
+		for (usz i = 0; i < count; ++i) {
+			if (iov[i].iov_len && conn->write_callb(conn->callb_usr, iov[i].iov_base, iov[i].iov_len) < 0) {
+				return 0;
+			}
+		}
+		return 1;
+	}
+
+	while (count) {
+		isz res = writev(conn->fd, iov, lt_min(count, IOV_MAX));
+		if (res < 0) {
+			if (!would_block(conn->fd, POLLOUT, SRV_IO_TIMEOUT_MSEC)) {
+				return 0;
+			}
+			continue;
+		}
+
+		while (count && (usz)res >= iov->iov_len) {
+			res -= iov->iov_len;
+			++iov;
+			--count;
+		}
+		if (count) {
+			iov->iov_base = (u8*)iov->iov_base + res;
+			iov->iov_len -= res;
+		}
+	}
+	return 1;
+}
+
+b8 conn_flush(connection_t* conn) {
+	if (!conn->send_len) {
+		return 1;
+	}
+	struct iovec iov = { .iov_base = conn->send_buf, .iov_len = conn->send_len };
+	conn->send_len = 0;
+	return conn_write_direct(conn, &iov, 1);
+}
+
+// while more pipelined requests are waiting, small responses are appended to the send buffer instead of
+// being written immediately. whatever is buffered goes out together with the next direct write.
+static
+b8 conn_writev(connection_t* conn, struct iovec* iov, usz count) {
+	if (!conn->send_batch && !conn->send_len) {
+		return conn_write_direct(conn, iov, count);
+	}
+
+	usz total = 0;
+	for (usz i = 0; i < count; ++i) {
+		total += iov[i].iov_len;
+	}
+
+	if (conn->send_batch && conn->send_len + total <= SRV_SEND_BUFFER_SIZE) {
+		if (!conn->send_buf && !(conn->send_buf = lt_malloc(lt_libc_heap, SRV_SEND_BUFFER_SIZE))) {
+			return conn_write_direct(conn, iov, count);
+		}
+		for (usz i = 0; i < count; ++i) {
+			memcpy(conn->send_buf + conn->send_len, iov[i].iov_base, iov[i].iov_len);
+			conn->send_len += iov[i].iov_len;
+		}
+		return 1;
+	}
+
+	struct iovec* joined = lt_amalloc(conn->arena, (count + 1) * sizeof(struct iovec));
+	if (!joined) {
+		return conn_flush(conn) && conn_write_direct(conn, iov, count);
+	}
+	joined[0] = (struct iovec){ .iov_base = conn->send_buf, .iov_len = conn->send_len };
+	memcpy(joined + 1, iov, count * sizeof(struct iovec));
+	conn->send_len = 0;
+	return conn_write_direct(conn, joined, count + 1);
+}
+
+static
+b8 conn_sendfile(connection_t* conn, int fd, u64 offset, u64 size) {
+	if (!conn_flush(conn)) {
+		return 0;
+	}
+
+	if (conn_is_plain(conn)) {
+		off_t off = offset;
+		u64 remain = size;
+		while (remain) {
+			isz res = sendfile(conn->fd, fd, &off, remain);
+			if (res > 0) {
+				remain -= res;
+			}
+			else if (res == 0) {
+				// the file was truncated after the headers went out, the response can not be completed
+				return 0;
+			}
+			else if (!would_block(conn->fd, POLLOUT, SRV_IO_TIMEOUT_MSEC)) {
+				return 0;
+			}
+		}
+		return 1;
+	}
+
+	// the ssl layer has to see the plaintext, copy through a fixed size buffer instead
+	u8* buf = lt_amalloc(conn->arena, FILE_CHUNK_SIZE);
+	if (!buf) {
+		return 0;
+	}
+
+	u64 remain = size;
+	while (remain) {
+		isz res = pread(fd, buf, lt_min(remain, FILE_CHUNK_SIZE), offset);
+		if (res < 0 && errno == EINTR) {
+			continue;
+		}
+		if (res <= 0 || conn->write_callb(conn->callb_usr, buf, res) < 0) {
+			return 0;
+		}
+		offset += res;
+		remain -= res;
+	}
+	return 1;
+}
+
+void srv_release_body(connection_t* conn) {
+	if (conn->response_file.fd >= 0) {
+		close(conn->response_file.fd);
+		conn->response_file.fd = -1;
+	}
+	if (conn->response_cache_entry) {
+		file_cache_release(&conn->server->file_cache, conn->response_cache_entry);
+		conn->response_cache_entry = NULL;
+	}
+	if (conn->response_page) {
+		page_cache_release(conn->response_page);
+		conn->response_page = NULL;
+	}
+	if (conn->response_iov) {
+		response_iov_t* body = conn->response_iov;
+		for (usz i = 0; i < body->hold_count; ++i) {
+			template_cache_release(body->holds[i]);
+		}
+		conn->response_iov = NULL;
+	}
+}
+
+void srv_respond_file(connection_t* conn, int fd, u64 offset, u64 size) {
+	srv_release_body(conn);
+	conn->response_file = (response_file_t) {
+			.fd = fd,
+			.offset = offset,
+			.size = size };
+	conn->response.body = NLSTR();
+}
+
+// takes over the reference to the entry, which is released once the response is sent
+void srv_respond_cached(connection_t* conn, file_cache_entry_t* entry) {
+	srv_release_body(conn);
+	conn->response_cache_entry = entry;
+	conn->response.body = entry->data;
+}
+
+// same as srv_respond_cached, for rendered pages
+void srv_respond_page(connection_t* conn, page_cache_entry_t* entry) {
+	srv_release_body(conn);
+	conn->response_page = entry;
+	conn->response.body = entry->body;
+}
+
+// switches the response body to a scatter list, which is filled with srv_iov_ref/srv_iov_write
+b8 srv_respond_iov(connection_t* conn) {
+	srv_release_body(conn);
+
+	response_iov_t* body = lt_amalloc(conn->arena, sizeof(response_iov_t));
+	if (!body) {
+		return 0;
+	}
+	lt_mzero(body, sizeof(*body));
+
+	conn->response_iov = body;
+	conn->response.body = NLSTR();
+	return 1;
+}
+
+static
+b8 grow_array(connection_t* conn, void** arr, usz* capacity, usz elem_size) {
+	usz new_capacity = *capacity ? *capacity * 2 : 64;
+	void* new_arr = lt_amalloc(conn->arena, new_capacity * elem_size);
+	if (!new_arr) {
+		return 0;
+	}
+	if (*arr) {
+		memcpy(new_arr, *arr, *capacity * elem_size);
+	}
+	*arr = new_arr;
+	*capacity = new_capacity;
+	return 1;
+}
+
+static
+void push_iov(connection_t* conn, response_iov_t body[static 1], void* data, usz len) {
+	if (body->count == body->capacity && !grow_array(conn, (void**)&body->iov, &body->capacity, sizeof(struct iovec))) {
+		body->failed = 1;
+		return;
+	}
+	body->iov[body->count++] = (struct iovec){ .iov_base = data, .iov_len = len };
+	body->total += len;
+}
+
+static
+b8 send_chunk_iov(connection_t* conn, struct iovec* iov, usz count, u64 len);
+
+// sends what has been collected as the first chunk of a chunked response, see srv_stream_begin.
+// returns 0 if the response can not be streamed, in which case it is only tried once.
+static
+b8 start_streaming(connection_t* conn, response_iov_t body[static 1]) {
+	if (body->stream_refused || !srv_stream_begin(conn, &body->stream)) {
+		body->stream_refused = 1;
+		return 0;
+	}
+	body->streaming = 1;
+
+	if (body->total && !body->stream.failed && !send_chunk_iov(conn, body->iov, body->count, body->total)) {
+		body->stream.failed = 1;
+	}
+	body->count = 0;
+	body->total = 0;
+	body->buf_len = body->buf_size = 0;
+	body->failed = 0;
+	return 1;
+}
+
+static
+void check_stream_threshold(connection_t* conn, response_iov_t body[static 1]) {
+	if (body->stream_threshold && body->total > body->stream_threshold) {
+		start_streaming(conn, body);
+	}
+}
+
+// the referenced memory has to stay valid until the response is sent
+void srv_iov_ref(connection_t* conn, const void* data, usz len) {
+	response_iov_t* body = conn->response_iov;
+	if (body->streaming) {
+		srv_stream_write(&body->stream, data, len);
+		return;
+	}
+	if (!len || body->failed) {
+		return;
+	}
+
+	push_iov(conn, body, (void*)data, len);
+	if (body->failed && start_streaming(conn, body)) {
+		srv_stream_write(&body->stream, data, len);
+		return;
+	}
+	check_stream_threshold(conn, body);
+}
+
+isz srv_iov_write(connection_t* conn, const void* data, usz len) {
+	response_iov_t* body = conn->response_iov;
+	if (body->streaming) {
+		return srv_stream_write(&body->stream, data, len);
+	}
+	if (!len || body->failed) {
+		return len;
+	}
+
+	if (body->buf_size - body->buf_len < len) {
+		usz size = lt_max(len, SRV_IOV_BUFFER_SIZE);
+		if (!(body->buf = lt_amalloc(conn->arena, size))) {
+			// what has been collected so far is sent, the rest of the response does not need to be held
+			if (start_streaming(conn, body)) {
+				return srv_stream_write(&body->stream, data, len);
+			}
+			body->failed = 1;
+			return -LT_ERR_OUT_OF_MEMORY;
+		}
+		body->buf_len = 0;
+		body->buf_size = size;
+	}
+
+	char* dst = body->buf + body->buf_len;
+	memcpy(dst, data, len);
+	body->buf_len += len;
+
+	// consecutive writes share one entry
+	struct iovec* last = body->count ? &body->iov[body->count - 1] : NULL;
+	if (last && (char*)last->iov_base + last->iov_len == dst) {
+		last->iov_len += len;
+		body->total += len;
+	}
+	else {
+		push_iov(conn, body, dst, len);
+		if (body->failed && start_streaming(conn, body)) {
+			return srv_stream_write(&body->stream, data, len);
+		}
+	}
+	check_stream_threshold(conn, body);
+	return len;
+}
+
+// takes over a reference to the template, which is released once the response is sent
+void srv_iov_hold(connection_t* conn, compiled_template_t* compiled) {
+	response_iov_t* body = conn->response_iov;
+	if (body->hold_count == body->hold_capacity && !grow_array(conn, (void**)&body->holds, &body->hold_capacity, sizeof(compiled_template_t*))) {
+		// without a hold the fragments can not be sent safely
+		body->failed = 1;
+		template_cache_release(compiled);
+		return;
+	}
+	body->holds[body->hold_count++] = compiled;
+}
+
+#define CONTENT_LENGTH_NONE ((u64)-1)
+
+static
+lstr_t build_response_head(connection_t* conn, u64 content_length) {
+	lt_http_msg_t* msg = &conn->response;
+
+	lt_strstream_t ss;
+	LT_ASSERT(lt_strstream_create(&ss, &conn->arena->interf) == LT_SUCCESS);
+	lt_write_fn_t callb = (lt_write_fn_t)lt_strstream_write;
+
+	lt_io_printf(callb, &ss, "HTTP/%uw.%uw %uw %S\r\n",
+			LT_HTTP_VERSION_MAJOR(msg->version), LT_HTTP_VERSION_MINOR(msg->version),
+			msg->response_status_code, msg->response_status_msg);
+
+	usz header_count = lt_darr_count(msg->header_keys);
+	for (usz i = 0; i < header_count; ++i) {
+		lt_io_printf(callb, &ss, "%S: %S\r\n", msg->header_keys[i], msg->header_vals[i]);
+	}
+	// a 304 describes the representation the client already has, so the empty body must not be announced
+	if (msg->response_status_code != 304 && content_length != CONTENT_LENGTH_NONE) {
+		lt_io_printf(callb, &ss, "Content-Length: %uq\r\n", content_length);
+	}
+	lt_writes(callb, &ss, "\r\n");
+	return ss.str;
+}
+
+static
+b8 send_body_range(connection_t* conn, u64 offset, u64 size) {
+	response_file_t* file = &conn->response_file;
+	if (file->fd >= 0) {
+		return conn_sendfile(conn, file->fd, file->offset + offset, size);
+	}
+
+	struct iovec iov = { .iov_base = conn->response.body.str + offset, .iov_len = size };
+	return conn_writev(conn, &iov, 1);
+}
+
+static
+b8 send_multipart(connection_t* conn) {
+	u64 full_size = conn->response_file.fd >= 0 ? conn->response_file.size : conn->response.body.len;
+
+	static volatile u64 boundary_counter = 0;
+	u64 boundary = __atomic_add_fetch(&boundary_counter, 1, __ATOMIC_RELAXED) * 0x9E3779B97F4A7C15 ^ conn->server->start_time_nsec;
+
+	lt_alloc_t* alloc = &conn->arena->interf;
+	usz range_count = conn->response_range_count;
+
+	lstr_t* part_heads = lt_amalloc(conn->arena, range_count * sizeof(lstr_t));
+	if (!part_heads) {
+		return 0;
+	}
+
+	u64 content_length = 0;
+	for (usz i = 0; i < range_count; ++i) {
+		byte_range_t* r = &conn->response_ranges[i];
+		part_heads[i] = lt_lsbuild(alloc, "\r\n--%hq\r\nContent-Type: %S\r\nContent-Range: bytes %uq-%uq/%uq\r\n\r\n",
+				boundary, conn->response_mime_type, r->offset, r->offset + r->size - 1, full_size);
+		content_length += part_heads[i].len + r->size;
+	}
+	lstr_t tail = lt_lsbuild(alloc, "\r\n--%hq--\r\n", boundary);
+	content_length += tail.len;
+
+	lt_http_add_header(&conn->response, CLSTR("Content-Type"), lt_lsbuild(alloc, "multipart/byteranges; boundary=%hq", boundary));
+	lstr_t head = build_response_head(conn, content_length);
+	struct iovec iov = { .iov_base = head.str, .iov_len = head.len };
+	if (!conn_writev(conn, &iov, 1)) {
+		return 0;
+	}
+
+	for (usz i = 0; i < range_count; ++i) {
+		iov = (struct iovec){ .iov_base = part_heads[i].str, .iov_len = part_heads[i].len };
+		if (!conn_writev(conn, &iov, 1) || !send_body_range(conn, conn->response_ranges[i].offset, conn->response_ranges[i].size)) {
+			return 0;
+		}
+	}
+
+	iov = (struct iovec){ .iov_base = tail.str, .iov_len = tail.len };
+	return conn_writev(conn, &iov, 1);
+}
+
+lt_err_t srv_send_response(connection_t* conn) {
+	b8 success;
+
+	response_iov_t* body = conn->response_iov;
+	if (body && body->streaming) {
+		lt_err_t err = srv_stream_end(&body->stream);
+		srv_release_body(conn);
+		return err;
+	}
+	if (conn->response_streamed) {
+		return LT_SUCCESS;
+	}
+
+	if (conn->response_range_count > 1) {
+		success = send_multipart(conn);
+		srv_release_body(conn);
+		return success ? LT_SUCCESS : LT_ERR_CLOSED;
+	}
+
+	lt_http_add_header(&conn->response, CLSTR("Content-Type"), conn->response_mime_type);
+
+	response_file_t* file = &conn->response_file;
+	if (body) {
+		if (body->failed) {
+			srv_release_body(conn);
+			return LT_ERR_OUT_OF_MEMORY;
+		}
+
+		struct iovec* iov = lt_amalloc(conn->arena, (body->count + 1) * sizeof(struct iovec));
+		lstr_t head = build_response_head(conn, body->total);
+		success = iov != NULL;
+		if (success) {
+			iov[0] = (struct iovec){ .iov_base = head.str, .iov_len = head.len };
+			memcpy(iov + 1, body->iov, body->count * sizeof(struct iovec));
+			success = conn_writev(conn, iov, body->count + 1);
+		}
+	}
+	else if (file->fd >= 0) {
+		lstr_t head = build_response_head(conn, file->size);
+		struct iovec iov = { .iov_base = head.str, .iov_len = head.len };
+		success = conn_writev(conn, &iov, 1) && conn_sendfile(conn, file->fd, file->offset, file->size);
+	}
+	else {
+		lstr_t head = build_response_head(conn, conn->response.body.len);
+		struct iovec iov[2] = {
+				{ .iov_base = head.str, .iov_len = head.len },
+				{ .iov_base = conn->response.body.str, .iov_len = conn->response.body.len } };
+		success = conn_writev(conn, iov, 2);
+	}
+
+	srv_release_body(conn);
+
+	return success ? LT_SUCCESS : LT_ERR_CLOSED;
+}
+
+// chunked streaming, for responses whose size is not known until they have been generated.
+// output is collected into SRV_STREAM_CHUNK_SIZE chunks, so memory stays bounded regardless of length.
+
+static
+b8 send_chunk(connection_t* conn, const void* data, usz len) {
+	char size_buf[24];
+	usz size_len = lt_sprintf(size_buf, "%hq\r\n", (u64)len);
+
+	struct iovec iov[3] = {
+			{ .iov_base = size_buf, .iov_len = size_len },
+			{ .iov_base = (void*)data, .iov_len = len },
+			{ .iov_base = "\r\n", .iov_len = 2 } };
+	return conn_writev(conn, iov, 3);
+}
+
+// one chunk made of len bytes spread over a scatter list
+static
+b8 send_chunk_iov(connection_t* conn, struct iovec* iov, usz count, u64 len) {
+	char size_buf[24];
+	struct iovec size_iov = { .iov_base = size_buf, .iov_len = lt_sprintf(size_buf, "%hq\r\n", len) };
+	struct iovec end_iov = { .iov_base = "\r\n", .iov_len = 2 };
+	return conn_writev(conn, &size_iov, 1) && conn_writev(conn, iov, count) && conn_writev(conn, &end_iov, 1);
+}
+
+// sends the response head and returns 1 if the response can be streamed. returns 0 if the caller should
+// fill conn->response.body instead, which is the case for HEAD requests and HTTP/1.0 clients.
+b8 srv_stream_begin(connection_t* conn, response_stream_t stream[static 1]) {
+	if (conn->request.request_method == LT_HTTP_HEAD || conn->request.version < LT_HTTP_1_1) {
+		return 0;
+	}
+
+	// without a buffer every write becomes a chunk of its own, which still beats failing the response
+	*stream = (response_stream_t){ .conn = conn, .buf = lt_amalloc(conn->arena, SRV_STREAM_CHUNK_SIZE) };
+
+	lt_http_add_header(&conn->response, CLSTR("Content-Type"), conn->response_mime_type);
+	lt_http_add_header(&conn->response, CLSTR("Transfer-Encoding"), CLSTR("chunked"));
+
+	lstr_t head = build_response_head(conn, CONTENT_LENGTH_NONE);
+	struct iovec iov = { .iov_base = head.str, .iov_len = head.len };
+	stream->failed = !conn_writev(conn, &iov, 1);
+
+	conn->response_streamed = 1;
+	return 1;
+}
+
+isz srv_stream_write(response_stream_t stream[static 1], const void* data, usz len) {
+	if (stream->failed) {
+		return -LT_ERR_CLOSED;
+	}
+	if (!len) {
+		return 0;
+	}
+	if (!stream->buf) {
+		if (!send_chunk(stream->conn, data, len)) {
+			goto failed;
+		}
+		return len;
+	}
+
+	usz avail = SRV_STREAM_CHUNK_SIZE - stream->len;
+	if (len < avail) {
+		memcpy(stream->buf + stream->len, data, len);
+		stream->len += len;
+		return len;
+	}
+
+	// fill up and flush the current chunk, anything that still is a full chunk goes out without copying
+	memcpy(stream->buf + stream->len, data, avail);
+	const char* it = (const char*)data + avail;
+	usz remain = len - avail;
+	if (!send_chunk(stream->conn, stream->buf, SRV_STREAM_CHUNK_SIZE)) {
+		goto failed;
+	}
+	stream->len = 0;
+
+	if (remain >= SRV_STREAM_CHUNK_SIZE) {
+		if (!send_chunk(stream->conn, it, remain)) {
+			goto failed;
+		}
+		return len;
+	}
+
+	memcpy(stream->buf, it, remain);
+	stream->len = remain;
+	return len;
+
+failed:
+	stream->failed = 1;
+	return -LT_ERR_CLOSED;
+}
+
+lt_err_t srv_stream_end(response_stream_t stream[static 1]) {
+	if (!stream->failed && stream->len && !send_chunk(stream->conn, stream->buf, stream->len)) {
+		stream->failed = 1;
+	}
+
+	struct iovec iov = { .iov_base = "0\r\n\r\n", .iov_len = 5 };
+	if (stream->failed || !conn_writev(stream->conn, &iov, 1)) {
+		// the response is incomplete, the only way to tell the client is to close the connection
+		stream->conn->keep_alive = 0;
+		return LT_ERR_CLOSED;
+	}
+	return LT_SUCCESS;
+}
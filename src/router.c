@@ -0,0 +1,150 @@
+#include <lt/mem.h>
+
+#include "router.h"
+
+static
+route_node_t* node_create(lstr_t label) {
+	route_node_t* node = lt_malloc(lt_libc_heap, sizeof(route_node_t));
+	if (node) {
+		*node = (route_node_t){ .label = label, .exact = ROUTE_NONE, .prefix = ROUTE_NONE };
+	}
+	return node;
+}
+
+static
+void node_destroy(route_node_t* node) {
+	for (usz i = 0; i < node->child_count; ++i) {
+		node_destroy(node->children[i]);
+	}
+	if (node->children) {
+		lt_mfree(lt_libc_heap, node->children);
+		lt_mfree(lt_libc_heap, node->child_keys);
+	}
+	lt_mfree(lt_libc_heap, node);
+}
+
+static
+route_node_t* find_child(const route_node_t node[static 1], char key) {
+	char* it = memchr(node->child_keys, key, node->child_count);
+	return it ? node->children[it - node->child_keys] : NULL;
+}
+
+static
+b8 add_child(route_node_t node[static 1], route_node_t child[static 1]) {
+	usz count = node->child_count + 1;
+	route_node_t** children = lt_mrealloc(lt_libc_heap, node->children, count * sizeof(route_node_t*));
+	if (!children) {
+		return 0;
+	}
+	node->children = children;
+
+	char* keys = lt_mrealloc(lt_libc_heap, node->child_keys, count);
+	if (!keys) {
+		return 0;
+	}
+	node->child_keys = keys;
+
+	node->children[node->child_count] = child;
+	node->child_keys[node->child_count] = child->label.str[0];
+	node->child_count = count;
+	return 1;
+}
+
+lt_err_t route_table_create(route_table_t out_table[static 1]) {
+	out_table->root = node_create(NLSTR());
+	out_table->node_count = 1;
+	return out_table->root ? LT_SUCCESS : LT_ERR_OUT_OF_MEMORY;
+}
+
+void route_table_destroy(route_table_t table[static 1]) {
+	if (table->root) {
+		node_destroy(table->root);
+		table->root = NULL;
+	}
+	table->node_count = 0;
+}
+
+static
+usz common_prefix(lstr_t a, lstr_t b) {
+	usz len = lt_min(a.len, b.len), i = 0;
+	while (i < len && a.str[i] == b.str[i]) {
+		++i;
+	}
+	return i;
+}
+
+// the route string has to outlive the table, labels point into it.
+// if a route is inserted twice, the value that was inserted first is kept.
+lt_err_t route_table_insert(route_table_t table[static 1], lstr_t route, b8 prefix, u32 val) {
+	route_node_t* node = table->root;
+
+	while (route.len) {
+		route_node_t* child = find_child(node, route.str[0]);
+		if (!child) {
+			if (!(child = node_create(route)) || !add_child(node, child)) {
+				return LT_ERR_OUT_OF_MEMORY;
+			}
+			++table->node_count;
+			node = child;
+			break;
+		}
+
+		usz common = common_prefix(child->label, route);
+		if (common < child->label.len) {
+			// split the edge, the new node takes the place of the old child
+			route_node_t* mid = node_create(LSTR(child->label.str, common));
+			if (!mid || !add_child(mid, child)) {
+				return LT_ERR_OUT_OF_MEMORY;
+			}
+			++table->node_count;
+
+			child->label = LSTR(child->label.str + common, child->label.len - common);
+			mid->child_keys[0] = child->label.str[0];
+
+			char* key = memchr(node->child_keys, mid->label.str[0], node->child_count);
+			node->children[key - node->child_keys] = mid;
+			child = mid;
+		}
+
+		node = child;
+		route = LSTR(route.str + common, route.len - common);
+	}
+
+	u32* slot = prefix ? &node->prefix : &node->exact;
+	if (*slot == ROUTE_NONE) {
+		*slot = val;
+	}
+	return LT_SUCCESS;
+}
+
+// prefix routes only match at a path segment boundary, '/public' matches '/public/a' but not '/publication'
+static
+b8 is_boundary(lstr_t path, usz consumed) {
+	return consumed == path.len || path.str[consumed] == '/' || (consumed && path.str[consumed - 1] == '/');
+}
+
+route_match_t route_table_lookup(const route_table_t table[static 1], lstr_t path) {
+	route_match_t match = { .exact = ROUTE_NONE, .prefix = ROUTE_NONE };
+
+	const route_node_t* node = table->root;
+	usz consumed = 0;
+
+	for (;;) {
+		if (node->prefix != ROUTE_NONE && is_boundary(path, consumed)) {
+			match.prefix = node->prefix;
+		}
+		if (consumed == path.len) {
+			match.exact = node->exact;
+			return match;
+		}
+
+		const route_node_t* child = find_child(node, path.str[consumed]);
+		if (!child || path.len - consumed < child->label.len ||
+			memcmp(path.str + consumed, child->label.str, child->label.len) != 0)
+		{
+			return match;
+		}
+		consumed += child->label.len;
+		node = child;
+	}
+}
@@ -0,0 +1,43 @@
+#ifndef ROUTER_H
+#define ROUTER_H 1
+
+#include <lt/lt.h>
+
+// router.c
+
+#define ROUTE_NONE (~(u32)0)
+
+typedef struct route_node route_node_t;
+
+// edges are labelled with whole runs of bytes, so a lookup visits one node per distinct route prefix
+typedef
+struct route_node {
+	lstr_t label;
+	u32 exact;  // value for a route that ends here, ROUTE_NONE if there is none
+	u32 prefix; // value for a route that ends here and also matches everything below it
+
+	usz child_count;
+	char* child_keys; // first byte of every child's label, for scanning without touching the children
+	route_node_t** children;
+} route_node_t;
+
+typedef
+struct route_match {
+	u32 exact;
+	u32 prefix; // longest matching prefix route
+} route_match_t;
+
+// routes are inserted while the server is being set up, the trie is read-only once workers run
+typedef
+struct route_table {
+	route_node_t* root;
+	usz node_count;
+} route_table_t;
+
+lt_err_t route_table_create(route_table_t out_table[static 1]);
+void route_table_destroy(route_table_t table[static 1]);
+
+lt_err_t route_table_insert(route_table_t table[static 1], lstr_t route, b8 prefix, u32 val);
+route_match_t route_table_lookup(const route_table_t table[static 1], lstr_t path);
+
+#endif
@@ -6,159 +6,625 @@
 #include <lt/str.h>
 #include <lt/ssl.h>
 
-#define LT_ANSI_SHORTEN_NAMES 1
-#include <lt/ansi.h>
-
 #include "server.h"
 #include "mime.h"
 #include "template.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+
+// per-request log records go through the worker's ring to the access log writer thread
 static
-void on_client_connected(server_t server[static 1], u32 cid, lt_arena_t arena[static 1]) {
-	lt_err_t err;
+access_record_t* log_begin(access_ring_t* ring, access_record_type_t type, u32 addr) {
+	if (!ring) {
+		return NULL;
+	}
+	// slots are reused, and ACCESS_LOG_FILE writes them out whole, so nothing of an earlier record may remain
+	access_record_t* record = access_ring_reserve(ring);
+	if (record) {
+		lt_mzero(record, sizeof(*record));
+		record->type = type;
+		record->time_nsec = access_log_time_nsec();
+		record->addr = addr;
+	}
+	return record;
+}
 
-	connection_t* conn        = &server->connections[cid];
-	lt_write_fn_t write_callb = (lt_write_fn_t)lt_socket_send;
-	lt_read_fn_t  read_callb  = (lt_read_fn_t) lt_socket_recv;
-	void*         callb_usr   = conn->socket;
+// per-request errors are recorded like the requests themselves, through the ring of the worker that
+// serves conn. subject, usually a path, is quoted after msg, err is appended unless it is LT_SUCCESS.
+void srv_log_error(connection_t* conn, lstr_t msg, lstr_t subject, lt_err_t err) {
+	if (conn->server->log_level > SRV_LOG_ERRORS) {
+		return;
+	}
+	access_record_t* record = log_begin(conn->log_ring, ACCESS_ERROR, lt_sockaddr_ipv4_addr(&conn->addr));
+	if (!record) {
+		return;
+	}
+
+	lt_write_fn_t callb = (lt_write_fn_t)access_record_write_text;
+	lt_writels(callb, record, msg);
+	if (subject.len) {
+		lt_io_printf(callb, record, " '%S'", subject);
+	}
+	if (err) {
+		lt_io_printf(callb, record, ": %S", lt_err_str(err));
+	}
+	access_ring_commit(conn->log_ring);
+}
+
+static
+void log_request(worker_t worker[static 1], connection_t conn[static 1], u64 start_nsec) {
+	if (worker->server->log_level > SRV_LOG_REQUESTS) {
+		return;
+	}
+	access_record_t* record = log_begin(worker->log_ring, ACCESS_REQUEST, lt_sockaddr_ipv4_addr(&conn->addr));
+	if (record) {
+		// time_nsec is wall clock time and may step, the duration is measured on the monotonic clock
+		record->duration_usec = lt_min((timer_now_nsec() - start_nsec) / 1000, (u32)-1);
+		record->method = conn->request.request_method;
+		record->version_major = LT_HTTP_VERSION_MAJOR(conn->request.version);
+		record->version_minor = LT_HTTP_VERSION_MINOR(conn->request.version);
+		record->status = conn->response.response_status_code;
+		access_record_set_text(record, conn->request.request_file);
+		access_ring_commit(worker->log_ring);
+	}
+}
+
+static
+b8 on_client_connected(worker_t worker[static 1], connection_t conn[static 1]) {
+	conn->write_callb = (lt_write_fn_t)conn_send;
+	conn->read_callb  = (lt_read_fn_t)conn_recv;
+	conn->callb_usr   = conn;
+
+	int flags = fcntl(conn->fd, F_GETFL);
+	if (flags < 0 || fcntl(conn->fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+		srv_log_error(conn, CLSTR("failed to make client socket nonblocking"), NLSTR(), lt_errno());
+		return 0;
+	}
+	return 1;
+}
 
 #ifdef SSL
-	if (server->use_https) {
-		callb_usr = conn->ssl_conn = lt_ssl_accept(conn->socket);
-		if (!callb_usr) {
-			lt_werrf("ssl handshake failed\n");
-			return;
+#define GUARD_CHECK_MSEC 100
+
+static
+void guard_begin(io_guard_t guard[static 1], connection_t conn[static 1], u64 deadline_msec) {
+	pthread_mutex_lock(&guard->lock);
+	guard->fd = conn->fd;
+	guard->deadline_msec = deadline_msec;
+	guard->expired = 0;
+	pthread_mutex_unlock(&guard->lock);
+}
+
+// returns true if the socket was shut down. the socket may only be closed after this returned,
+// otherwise the guard thread could shut down an unrelated socket that reused the descriptor.
+static
+b8 guard_end(io_guard_t guard[static 1]) {
+	pthread_mutex_lock(&guard->lock);
+	guard->fd = -1;
+	b8 expired = guard->expired;
+	pthread_mutex_unlock(&guard->lock);
+	return expired;
+}
+
+static
+void guard_check(io_guard_t guard[static 1], u64 now_msec) {
+	pthread_mutex_lock(&guard->lock);
+	if (guard->fd >= 0 && !guard->expired && guard->deadline_msec <= now_msec) {
+		shutdown(guard->fd, SHUT_RDWR);
+		guard->expired = 1;
+	}
+	pthread_mutex_unlock(&guard->lock);
+}
+
+static
+void guard_proc(server_t* server) {
+	for (;;) {
+		lt_sleep_msec(GUARD_CHECK_MSEC);
+
+		u64 now_msec = timer_now_msec();
+		for (usz i = 0; i < server->worker_count; ++i) {
+			guard_check(&server->workers[i].guard, now_msec);
+		}
+		for (usz i = 0; i < server->handshake_threads; ++i) {
+			guard_check(&server->handshakers[i].guard, now_msec);
 		}
-		write_callb = (lt_write_fn_t)lt_ssl_send_fixed;
-		read_callb  = (lt_read_fn_t)lt_ssl_recv_fixed;
 	}
+}
+
+// lt's ssl layer only works on blocking sockets and can not resume a handshake that would block, so
+// SO_RCVTIMEO only bounds single reads. a client that sends one byte at a time is stopped by the guard,
+// which limits the handshake as a whole.
+static
+b8 ssl_handshake(server_t server[static 1], io_guard_t guard[static 1], connection_t conn[static 1]) {
+	struct timeval recv_timeout = {
+			.tv_sec = server->header_timeout_msec / 1000,
+			.tv_usec = server->header_timeout_msec % 1000 * 1000 };
+	struct timeval send_timeout = {
+			.tv_sec = SRV_IO_TIMEOUT_MSEC / 1000,
+			.tv_usec = SRV_IO_TIMEOUT_MSEC % 1000 * 1000 };
+	if (setsockopt(conn->fd, SOL_SOCKET, SO_RCVTIMEO, &recv_timeout, sizeof(recv_timeout)) < 0 ||
+		setsockopt(conn->fd, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout)) < 0)
+	{
+		srv_log_error(conn, CLSTR("failed to set socket timeouts"), NLSTR(), lt_errno());
+		return 0;
+	}
+
+	guard_begin(guard, conn, timer_now_msec() + server->handshake_timeout_msec);
+	conn->ssl_conn = lt_ssl_accept(conn->socket);
+	if (guard_end(guard)) {
+		srv_log_error(conn, CLSTR("ssl handshake timed out"), NLSTR(), LT_ERR_TIMEOUT);
+		return 0;
+	}
+	if (!conn->ssl_conn) {
+		srv_log_error(conn, CLSTR("ssl handshake failed"), NLSTR(), LT_ERR_UNKNOWN);
+		return 0;
+	}
+
+	conn->write_callb = (lt_write_fn_t)lt_ssl_send_fixed;
+	conn->read_callb  = (lt_read_fn_t)lt_ssl_recv_fixed;
+	conn->callb_usr   = conn->ssl_conn;
+	return 1;
+}
 #endif
 
+static
+b8 on_client_request(worker_t worker[static 1], connection_t conn[static 1]) {
+	lt_err_t err;
+
+	server_t* server = worker->server;
+	lt_arena_t* arena = worker->arena;
 	lt_alloc_t* alloc = &arena->interf;
 
-	do {
-		lt_amreset(arena);
+	lt_amreset(arena);
+	conn->arena = arena;
 
-		// read and parse request
-		lt_mzero(&conn->request, sizeof(conn->request));
-		if ((err = lt_http_parse_request(&conn->request, read_callb, callb_usr, alloc))) {
-			if (err != LT_ERR_CLOSED) {
-				lt_werrf("failed to parse http request: %S\n", lt_err_str(err));
-			}
-			conn->keep_alive = 0;
-			return;
+	// normally set when the first bytes of the request arrived, the parser's reads are bounded by it
+	if (!conn->read_deadline_msec) {
+		conn->read_deadline_msec = timer_now_msec() + server->header_timeout_msec;
+	}
+
+	// read and parse request
+	lt_mzero(&conn->request, sizeof(conn->request));
+#ifdef SSL
+	if (conn->ssl_conn) {
+		guard_begin(&worker->guard, conn, conn->read_deadline_msec);
+	}
+#endif
+	err = lt_http_parse_request(&conn->request, (lt_read_fn_t)conn_recv_buffered, conn, alloc);
+#ifdef SSL
+	if (conn->ssl_conn && guard_end(&worker->guard) && err) {
+		err = LT_ERR_TIMEOUT;
+	}
+#endif
+	if (err) {
+		if (err != LT_ERR_CLOSED) {
+			srv_log_error(conn, CLSTR("failed to parse http request"), NLSTR(), err);
 		}
-		u32 addr = lt_sockaddr_ipv4_addr(&conn->addr);
-		lt_ierrf("["FG_BYELLOW"C_%hd"RESET"] HTTP/%uw.%uw %S %S\n", addr,
-				LT_HTTP_VERSION_MAJOR(conn->request.version),
-				LT_HTTP_VERSION_MINOR(conn->request.version),
-				lt_http_method_str(conn->request.request_method),
-				conn->request.request_file);
+		conn->keep_alive = 0;
+		conn->read_deadline_msec = 0;
+		return 0;
+	}
+	conn->read_deadline_msec = 0;
 
-		conn->uri = parse_uri(conn->request.request_file);
+	u64 start_nsec = timer_now_nsec();
 
-		lstr_t* conn_header = lt_http_find_header(&conn->request, CLSTR("Connection"));
-		conn->keep_alive = conn_header && lt_lseq_nocase(*conn_header, CLSTR("keep-alive"));
+	if ((err = parse_uri(&conn->uri, conn->request.request_file, alloc))) {
+		srv_log_error(conn, CLSTR("failed to parse request uri"), NLSTR(), err);
+		conn->keep_alive = 0;
+		return 0;
+	}
+	if (conn->uri.invalid_escapes) {
+		srv_log_error(conn, CLSTR("invalid url escape sequence in"), conn->request.request_file, LT_SUCCESS);
+	}
 
-		// create response
-		lt_mzero(&conn->response, sizeof(conn->response));
-		if ((err = lt_http_msg_create(&conn->response, alloc))) {
-			lt_werrf("failed to create response message: %S\n", lt_err_str(err));
-			break;
+	// hold back the response while the client has already sent the next request
+	conn->send_batch = conn_buffered_request(conn) == REQUEST_READY;
+
+	lstr_t* conn_header = lt_http_find_header(&conn->request, CLSTR("Connection"));
+	conn->keep_alive = conn_header && lt_lseq_nocase(*conn_header, CLSTR("keep-alive"));
+
+	u32 requests_left = server->max_keep_alive_requests - ++conn->request_count;
+	if (!requests_left) {
+		conn->keep_alive = 0;
+	}
+
+	// create response
+	lt_mzero(&conn->response, sizeof(conn->response));
+	if ((err = lt_http_msg_create(&conn->response, alloc))) {
+		srv_log_error(conn, CLSTR("failed to create response message"), NLSTR(), err);
+		return 0;
+	}
+	conn->response.version              = LT_HTTP_1_1;
+	conn->response.response_status_code = 200;
+	conn->response.response_status_msg  = CLSTR("OK");
+
+	conn->response_mime_type = NLSTR();
+	conn->response_file = (response_file_t){ .fd = -1 };
+	conn->response_cache_entry = NULL;
+	conn->response_page = NULL;
+	conn->response_iov = NULL;
+	conn->response_ranges = NULL;
+	conn->response_range_count = 0;
+	conn->response_streamed = 0;
+	lt_hashtab_init(&conn->vars);
+	conn->first_var = NULL;
+
+	// added up front, streamed responses send their head before the handler returns
+	if (conn->keep_alive) {
+		lt_http_add_header(&conn->response, CLSTR("Connection"), CLSTR("keep-alive"));
+		lstr_t keep_alive = lt_lsbuild(alloc, "timeout=%ud, max=%ud", server->keep_alive_timeout_msec / 1000, requests_left);
+		lt_http_add_header(&conn->response, CLSTR("Keep-Alive"), keep_alive);
+	}
+	else {
+		lt_http_add_header(&conn->response, CLSTR("Connection"), CLSTR("close"));
+	}
+
+	// route parsed request
+	if (server->on_request && server->on_request(conn))
+		; // noop
+	else if (srv_handle_mapped_request(server, conn))
+		; // noop
+	else if (server->on_unmapped_request) {
+		server->on_unmapped_request(conn);
+	}
+	else {
+		LT_ASSERT(server->on_404);
+		server->on_404(conn);
+	}
+
+	if ((err = srv_send_response(conn))) {
+		srv_log_error(conn, CLSTR("failed to send response message"), NLSTR(), err);
+		conn->keep_alive = 0;
+	}
+	log_request(worker, conn, start_nsec);
+
+	return conn->keep_alive;
+}
+
+static
+b8 conn_rearm(server_t server[static 1], connection_t conn[static 1], int op) {
+	struct epoll_event ev = {
+			.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT,
+			.data.u64 = (u64)conn->generation << 32 | (u32)(conn - server->connections) };
+	return epoll_ctl(server->epoll_fd, op, conn->fd, &ev) == 0;
+}
+
+static
+b8 conn_assign(server_t server[static 1], u32 cid, const pending_conn_t pending[static 1]) {
+	connection_t* conn = &server->connections[cid];
+
+	conn->socket         = pending->socket;
+	conn->fd             = lt_socket_fd(pending->socket);
+	conn->addr           = pending->addr;
+	conn->keep_alive     = 0;
+	conn->handshake_done = 0;
+	conn->request_count  = 0;
+	conn->read_deadline_msec = 0;
+
+	// a client that connects but never sends anything is treated like an idle keep-alive connection
+	timer_wheel_schedule(&server->timers, &conn->timer, timer_now_msec() + server->keep_alive_timeout_msec);
+	__atomic_store_n(&conn->state, CONN_IDLE, __ATOMIC_RELEASE);
+
+	// the first readiness event performs the (ssl) handshake and serves the first request
+	if (!conn_rearm(server, conn, EPOLL_CTL_ADD)) {
+		lt_werrf("failed to register client with epoll: %S\n", lt_err_str(lt_errno()));
+		timer_wheel_cancel(&server->timers, &conn->timer);
+		conn->socket = NULL;
+		lt_socket_destroy(pending->socket, lt_libc_heap);
+		return 0;
+	}
+	return 1;
+}
+
+// hands a free slot to the oldest pending connection of the shard, or returns it to the pool if nobody is waiting
+static
+void conn_release_slot(shard_t shard[static 1], u32 cid) {
+	pending_conn_t pending;
+	while (accept_queue_pop(&shard->pending, &pending)) {
+		if (conn_assign(shard->server, cid, &pending)) {
+			return;
 		}
-		conn->response.version              = LT_HTTP_1_1;
-		conn->response.response_status_code = 200;
-		conn->response.response_status_msg  = CLSTR("OK");
+	}
+	slot_pool_push(&shard->slots, cid - shard->first_slot);
+}
+
+// must only be called by the owner of the connection, which is either a worker, a handshake thread or the timer sweep
+static
+void conn_close(server_t server[static 1], connection_t conn[static 1]) {
+	epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+	timer_wheel_cancel(&server->timers, &conn->timer);
+	__atomic_add_fetch(&conn->generation, 1, __ATOMIC_RELAXED);
+
+#ifdef SSL
+	if (conn->ssl_conn) {
+		lt_ssl_connection_destroy(conn->ssl_conn);
+		conn->ssl_conn = NULL;
+	}
+#endif
+	lt_socket_destroy(conn->socket, lt_libc_heap);
+	conn->socket = NULL;
+	conn_free_buffers(conn);
+
+	conn_release_slot(conn->shard, conn - server->connections);
+}
+
+static
+void reject_overloaded(shard_t shard[static 1], lt_socket_t* socket) {
+	server_t* server = shard->server;
+
+#ifdef SSL
+	// a plaintext response would be garbage to an https client, so there is nothing better to do than to drop it
+	if (server->use_https) {
+		__atomic_fetch_add(&shard->dropped_count, 1, __ATOMIC_RELAXED);
+		lt_socket_destroy(socket, lt_libc_heap);
+		return;
+	}
+#endif
+
+	char buf[128];
+	usz len = lt_sprintf(buf,
+			"HTTP/1.1 503 Service Unavailable\r\n"
+			"Retry-After: %ud\r\n"
+			"Connection: close\r\n"
+			"Content-Length: 0\r\n\r\n", server->retry_after_sec);
+	send(lt_socket_fd(socket), buf, len, MSG_NOSIGNAL | MSG_DONTWAIT);
 
-		conn->response_mime_type = NLSTR();
-		lt_hashtab_init(&conn->vars);
+	__atomic_fetch_add(&shard->rejected_count, 1, __ATOMIC_RELAXED);
+	lt_socket_destroy(socket, lt_libc_heap);
+}
+
+static
+void reject_oversized(worker_t worker[static 1], connection_t conn[static 1]) {
+	static const char response[] =
+			"HTTP/1.1 431 Request Header Fields Too Large\r\n"
+			"Connection: close\r\n"
+			"Content-Length: 0\r\n\r\n";
+
+	srv_log_error(conn, CLSTR("request head too large"), NLSTR(), LT_ERR_OVERFLOW);
+	conn_flush(conn);
+	conn_send(conn, response, sizeof(response) - 1);
+}
+
+#define WORKER_MAX_EVENTS 64
+#define WORKER_POLL_MSEC 250
+#define SRV_TIMER_TICK_MSEC 100
+
+static
+void collect_expired(wheel_timer_t* timer, worker_t* worker) {
+	connection_t* conn = (connection_t*)((u8*)timer - offsetof(connection_t, timer));
+	lt_darr_push(worker->expired, conn);
+}
+
+// takes ownership of an idle connection, fails if a worker or the timer sweep got to it first
+static
+b8 conn_claim(connection_t conn[static 1], conn_state_t new_state) {
+	u32 idle = CONN_IDLE;
+	return __atomic_compare_exchange_n(&conn->state, &idle, new_state, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+// closes every idle connection whose deadline has passed. the sweep is shared, whichever worker gets to
+// the wheel first does it, so no thread has to be dedicated to timers.
+static
+void reap_expired(worker_t worker[static 1]) {
+	server_t* server = worker->server;
+
+	lt_darr_clear(worker->expired);
+	if (!timer_wheel_expire(&server->timers, (timer_expire_fn_t)collect_expired, worker)) {
+		return;
+	}
 
-		// route parsed request
-		if (server->on_request && server->on_request(conn))
-			; // noop
-		else if (srv_handle_mapped_request(server, conn))
-			; // noop
-		else if (server->on_unmapped_request) {
-			server->on_unmapped_request(conn);
+	for (usz i = 0; i < lt_darr_count(worker->expired); ++i) {
+		connection_t* conn = worker->expired[i];
+		if (!conn_claim(conn, CONN_CLOSING)) {
+			continue;
 		}
-		else {
-			LT_ASSERT(server->on_404);
-			server->on_404(conn);
+		// the connection may have been served and rescheduled between the sweep and the claim
+		if (!timer_expired(&conn->timer, &server->timers)) {
+			__atomic_store_n(&conn->state, CONN_IDLE, __ATOMIC_RELEASE);
+			continue;
 		}
+		conn_close(server, conn);
+	}
+}
+
+#ifdef SSL
+// the connection stays busy while it waits, only the handshake deadline applies to it
+static
+b8 handshake_enqueue(server_t server[static 1], connection_t conn[static 1]) {
+	pthread_mutex_lock(&server->handshake_lock);
+	b8 queued = server->handshake_count < server->handshake_queue_size;
+	if (queued) {
+		server->handshake_queue[(server->handshake_head + server->handshake_count++) % server->handshake_queue_size] = conn;
+		pthread_cond_signal(&server->handshake_ready);
+	}
+	pthread_mutex_unlock(&server->handshake_lock);
+	return queued;
+}
+
+static
+void handshake_proc(handshaker_t* hs) {
+	server_t* server = hs->server;
 
-		if (conn->keep_alive) {
-			lt_http_add_header(&conn->response, CLSTR("Connection"), CLSTR("keep-alive"));
-			lt_http_add_header(&conn->response, CLSTR("Keep-Alive"), CLSTR("timeout=5, max=99"));
+	for (;;) {
+		pthread_mutex_lock(&server->handshake_lock);
+		while (!server->handshake_count && !server->done) {
+			pthread_cond_wait(&server->handshake_ready, &server->handshake_lock);
 		}
-		else {
-			lt_http_add_header(&conn->response, CLSTR("Connection"), CLSTR("close"));
+		if (server->done) {
+			pthread_mutex_unlock(&server->handshake_lock);
+			return;
 		}
-		lt_http_add_header(&conn->response, CLSTR("Content-Type"), conn->response_mime_type);
-
-		if ((err = lt_http_write_response(&conn->response, write_callb, callb_usr))) {
-			lt_werrf("failed to send response message: %S\n", lt_err_str(err));
+		connection_t* conn = server->handshake_queue[server->handshake_head];
+		server->handshake_head = (server->handshake_head + 1) % server->handshake_queue_size;
+		--server->handshake_count;
+		pthread_mutex_unlock(&server->handshake_lock);
+
+		conn->log_ring = hs->log_ring;
+		if (!ssl_handshake(server, &hs->guard, conn)) {
+			conn_close(server, conn);
+			continue;
 		}
 
-		// cleanup
-		free_uri(&conn->uri);
-	} while (conn->keep_alive);
+		// the first request is read by a worker, like every later one
+		timer_wheel_schedule(&server->timers, &conn->timer, timer_now_msec() + server->keep_alive_timeout_msec);
+		__atomic_store_n(&conn->state, CONN_IDLE, __ATOMIC_RELEASE);
+		if (!conn_rearm(server, conn, EPOLL_CTL_MOD) && conn_claim(conn, CONN_CLOSING)) {
+			conn_close(server, conn);
+		}
+	}
 }
+#endif
 
 static
-void connection_proc(connection_t* conn) {
-	server_t* server = conn->server;
-	u32 cid = conn - conn->server->connections;
+void worker_proc(worker_t* worker) {
+	server_t* server = worker->server;
+	struct epoll_event events[WORKER_MAX_EVENTS];
 
 	while (!server->done) {
-		lt_mutex_lock(conn->mutex);
+		int count = epoll_wait(server->epoll_fd, events, WORKER_MAX_EVENTS, WORKER_POLL_MSEC);
+		if (count < 0) {
+			if (errno != EINTR) {
+				lt_werrf("epoll_wait failed: %S\n", lt_err_str(lt_errno()));
+			}
+			continue;
+		}
+
+		for (int i = 0; i < count; ++i) {
+			u64 data = events[i].data.u64;
+			connection_t* conn = &server->connections[(u32)data];
 
-		on_client_connected(server, cid, conn->arena);
+			// EPOLLONESHOT guarantees that no other worker touches the connection until it is rearmed,
+			// the only one left to race with is the timer sweep
+			if (__atomic_load_n(&conn->generation, __ATOMIC_RELAXED) != data >> 32 || !conn_claim(conn, CONN_BUSY)) {
+				continue;
+			}
+			timer_wheel_cancel(&server->timers, &conn->timer);
+			conn->log_ring = worker->log_ring;
 
+			if (!(events[i].events & EPOLLIN)) {
+				conn_close(server, conn);
+				continue;
+			}
+
+			if (!conn->handshake_done) {
+				conn->handshake_done = 1;
 #ifdef SSL
-		if (server->use_https && conn->ssl_conn) { // !! ssl_conn can be null
-			lt_ssl_connection_destroy(conn->ssl_conn);
-		}
+				if (server->use_https) {
+					if (!handshake_enqueue(server, conn)) {
+						srv_log_error(conn, CLSTR("too many pending ssl handshakes"), NLSTR(), LT_ERR_OVERFLOW);
+						conn_close(server, conn);
+					}
+					continue;
+				}
 #endif
-		lt_socket_destroy(conn->socket, lt_libc_heap);
+				if (!on_client_connected(worker, conn)) {
+					conn_close(server, conn);
+					continue;
+				}
+			}
+
+			// requests are only parsed once they were received completely, pipelined requests that were
+			// read along with the first one are answered in order
+			b8 keep_alive = 1;
+			request_status_t status = conn_recv_request(conn);
+			while (keep_alive && status == REQUEST_READY) {
+				keep_alive = on_client_request(worker, conn);
+				status = conn_buffered_request(conn);
+			}
+
+			if (keep_alive && status == REQUEST_TOO_LARGE) {
+				reject_oversized(worker, conn);
+				keep_alive = 0;
+			}
 
-		// !! race condition
-		conn->next_free    = server->first_free;
-		server->first_free = cid;
+			if (!conn_flush(conn) || !keep_alive || status == REQUEST_CLOSED) {
+				conn_close(server, conn);
+				continue;
+			}
+
+			// a partially received request keeps the deadline of its first bytes across events
+			u64 deadline_msec = timer_now_msec() + server->keep_alive_timeout_msec;
+			if (status == REQUEST_PARTIAL) {
+				if (!conn->read_deadline_msec) {
+					conn->read_deadline_msec = timer_now_msec() + server->header_timeout_msec;
+				}
+				deadline_msec = conn->read_deadline_msec;
+			}
+
+			timer_wheel_schedule(&server->timers, &conn->timer, deadline_msec);
+			__atomic_store_n(&conn->state, CONN_IDLE, __ATOMIC_RELEASE);
+			if (!conn_rearm(server, conn, EPOLL_CTL_MOD) && conn_claim(conn, CONN_CLOSING)) {
+				conn_close(server, conn);
+			}
+		}
+
+		reap_expired(worker);
 	}
 }
 
 static
-void listen_proc(server_t* server) {
+void listen_proc(shard_t* shard) {
+	server_t* server = shard->server;
+
 	while (!server->done) {
 		lt_sockaddr_t client_addr;
 
-		lt_socket_t* client_socket = lt_socket_accept(server->socket, &client_addr, lt_libc_heap);
+		lt_socket_t* client_socket = lt_socket_accept(shard->socket, &client_addr, lt_libc_heap);
 		if (!client_socket) {
 			lt_werrf("failed to accept client: %S\n", lt_err_str(lt_errno()));
-			goto err;
+			continue;
 		}
 
 		u32 ipv4_addr = lt_sockaddr_ipv4_addr(&client_addr);
 		u16 ipv4_port = lt_sockaddr_ipv4_port(&client_addr);
 
-		lt_ierrf("["FG_BYELLOW"C_%hd"RESET"] accepted incoming connection from %ub.%ub.%ub.%ub:%uw\n", ipv4_addr,
-				(ipv4_addr >> 24), (ipv4_addr >> 16) & 0xFF, (ipv4_addr >> 8) & 0xFF, ipv4_addr & 0xFF, ipv4_port);
+		if (server->log_level <= SRV_LOG_REQUESTS) {
+			access_record_t* record = log_begin(shard->log_ring, ACCESS_ACCEPT, ipv4_addr);
+			if (record) {
+				record->port = ipv4_port;
+				access_ring_commit(shard->log_ring);
+			}
+		}
+
+		pending_conn_t pending = {
+				.socket = client_socket,
+				.addr = client_addr };
 
-		u32 cid = server->first_free;
-		if (cid == ~0) {
-			lt_printf("pool is full, dropping connection...\n");
-			goto err;
+		u32 slot = slot_pool_pop(&shard->slots);
+		if (slot != SLOT_NONE) {
+			if (!conn_assign(server, shard->first_slot + slot, &pending)) {
+				slot_pool_push(&shard->slots, slot);
+			}
+			continue;
 		}
-		connection_t* client = &server->connections[cid];
-		server->first_free = client->next_free; // !! race condition
-		
-		client->socket = client_socket;
-		client->addr   = client_addr;
-		lt_mutex_release(client->mutex);
-		continue;
 
-	err:
-		lt_socket_destroy(client_socket, lt_libc_heap);
+		switch (server->overload_policy) {
+		case SRV_OVERLOAD_QUEUE:
+			if (accept_queue_push(&shard->pending, &pending)) {
+				// a slot may have been released between the pop above and the push,
+				// in which case nobody would pick up the queued connection
+				if ((slot = slot_pool_pop(&shard->slots)) != SLOT_NONE) {
+					conn_release_slot(shard, shard->first_slot + slot);
+				}
+				continue;
+			}
+			// fall through
+
+		case SRV_OVERLOAD_REJECT:
+			reject_overloaded(shard, client_socket);
+			break;
+
+		case SRV_OVERLOAD_DROP:
+			__atomic_fetch_add(&shard->dropped_count, 1, __ATOMIC_RELAXED);
+			lt_socket_destroy(client_socket, lt_libc_heap);
+			break;
+		}
 	}
 }
 
@@ -166,8 +632,10 @@ void srv_set_var_moved(connection_t* conn, lstr_t key, lstr_t val) {
 	variable_t* var = lt_amalloc(conn->arena, sizeof(*var));
 	LT_ASSERT(var);
 	*var = (variable_t) {
+			.next = conn->first_var,
 			.key = key,
 			.val = val };
+	conn->first_var = var;
 
 	lt_hashtab_insert(&conn->vars, lt_hashls(key), var, &conn->arena->interf);
 }
@@ -187,6 +655,191 @@ lstr_t* srv_get_var(connection_t* conn, lstr_t key) {
 
 #include <signal.h>
 
+static
+void start_file_cache(server_t server[static 1]) {
+	lt_err_t err;
+
+	if (server->file_cache_size == 0) {
+		server->file_cache_size = SRV_DEFAULT_FILE_CACHE_SIZE;
+	}
+	if (server->file_cache_max_entry_size == 0) {
+		server->file_cache_max_entry_size = SRV_DEFAULT_FILE_CACHE_MAX_ENTRY_SIZE;
+	}
+
+	// cached files are only invalidated through inotify, the watcher already reported why it is missing
+	if (!server->fs_watcher_active) {
+		return;
+	}
+
+	file_cache_t* cache = &server->file_cache;
+	if ((err = file_cache_create(cache, &server->fs_watcher, server->file_cache_size, server->file_cache_max_entry_size))) {
+		lt_werrf("failed to create file cache, static files are served from disk: %S\n", lt_err_str(err));
+		return;
+	}
+
+	// every mapped target has to be watched
+	for (usz i = 0; i < lt_darr_count(server->mappings); ++i) {
+		route_mapping_t* m = &server->mappings[i];
+
+		if (m->type == RMAP_DIR) {
+			err = file_cache_watch(cache, m->target, 1);
+		}
+		else if (m->type == RMAP_MARKDOWN && m->prefix) {
+			// images and other files next to the documents are served from the file cache
+			err = file_cache_watch(cache, m->target, 1);
+		}
+		else if (m->type == RMAP_FILE) {
+			// file_cache_join turns the "." watch back into keys without a directory part, like m->target
+			lstr_t dir = lt_lsdirname(m->target);
+			if (!dir.len) {
+				dir = m->target.str[0] == '/' ? CLSTR("/") : CLSTR(".");
+			}
+			err = file_cache_watch(cache, dir, 0);
+		}
+		else {
+			continue;
+		}
+
+		if (err) {
+			lt_werrf("failed to watch '%S', static files are served from disk: %S\n", m->target, lt_err_str(err));
+			file_cache_destroy(cache);
+			return;
+		}
+	}
+
+	server->file_cache_active = 1;
+}
+
+#ifdef SSL
+static
+void start_handshakers(server_t server[static 1]) {
+	pthread_mutex_init(&server->handshake_lock, NULL);
+	pthread_cond_init(&server->handshake_ready, NULL);
+	server->handshake_head = 0;
+	server->handshake_count = 0;
+
+	server->handshake_queue = lt_malloc(lt_libc_heap, server->handshake_queue_size * sizeof(connection_t*));
+	server->handshakers = lt_malloc(lt_libc_heap, server->handshake_threads * sizeof(handshaker_t));
+	if (!server->handshake_queue || !server->handshakers) {
+		lt_ferrf("failed to allocate handshake threads\n");
+	}
+
+	usz first_ring = server->worker_count + server->listen_shards;
+	for (usz i = 0; i < server->handshake_threads; ++i) {
+		handshaker_t* hs = &server->handshakers[i];
+		hs->server = server;
+		hs->log_ring = server->access_log_active ? &server->access_log.rings[first_ring + i] : NULL;
+		pthread_mutex_init(&hs->guard.lock, NULL);
+		hs->guard.fd = -1;
+	}
+
+	// every guard exists before the first one is checked
+	server->guard_thread = lt_thread_create((lt_thread_fn_t)guard_proc, server, lt_libc_heap);
+	if (!server->guard_thread) {
+		lt_ferrf("failed to create ssl guard thread\n");
+	}
+	for (usz i = 0; i < server->handshake_threads; ++i) {
+		handshaker_t* hs = &server->handshakers[i];
+		hs->thread = lt_thread_create((lt_thread_fn_t)handshake_proc, hs, lt_libc_heap);
+		if (!hs->thread) {
+			lt_ferrf("failed to create handshake thread\n");
+		}
+	}
+}
+
+static
+void stop_handshakers(server_t server[static 1]) {
+	pthread_mutex_lock(&server->handshake_lock);
+	pthread_cond_broadcast(&server->handshake_ready);
+	pthread_mutex_unlock(&server->handshake_lock);
+
+	// a handshake in progress ends by its deadline at the latest, the guard has to outlive it
+	for (usz i = 0; i < server->handshake_threads; ++i) {
+		lt_thread_join(server->handshakers[i].thread, lt_libc_heap);
+		pthread_mutex_destroy(&server->handshakers[i].guard.lock);
+	}
+	lt_thread_cancel(server->guard_thread);
+	lt_thread_join(server->guard_thread, lt_libc_heap);
+
+	for (usz i = 0; i < server->worker_count; ++i) {
+		pthread_mutex_destroy(&server->workers[i].guard.lock);
+	}
+	lt_mfree(lt_libc_heap, server->handshakers);
+	lt_mfree(lt_libc_heap, server->handshake_queue);
+	pthread_cond_destroy(&server->handshake_ready);
+	pthread_mutex_destroy(&server->handshake_lock);
+}
+#endif
+
+static
+void compile_routes(server_t server[static 1]) {
+	lt_err_t err;
+
+	if ((err = route_table_create(&server->routes))) {
+		lt_ferrf("failed to create route table: %S\n", lt_err_str(err));
+	}
+
+	for (usz i = 0; i < lt_darr_count(server->mappings); ++i) {
+		route_mapping_t* m = &server->mappings[i];
+		b8 prefix = m->type == RMAP_DIR || ((m->type == RMAP_HANDLER || m->type == RMAP_MARKDOWN) && m->prefix);
+		if ((err = route_table_insert(&server->routes, m->route, prefix, i))) {
+			lt_ferrf("failed to insert route '%S': %S\n", m->route, lt_err_str(err));
+		}
+	}
+}
+
+static
+void start_access_log(server_t server[static 1]) {
+	lt_err_t err;
+
+	if (server->log_level == SRV_LOG_OFF || server->log_sink == ACCESS_LOG_NONE) {
+		return;
+	}
+
+	if (server->log_max_file_size == 0) {
+		server->log_max_file_size = SRV_DEFAULT_LOG_MAX_FILE_SIZE;
+	}
+	if (server->log_rotate_count == 0) {
+		server->log_rotate_count = SRV_DEFAULT_LOG_ROTATE_COUNT;
+	}
+	if (server->log_ring_size == 0) {
+		server->log_ring_size = SRV_DEFAULT_LOG_RING_SIZE;
+	}
+
+	// one ring per worker, listening thread and handshake thread, so every ring has exactly one producer
+	usz ring_count = server->worker_count + server->listen_shards;
+#ifdef SSL
+	ring_count += server->handshake_threads;
+#endif
+	access_log_t* log = &server->access_log;
+	if ((err = access_log_create(log, ring_count, server->log_ring_size))) {
+		lt_werrf("failed to create access log, requests are not logged: %S\n", lt_err_str(err));
+		return;
+	}
+	log->sink = server->log_sink;
+	log->path = server->log_path;
+	log->max_file_size = server->log_max_file_size;
+	log->rotate_count = server->log_rotate_count;
+
+	if (log->sink == ACCESS_LOG_FILE && !log->path.len) {
+		lt_werrf("server->log_sink is ACCESS_LOG_FILE, but no server->log_path was set, logging to stderr\n");
+		log->sink = ACCESS_LOG_STDERR;
+	}
+
+	if ((err = access_log_start(log)) && log->sink == ACCESS_LOG_FILE) {
+		lt_werrf("failed to open access log '%S', logging to stderr: %S\n", log->path, lt_err_str(err));
+		log->sink = ACCESS_LOG_STDERR;
+		err = access_log_start(log);
+	}
+	if (err) {
+		lt_werrf("failed to start access log writer, requests are not logged: %S\n", lt_err_str(err));
+		access_log_destroy(log);
+		return;
+	}
+
+	server->access_log_active = 1;
+}
+
 void srv_start(server_t* server) {
 	lt_err_t err;
 
@@ -197,6 +850,10 @@ void srv_start(server_t* server) {
 
 	signal(SIGPIPE, SIG_IGN);
 
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	server->start_time_nsec = (u64)now.tv_sec * 1000000000 + now.tv_nsec;
+
 	u16 default_port = 80;
 
 #ifdef SSL
@@ -243,13 +900,71 @@ https_canceled:
 		server->max_request_memory = SRV_DEFAULT_MAX_REQUEST_MEMORY;
 	}
 
-	server->socket = lt_socket_create(LT_SOCKTYPE_TCP, lt_libc_heap);
-	if (!server->socket) {
-		lt_ferrf("failed to create socket: %S\n", lt_err_str(lt_errno()));
+	if (server->listen_shards == 0) {
+		server->listen_shards = 1;
+	}
+	if (server->listen_shards > server->max_connections) {
+		server->listen_shards = server->max_connections;
+	}
+
+	if (server->accept_queue_size == 0) {
+		server->accept_queue_size = SRV_DEFAULT_ACCEPT_QUEUE_SIZE;
+	}
+
+	if (server->retry_after_sec == 0) {
+		server->retry_after_sec = SRV_DEFAULT_RETRY_AFTER_SEC;
+	}
+
+	if (server->header_timeout_msec == 0) {
+		server->header_timeout_msec = SRV_DEFAULT_HEADER_TIMEOUT_MSEC;
 	}
+	if (server->keep_alive_timeout_msec == 0) {
+		server->keep_alive_timeout_msec = SRV_DEFAULT_KEEP_ALIVE_TIMEOUT_MSEC;
+	}
+	if (server->max_keep_alive_requests == 0) {
+		server->max_keep_alive_requests = SRV_DEFAULT_MAX_KEEP_ALIVE_REQUESTS;
+	}
+	if (server->template_revalidate_msec == 0) {
+		server->template_revalidate_msec = SRV_DEFAULT_TEMPLATE_REVALIDATE_MSEC;
+	}
+	if (server->page_cache_size == 0) {
+		server->page_cache_size = SRV_DEFAULT_PAGE_CACHE_SIZE;
+	}
+#ifdef SSL
+	if (!server->use_https) {
+		server->handshake_threads = 0;
+	}
+	else {
+		if (server->handshake_threads == 0) {
+			server->handshake_threads = SRV_DEFAULT_HANDSHAKE_THREADS;
+		}
+		if (server->handshake_queue_size == 0) {
+			server->handshake_queue_size = SRV_DEFAULT_HANDSHAKE_QUEUE_SIZE;
+		}
+		if (server->handshake_timeout_msec == 0) {
+			server->handshake_timeout_msec = SRV_DEFAULT_HANDSHAKE_TIMEOUT_MSEC;
+		}
+	}
+#endif
+	timer_wheel_create(&server->timers, SRV_TIMER_TICK_MSEC);
 
-	if ((err = lt_socket_server(server->socket, server->port))) {
-		lt_ferrf("failed to bind server port: %S\n", lt_err_str(err));
+	if (server->worker_count == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		server->worker_count = cpus > 0 ? cpus : 1;
+	}
+
+	// idle connections only cost a file descriptor, make sure we are allowed to have enough of them
+	struct rlimit nofile;
+	if (getrlimit(RLIMIT_NOFILE, &nofile) == 0 && nofile.rlim_cur < server->max_connections + 64) {
+		nofile.rlim_cur = lt_min(nofile.rlim_max, server->max_connections + 64);
+		if (setrlimit(RLIMIT_NOFILE, &nofile) != 0 || nofile.rlim_cur < server->max_connections + 64) {
+			lt_werrf("file descriptor limit is lower than server->max_connections\n");
+		}
+	}
+
+	server->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (server->epoll_fd < 0) {
+		lt_ferrf("failed to create epoll instance: %S\n", lt_err_str(lt_errno()));
 	}
 
 	usz connections_size = server->max_connections * sizeof(*server->connections);
@@ -257,38 +972,197 @@ https_canceled:
 	if (!server->connections) {
 		lt_ferrf("failed to allocate connection array\n");
 	}
+	lt_mzero(server->connections, connections_size);
 
-	for (usz i = 0; i < server->max_connections; ++i) {
-		connection_t* conn = &server->connections[i];
-		conn->server = server;
-		conn->next_free = i + 1;
-		conn->arena = lt_amcreate(NULL, server->max_request_memory, 0);
-		conn->mutex = lt_mutex_create(lt_libc_heap);
-		lt_mutex_lock(conn->mutex);
-		conn->thread = lt_thread_create((lt_thread_fn_t)connection_proc, conn, lt_libc_heap);
+	server->shards = lt_malloc(lt_libc_heap, server->listen_shards * sizeof(*server->shards));
+	if (!server->shards) {
+		lt_ferrf("failed to allocate shard array\n");
 	}
-	server->connections[server->max_connections - 1].next_free = ~0;
+	lt_mzero(server->shards, server->listen_shards * sizeof(*server->shards));
+
+	// split the connection slots and the accept queue evenly between the shards
+	usz shard_slots = server->max_connections / server->listen_shards;
+	usz shard_queue_size = (server->accept_queue_size + server->listen_shards - 1) / server->listen_shards;
+
+	for (usz i = 0; i < server->listen_shards; ++i) {
+		shard_t* shard = &server->shards[i];
+		shard->server = server;
+		shard->first_slot = i * shard_slots;
+
+		usz slot_count = shard_slots;
+		if (i == server->listen_shards - 1) {
+			slot_count = server->max_connections - shard->first_slot;
+		}
+
+		for (usz j = 0; j < slot_count; ++j) {
+			server->connections[shard->first_slot + j].server = server;
+			server->connections[shard->first_slot + j].shard = shard;
+		}
+
+		if ((err = slot_pool_create(&shard->slots, slot_count, lt_libc_heap))) {
+			lt_ferrf("failed to allocate connection pool: %S\n", lt_err_str(err));
+		}
+		if ((err = accept_queue_create(&shard->pending, shard_queue_size, lt_libc_heap))) {
+			lt_ferrf("failed to allocate accept queue: %S\n", lt_err_str(err));
+		}
+
+		shard->socket = lt_socket_create(LT_SOCKTYPE_TCP, lt_libc_heap);
+		if (!shard->socket) {
+			lt_ferrf("failed to create socket: %S\n", lt_err_str(lt_errno()));
+		}
 
-	server->listen_thread = lt_thread_create((lt_thread_fn_t)listen_proc, server, lt_libc_heap);
-	if (!server->listen_thread) {
-		lt_ferrf("failed to create message thread\n");
+		// the kernel balances incoming connections between all sockets bound with SO_REUSEPORT
+		int reuseport = 1;
+		if (server->listen_shards > 1 && setsockopt(lt_socket_fd(shard->socket), SOL_SOCKET, SO_REUSEPORT, &reuseport, sizeof(reuseport)) < 0) {
+			lt_ferrf("failed to set SO_REUSEPORT: %S\n", lt_err_str(lt_errno()));
+		}
+
+		if ((err = lt_socket_server(shard->socket, server->port))) {
+			lt_ferrf("failed to bind server port: %S\n", lt_err_str(err));
+		}
+	}
+
+	start_access_log(server);
+	compile_routes(server);
+
+	if ((err = template_cache_create(&server->template_cache, server->template_revalidate_msec))) {
+		lt_ferrf("failed to create template cache: %S\n", lt_err_str(err));
+	}
+	if ((err = template_cache_create(&server->markdown_cache, server->template_revalidate_msec))) {
+		lt_ferrf("failed to create markdown cache: %S\n", lt_err_str(err));
+	}
+	if ((err = fs_watcher_create(&server->fs_watcher))) {
+		lt_werrf("failed to initialize inotify, static files and directory listings are not cached: %S\n", lt_err_str(err));
+	}
+	else {
+		server->fs_watcher_active = 1;
+	}
+	if ((err = dir_index_set_create(&server->dir_indexes, server->fs_watcher_active ? &server->fs_watcher : NULL))) {
+		lt_ferrf("failed to create directory index: %S\n", lt_err_str(err));
+	}
+	if ((err = page_cache_create(&server->page_cache, server->page_cache_size))) {
+		lt_ferrf("failed to create page cache: %S\n", lt_err_str(err));
+	}
+
+	server->workers = lt_malloc(lt_libc_heap, server->worker_count * sizeof(*server->workers));
+	if (!server->workers) {
+		lt_ferrf("failed to allocate worker array\n");
+	}
+
+	for (usz i = 0; i < server->worker_count; ++i) {
+		worker_t* worker = &server->workers[i];
+		worker->server = server;
+		worker->arena = lt_amcreate(NULL, server->max_request_memory, 0);
+		worker->expired = lt_darr_create(connection_t*, 64, lt_libc_heap);
+		worker->log_ring = server->access_log_active ? &server->access_log.rings[i] : NULL;
+#ifdef SSL
+		pthread_mutex_init(&worker->guard.lock, NULL);
+		worker->guard.fd = -1;
+#endif
+		worker->thread = lt_thread_create((lt_thread_fn_t)worker_proc, worker, lt_libc_heap);
+		if (!worker->thread) {
+			lt_ferrf("failed to create worker thread\n");
+		}
+	}
+
+#ifdef SSL
+	if (server->use_https) {
+		start_handshakers(server);
+	}
+#endif
+
+	if (!server->no_file_cache) {
+		start_file_cache(server);
+	}
+	// every subscriber is registered by now, the directory index adds its watches later on
+	if (server->fs_watcher_active && (err = fs_watcher_start(&server->fs_watcher))) {
+		lt_ferrf("failed to start file watcher: %S\n", lt_err_str(err));
+	}
+
+	for (usz i = 0; i < server->listen_shards; ++i) {
+		shard_t* shard = &server->shards[i];
+		shard->log_ring = server->access_log_active ? &server->access_log.rings[server->worker_count + i] : NULL;
+		shard->listen_thread = lt_thread_create((lt_thread_fn_t)listen_proc, shard, lt_libc_heap);
+		if (!shard->listen_thread) {
+			lt_ferrf("failed to create message thread\n");
+		}
 	}
 }
 
 void srv_stop(server_t* server) {
 	server->done = 1;
 
-	lt_thread_cancel(server->listen_thread);
-	lt_thread_join(server->listen_thread, lt_libc_heap);
+	for (usz i = 0; i < server->listen_shards; ++i) {
+		lt_thread_cancel(server->shards[i].listen_thread);
+		lt_thread_join(server->shards[i].listen_thread, lt_libc_heap);
+		lt_socket_destroy(server->shards[i].socket, lt_libc_heap);
+	}
+
+	// workers notice server->done within WORKER_POLL_MSEC
+	for (usz i = 0; i < server->worker_count; ++i) {
+		lt_thread_join(server->workers[i].thread, lt_libc_heap);
+	}
+#ifdef SSL
+	// the guard thread checks the workers as well, so it is stopped before they are freed
+	if (server->use_https) {
+		stop_handshakers(server);
+	}
+#endif
+	for (usz i = 0; i < server->worker_count; ++i) {
+		lt_amdestroy(server->workers[i].arena);
+		lt_darr_destroy(server->workers[i].expired);
+	}
+	lt_mfree(lt_libc_heap, server->workers);
+
+	for (usz i = 0; i < server->listen_shards; ++i) {
+		pending_conn_t pending;
+		while (accept_queue_pop(&server->shards[i].pending, &pending)) {
+			lt_socket_destroy(pending.socket, lt_libc_heap);
+		}
+	}
+
+	for (usz i = 0; i < server->max_connections; ++i) {
+		if (server->connections[i].socket) {
+			conn_close(server, &server->connections[i]);
+		}
+	}
+	close(server->epoll_fd);
+
+	// every producer has stopped, the writer drains what is left before exiting
+	if (server->access_log_active) {
+		access_log_destroy(&server->access_log);
+		server->access_log_active = 0;
+	}
 
-	lt_socket_destroy(server->socket, lt_libc_heap);
+	for (usz i = 0; i < server->listen_shards; ++i) {
+		accept_queue_destroy(&server->shards[i].pending, lt_libc_heap);
+		slot_pool_destroy(&server->shards[i].slots, lt_libc_heap);
+	}
+	lt_mfree(lt_libc_heap, server->shards);
+
+	// subscribers are destroyed after the watcher stopped delivering events to them
+	if (server->fs_watcher_active) {
+		fs_watcher_stop(&server->fs_watcher);
+	}
+	if (server->file_cache_active) {
+		file_cache_destroy(&server->file_cache);
+		server->file_cache_active = 0;
+	}
 
 	for (usz i = 0; i < server->max_connections; ++i) {
-		lt_amdestroy(server->connections[i].arena);
-		lt_mutex_destroy(server->connections[i].mutex, lt_libc_heap);
-		//lt_thread_join(server->connections[i].thread, lt_libc_heap);
+		conn_free_buffers(&server->connections[i]);
 	}
 	lt_mfree(lt_libc_heap, server->connections);
+	timer_wheel_destroy(&server->timers);
+	route_table_destroy(&server->routes);
+	template_cache_destroy(&server->template_cache);
+	template_cache_destroy(&server->markdown_cache);
+	dir_index_set_destroy(&server->dir_indexes);
+	if (server->fs_watcher_active) {
+		fs_watcher_destroy(&server->fs_watcher);
+		server->fs_watcher_active = 0;
+	}
+	page_cache_destroy(&server->page_cache);
 	lt_darr_destroy(server->mappings);
 
 #ifdef SSL
@@ -296,66 +1170,231 @@ void srv_stop(server_t* server) {
 #endif
 }
 
-b8 srv_handle_mapped_request(server_t* server, connection_t* conn) {
-	lt_err_t err;
+void srv_get_stats(server_t* server, srv_stats_t out_stats[static 1]) {
+	*out_stats = (srv_stats_t){ .active_connections = server->max_connections };
 
-	if (!server->mappings) {
-		return 0;
+	for (usz i = 0; i < server->listen_shards; ++i) {
+		shard_t* shard = &server->shards[i];
+		out_stats->active_connections -= __atomic_load_n(&shard->slots.free_count, __ATOMIC_RELAXED);
+		out_stats->pending_connections += accept_queue_depth(&shard->pending);
+		out_stats->rejected_connections += __atomic_load_n(&shard->rejected_count, __ATOMIC_RELAXED);
+		out_stats->dropped_connections += __atomic_load_n(&shard->dropped_count, __ATOMIC_RELAXED);
 	}
 
+	if (server->file_cache_active) {
+		clock_cache_t* cache = &server->file_cache.store;
+		out_stats->file_cache_hits = __atomic_load_n(&cache->hits, __ATOMIC_RELAXED);
+		out_stats->file_cache_misses = __atomic_load_n(&cache->misses, __ATOMIC_RELAXED);
+		out_stats->file_cache_evictions = __atomic_load_n(&cache->evictions, __ATOMIC_RELAXED);
+		out_stats->file_cache_size = __atomic_load_n(&cache->size, __ATOMIC_RELAXED);
+	}
+
+	out_stats->template_cache_hits = __atomic_load_n(&server->template_cache.hits, __ATOMIC_RELAXED);
+	out_stats->template_cache_misses = __atomic_load_n(&server->template_cache.misses, __ATOMIC_RELAXED);
+	out_stats->markdown_cache_hits = __atomic_load_n(&server->markdown_cache.hits, __ATOMIC_RELAXED);
+	out_stats->markdown_cache_misses = __atomic_load_n(&server->markdown_cache.misses, __ATOMIC_RELAXED);
+	out_stats->dir_index_rebuilds = __atomic_load_n(&server->dir_indexes.rebuilds, __ATOMIC_RELAXED);
+
+	clock_cache_t* pages = &server->page_cache.store;
+	out_stats->page_cache_hits = __atomic_load_n(&pages->hits, __ATOMIC_RELAXED);
+	out_stats->page_cache_misses = __atomic_load_n(&pages->misses, __ATOMIC_RELAXED);
+	out_stats->page_cache_evictions = __atomic_load_n(&pages->evictions, __ATOMIC_RELAXED);
+	out_stats->page_cache_size = __atomic_load_n(&pages->size, __ATOMIC_RELAXED);
+}
+
+// drops the cached pages of every template mapping with the given route
+void srv_purge_pages(server_t* server, lstr_t route) {
 	for (usz i = 0; i < lt_darr_count(server->mappings); ++i) {
 		route_mapping_t* m = &server->mappings[i];
+		if (m->cache != PAGE_CACHE_OFF && lt_lseq(m->route, route)) {
+			page_cache_purge(&server->page_cache, i);
+		}
+	}
+}
 
-		if (m->type == RMAP_FILE && lt_lseq(conn->uri.page, m->route)) {
-			lstr_t data = NLSTR();
-			if ((err = lt_freadallp(m->target, &data, &conn->arena->interf))) {
-				lt_werrf("failed to read '%S': %S\n", m->target, lt_err_str(err));
-			}
+void srv_purge_all_pages(server_t* server) {
+	page_cache_purge(&server->page_cache, PAGE_CACHE_ALL);
+}
 
-			conn->response_mime_type = m->mime_type;
-			conn->response.body = data;
-			return 1;
+static
+b8 append_key(char* buf, usz size, usz* len, lstr_t str) {
+	if (*len + str.len + 1 > size) {
+		return 0;
+	}
+	memcpy(buf + *len, str.str, str.len);
+	*len += str.len;
+	buf[(*len)++] = 0;
+	return 1;
+}
+
+// appends the name and value of every parameter or variable in a comma separated list
+static
+b8 append_key_values(connection_t* conn, lstr_t names, b8 vars, char* buf, usz size, usz* len) {
+	for (char* it = names.str, *end = it + names.len; it < end;) {
+		char* start = it;
+		while (it < end && *it != ',') {
+			++it;
 		}
+		lstr_t name = lt_lstrim(lt_lsfrom_range(start, it++));
 
-		else if (m->type == RMAP_TEMPLATE && lt_lseq(conn->uri.page, m->route)) {
-			lstr_t data = NLSTR();
-			if ((err = lt_freadallp(m->target, &data, &conn->arena->interf))) {
-				lt_werrf("failed to read '%S': %S\n", m->target, lt_err_str(err));
-			}
+		lstr_t* val = vars ? srv_get_var(conn, name) : uri_find_param(&conn->uri, name);
+		if (!append_key(buf, size, len, name) || !append_key(buf, size, len, val ? *val : NLSTR())) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// the mapping index, followed by the selected parameters and variables. returns NLSTR() if the key
+// does not fit, in which case the page is rendered without caching.
+static
+lstr_t build_page_key(connection_t* conn, route_mapping_t* m, char* buf, usz size) {
+	usz len = lt_sprintf(buf, "%uz%c", m - conn->server->mappings, 0);
+
+	if (!append_key_values(conn, m->cache_params, 0, buf, size, &len) || !append_key_values(conn, m->cache_vars, 1, buf, size, &len)) {
+		return NLSTR();
+	}
+	return LSTR(buf, len);
+}
 
-			conn->response_mime_type = m->mime_type;
-			conn->response.body = template_render_str(data, conn);
+// a template that can not be loaded was logged by template_cache_get already
+static
+void respond_render_error(connection_t* conn, lstr_t template, lt_err_t err) {
+	if (err == LT_ERR_NOT_FOUND) {
+		conn->server->on_404(conn);
+		return;
+	}
+	srv_log_error(conn, CLSTR("failed to render"), template, err);
+	srv_release_body(conn);
+	conn->response.body = NLSTR();
+	conn->response.response_status_code = 500;
+	conn->response.response_status_msg = CLSTR("Internal Server Error");
+}
+
+static
+void render_cached_page(connection_t* conn, route_mapping_t* m) {
+	lt_err_t err;
+	server_t* server = conn->server;
+	page_cache_t* cache = &server->page_cache;
+
+	char key_buf[PAGE_CACHE_MAX_KEY_SIZE];
+	lstr_t key = build_page_key(conn, m, key_buf, sizeof(key_buf));
+	if (!key.str) {
+		if ((err = template_render_file_iov(m->target, conn, SRV_IOV_STREAM_THRESHOLD))) {
+			respond_render_error(conn, m->target, err);
+		}
+		return;
+	}
+
+	// a hit is served from the shared entry, without rendering or copying anything
+	u64 now_msec = timer_now_msec();
+	page_cache_entry_t* entry = page_cache_get(cache, key, now_msec);
+	if (entry) {
+		srv_respond_page(conn, entry);
+		return;
+	}
+
+	// a page that does not fit into the cache is streamed like an uncached one
+	// nothing is cached for a template that failed to render
+	u64 generation = page_cache_generation(cache);
+	if ((err = template_render_file_iov(m->target, conn, cache->store.max_size))) {
+		respond_render_error(conn, m->target, err);
+		return;
+	}
+
+	response_iov_t* body = conn->response_iov;
+	if (!body || body->failed || body->streaming || conn->response.response_status_code != 200) {
+		return;
+	}
+
+	u64 expires_msec = m->cache == PAGE_CACHE_TTL ? now_msec + m->cache_ttl_msec : 0;
+	entry = page_cache_insert(cache, m - server->mappings, key, body->iov, body->count, body->total, expires_msec, generation);
+	if (entry) {
+		srv_respond_page(conn, entry);
+	}
+}
+
+static
+b8 dispatch_mapping(connection_t* conn, route_mapping_t* m) {
+	lt_err_t err;
+
+	switch (m->type) {
+	case RMAP_FILE:
+		if ((err = srv_respond_static(conn, m->target))) {
+			srv_log_error(conn, CLSTR("failed to open"), m->target, err);
+		}
+		conn->response_mime_type = m->mime_type;
+		return 1;
+
+	case RMAP_TEMPLATE: {
+		conn->response_mime_type = m->mime_type;
+		if (m->etag && srv_etag_template(conn, m->target)) {
 			return 1;
 		}
 
-		else if (m->type == RMAP_DIR && lt_lsprefix(conn->uri.page, m->route)) {
-			srv_handle_dir_mapping(conn, m->route, m->target, m->mime_type);
+		if (m->cache != PAGE_CACHE_OFF) {
+			render_cached_page(conn, m);
 			return 1;
 		}
+
+		// static template text is sent straight from the compiled template, without being copied.
+		// large pages, such as long file_tree listings, are streamed once they pass the threshold.
+		if ((err = template_render_file_iov(m->target, conn, SRV_IOV_STREAM_THRESHOLD))) {
+			respond_render_error(conn, m->target, err);
+		}
+		return 1;
+	}
+
+	case RMAP_DIR:
+		srv_handle_dir_mapping(conn, m->route, m->target, m->mime_type);
+		return 1;
+
+	case RMAP_HANDLER:
+		return m->handler(conn);
+
+	case RMAP_MARKDOWN:
+		srv_handle_markdown_mapping(conn, m);
+		return 1;
+
+	case RMAP_AUTO:
+		break;
+	}
+	LT_ASSERT_NOT_REACHED();
+	return 0;
+}
+
+// exact routes take precedence over prefix routes, of which the longest one wins
+b8 srv_handle_mapped_request(server_t* server, connection_t* conn) {
+	if (!server->routes.root) {
+		return 0;
 	}
 
+	route_match_t match = route_table_lookup(&server->routes, conn->uri.page);
+	if (match.exact != ROUTE_NONE && dispatch_mapping(conn, &server->mappings[match.exact])) {
+		return 1;
+	}
+	if (match.prefix != ROUTE_NONE && dispatch_mapping(conn, &server->mappings[match.prefix])) {
+		return 1;
+	}
 	return 0;
 }
 
 void srv_handle_dir_mapping(connection_t* conn, lstr_t route, lstr_t target, lstr_t mime_type_override) {
 	lstr_t file = LSTR(conn->uri.page.str + route.len, conn->uri.page.len - route.len);
-	lstr_t load_path = lt_lsbuild(&conn->arena->interf, "%S/%S", target, file);
+	if (file.len && file.str[0] == '/') {
+		// keep paths canonical, the file cache is keyed by them
+		++file.str;
+		--file.len;
+	}
+	lstr_t load_path = file_cache_join(&conn->arena->interf, target, file);
 
 	lt_err_t err;
 
-	lt_stat_t stat;
-	if ((err = lt_lstatp(load_path, &stat))) {
-		lt_werrf("failed to stat '%S': %S\n", load_path, lt_err_str(err));
-		goto on_404;
-	}
-	if (stat.type != LT_DIRENT_FILE) {
-		lt_werrf("ignoring request for '%S': IS_DIRECTORY\n", load_path);
-		goto on_404;
-	}
-
-	lstr_t data = NLSTR();
-	if ((err = lt_freadallp(load_path, &data, &conn->arena->interf))) {
-		lt_werrf("failed to read '%S': %S\n", load_path, lt_err_str(err));
+	if ((err = srv_respond_static(conn, load_path))) {
+		// missing files show up as 404 in the request log already
+		if (err != LT_ERR_NOT_FOUND) {
+			srv_log_error(conn, CLSTR("failed to open"), load_path, err);
+		}
 		goto on_404;
 	}
 
@@ -365,41 +1404,117 @@ void srv_handle_dir_mapping(connection_t* conn, lstr_t route, lstr_t target, lst
 	else {
 		conn->response_mime_type = mime_type(conn->uri.page);
 	}
-	conn->response.body = data;
 	return;
 
 on_404:
 	conn->server->on_404(conn);
 }
 
+// directories with an index.md are served as markdown documents by RMAP_AUTO
+static
+b8 has_markdown_index(lstr_t dir) {
+	char path[LT_PATH_MAX];
+	if (dir.len + sizeof("/index.md") > sizeof(path)) {
+		return 0;
+	}
+	lstr_t index = LSTR(path, lt_sprintf(path, "%S/index.md", dir));
+
+	lt_stat_t stat;
+	return lt_lstatp(index, &stat) == LT_SUCCESS && stat.type == LT_DIRENT_FILE;
+}
+
+// targets are cache keys and watch paths, which have to be spelled the same way everywhere: without
+// repeated or trailing slashes and "." segments, and "." for the working directory itself.
+// a target that changes is copied, and lives as long as the process.
+static
+lstr_t normalize_target(lstr_t path) {
+	char buf[LT_PATH_MAX];
+	if (path.len >= sizeof(buf)) {
+		return path;
+	}
+
+	usz len = 0;
+	if (path.len && path.str[0] == '/') {
+		buf[len++] = '/';
+	}
+	for (usz i = 0; i < path.len;) {
+		while (i < path.len && path.str[i] == '/') {
+			++i;
+		}
+		usz start = i;
+		while (i < path.len && path.str[i] != '/') {
+			++i;
+		}
+		usz seg_len = i - start;
+
+		if (!seg_len || (seg_len == 1 && path.str[start] == '.')) {
+			continue;
+		}
+		if (len && buf[len - 1] != '/') {
+			buf[len++] = '/';
+		}
+		memcpy(buf + len, path.str + start, seg_len);
+		len += seg_len;
+	}
+	if (!len) {
+		buf[len++] = '.';
+	}
+
+	if (lt_lseq(LSTR(buf, len), path)) {
+		return path;
+	}
+	return lt_strdup(lt_libc_heap, LSTR(buf, len));
+}
+
 void srv_map_(server_t* server, route_mapping_t mapping) {
 	lt_err_t err;
 
 	if (mapping.route.len > 1) {
 		mapping.route = lt_lstrim_trailing_slash(mapping.route);
 	}
-	if (mapping.target.len > 1) {
-		mapping.target = lt_lstrim_trailing_slash(mapping.target);
+	if (mapping.type != RMAP_HANDLER) {
+		mapping.target = normalize_target(mapping.target);
 	}
 
-	lt_ierrf("mapping '%S' to '%S'...\n", mapping.route, mapping.target);
+	if (server->routes.root) {
+		lt_werrf("route '%S' was added after srv_start, mapping ignored\n", mapping.route);
+		return;
+	}
 
-	if (mapping.type == RMAP_AUTO) {
-		lt_stat_t stat;
-		if ((err = lt_lstatp(mapping.target, &stat))) {
-			lt_werrf("stat failed for '%S', mapping ignored: %S\n", mapping.target, lt_err_str(err));
-			return;
-		}
+	if (mapping.type == RMAP_HANDLER) {
+		LT_ASSERT(mapping.handler != NULL);
+		lt_ierrf("routing '%S' to a handler...\n", mapping.route);
+	}
+	else {
+		lt_ierrf("mapping '%S' to '%S'...\n", mapping.route, mapping.target);
+	}
+
+	lt_stat_t stat;
+	if ((mapping.type == RMAP_AUTO || mapping.type == RMAP_MARKDOWN) && (err = lt_lstatp(mapping.target, &stat))) {
+		lt_werrf("stat failed for '%S', mapping ignored: %S\n", mapping.target, lt_err_str(err));
+		return;
+	}
 
+	if (mapping.type == RMAP_AUTO) {
 		if (stat.type == LT_DIRENT_DIR) {
-			mapping.type = RMAP_DIR;
-			lt_ierrf("selected mapping type DIR\n");
+			if (has_markdown_index(mapping.target)) {
+				mapping.type = RMAP_MARKDOWN;
+				lt_ierrf("selected mapping type MARKDOWN\n");
+			}
+			else {
+				mapping.type = RMAP_DIR;
+				lt_ierrf("selected mapping type DIR\n");
+			}
 		}
 		else if (stat.type == LT_DIRENT_FILE) {
 			if (lt_lssuffix(mapping.target, CLSTR(".tmpl"))) {
 				mapping.type = RMAP_TEMPLATE;
 				lt_ierrf("selected mapping type TEMPLATE\n");
 			}
+			else if (lt_lssuffix(mapping.target, CLSTR(".md"))) {
+				mapping.type = RMAP_MARKDOWN;
+				lt_ierrf("selected mapping type MARKDOWN\n");
+			}
 			else {
 				mapping.type = RMAP_FILE;
 				lt_ierrf("selected mapping type FILE\n");
@@ -411,11 +1526,20 @@ void srv_map_(server_t* server, route_mapping_t mapping) {
 		}
 	}
 
+	if (mapping.type == RMAP_MARKDOWN) {
+		mapping.prefix = stat.type == LT_DIRENT_DIR;
+		if (!mapping.template.len) {
+			mapping.template = CLSTR(SRV_DEFAULT_MARKDOWN_TEMPLATE);
+		}
+	}
+
 	if (!mapping.mime_type.len) {
 		switch (mapping.type) {
 		case RMAP_AUTO:		LT_ASSERT_NOT_REACHED();
 		case RMAP_DIR:		break;
+		case RMAP_HANDLER:	break;
 		case RMAP_TEMPLATE:	mapping.mime_type = mime_type_or_default(mapping.route, CLSTR("text/html")); break;
+		case RMAP_MARKDOWN:	mapping.mime_type = CLSTR("text/html"); break;
 		case RMAP_FILE:		mapping.mime_type = mime_type(mapping.target); break;
 		}
 	}
@@ -425,5 +1549,9 @@ void srv_map_(server_t* server, route_mapping_t mapping) {
 		LT_ASSERT(server->mappings != NULL);
 	}
 
+	if (mapping.cache == PAGE_CACHE_TTL && !mapping.cache_ttl_msec) {
+		mapping.cache_ttl_msec = SRV_DEFAULT_PAGE_CACHE_TTL_MSEC;
+	}
+
 	lt_darr_push(server->mappings, mapping);
 }
@@ -6,53 +6,162 @@
 #include <lt/hashtab.h>
 
 #include "fwd.h"
+#include "pool.h"
+#include "filecache.h"
+#include "pagecache.h"
+#include "timer.h"
+#include "accesslog.h"
+#include "router.h"
+#include "template.h"
+#include "dirindex.h"
+
+#include <pthread.h>
+#include <sys/uio.h>
 
 // uri.c
 
-#define MAX_URI_PARAMS 32
+// queries with more parameters than this get a hash index, fewer are searched linearly
+#define URI_PARAM_SCAN_LIMIT 8
 
+typedef
+struct uri_param {
+	lstr_t key;
+	lstr_t val;
+	u32 hash; // of the lowercase key
+} uri_param_t;
+
+// page and parameters point into the parsed string unless they had to be decoded
 typedef
 struct uri {
 	lstr_t page;
 	lstr_t query;
+	usz invalid_escapes; // malformed '%' escapes, which are kept as they are
 
-	lstr_t params[MAX_URI_PARAMS];
-	lstr_t param_vals[MAX_URI_PARAMS];
+	uri_param_t* params;
 	usz param_count;
+	u32* param_index; // open addressing table of parameter positions + 1, NULL for short queries
+	usz param_index_mask;
 } uri_t;
 
-lstr_t urlencode(lstr_t str);
-lstr_t urldecode(lstr_t str);
+lstr_t urlencode(lstr_t str, lt_alloc_t* alloc);
+lstr_t urldecode(lstr_t str, lt_alloc_t* alloc);
 
-uri_t parse_uri(lstr_t str);
-void free_uri(const uri_t* uri);
+lt_err_t parse_uri(uri_t out[static 1], lstr_t str, lt_alloc_t* alloc);
 
 lstr_t* uri_find_param(uri_t* uri, lstr_t param);
 
 // server.c
 
+typedef struct shard shard_t;
+typedef struct variable variable_t;
+
+// file descriptor based response body, sent with sendfile(2) instead of being buffered
+typedef
+struct response_file {
+	int fd;
+	u64 offset;
+	u64 size;
+} response_file_t;
+
+typedef
+struct response_stream {
+	connection_t* conn;
+	char* buf; // NULL if no chunk buffer could be allocated, every write is sent as its own chunk
+	usz len;
+	b8 failed;
+} response_stream_t;
+
+// scatter list response body. static fragments are referenced where they are, everything else is
+// copied into arena memory. templates that fragments point into are held until the response is sent.
+// a body that grows past stream_threshold, or runs out of arena memory, is sent as the first chunk of
+// a chunked response, and everything written after that is streamed.
+typedef
+struct response_iov {
+	struct iovec* iov;
+	usz count;
+	usz capacity;
+
+	char* buf;
+	usz buf_len;
+	usz buf_size;
+
+	compiled_template_t** holds;
+	usz hold_count;
+	usz hold_capacity;
+
+	u64 total;
+	u64 stream_threshold; // 0 to only stream once memory runs out
+	b8 failed;
+	b8 stream_refused; // HEAD request or HTTP/1.0 client, see srv_stream_begin
+	b8 streaming;
+	response_stream_t stream;
+} response_iov_t;
+
+typedef
+struct byte_range {
+	u64 offset;
+	u64 size;
+} byte_range_t;
+
+typedef
+enum conn_state {
+	CONN_IDLE = 0, // waiting in epoll, may be reclaimed by its timer
+	CONN_BUSY,     // owned by a worker or a handshake thread
+	CONN_CLOSING,  // claimed by the timer sweep
+} conn_state_t;
+
 typedef
 struct connection {
 	b8 keep_alive;
-	volatile u32 next_free;
+	b8 handshake_done;
 	server_t* server;
+	shard_t* shard;
 	lt_arena_t* arena;
-	lt_mutex_t* mutex;
-	lt_thread_t* thread;
 
 #ifdef SSL
 	lt_ssl_connection_t* ssl_conn;
 #endif
 	lt_socket_t* socket;
+	int fd;
 	lt_sockaddr_t addr;
+
+	volatile u32 state;
+	u32 generation; // distinguishes epoll events of earlier connections that used the same slot
+	wheel_timer_t timer;
+	u32 request_count;
+	u64 read_deadline_msec; // header deadline of the request being received, 0 between requests
+	access_ring_t* log_ring; // of the worker that serves the connection, see srv_log_error
+
+	lt_write_fn_t write_callb;
+	lt_read_fn_t read_callb;
+	void* callb_usr;
+
+	// bytes read past the current request are kept for the next one
+	u8* recv_buf;
+	usz recv_pos;
+	usz recv_len;
+
+	// responses to pipelined requests are collected here and sent together
+	u8* send_buf;
+	usz send_len;
+	b8 send_batch;
+
 	lt_http_msg_t request;
 	lt_http_msg_t response;
 
 	uri_t uri;
 
 	lstr_t response_mime_type;
+	response_file_t response_file;
+	file_cache_entry_t* response_cache_entry;
+	page_cache_entry_t* response_page;
+	response_iov_t* response_iov;
+	byte_range_t* response_ranges; // only used for multipart/byteranges responses
+	usz response_range_count;
+	b8 response_streamed;
 
 	lt_hashtab_t vars;
+	variable_t* first_var;
 
 	void* usr;
 } connection_t;
@@ -63,21 +172,157 @@ enum route_mapping_type {
 	RMAP_DIR,
 	RMAP_FILE,
 	RMAP_TEMPLATE,
+	RMAP_HANDLER,
+	RMAP_MARKDOWN,
 } route_mapping_type_t;
 
+// returns 0 to let the request fall through to the next matching route
+typedef b8 (*srv_handler_t)(connection_t* conn);
+
+typedef
+enum page_cache_policy {
+	PAGE_CACHE_OFF = 0,
+	PAGE_CACHE_TTL,    // rendered pages are reused for cache_ttl_msec
+	PAGE_CACHE_MANUAL, // rendered pages are reused until srv_purge_pages is called
+} page_cache_policy_t;
+
 typedef
 struct route_mapping {
 	route_mapping_type_t type;
 	lstr_t route;
 	lstr_t target;
 	lstr_t mime_type;
+	b8 etag; // RMAP_TEMPLATE only, see srv_etag_template
+	srv_handler_t handler; // RMAP_HANDLER only
+	b8 prefix; // also match every path below the route like RMAP_DIR does. set by the caller for RMAP_HANDLER, and by srv_map_ for RMAP_MARKDOWN directories
+	lstr_t template; // RMAP_MARKDOWN only, the page documents are rendered into, see srv_respond_markdown
+
+	// RMAP_TEMPLATE only. pages are cached by route, plus the values of the listed uri parameters and
+	// srv_set_var variables, both given as comma separated names
+	page_cache_policy_t cache;
+	u32 cache_ttl_msec;
+	lstr_t cache_params;
+	lstr_t cache_vars;
 } route_mapping_t;
 
+typedef
+enum srv_overload_policy {
+	SRV_OVERLOAD_QUEUE = 0, // hold accepted sockets until a slot frees up, reject once the queue is full
+	SRV_OVERLOAD_REJECT,    // answer with '503 Service Unavailable' and a Retry-After header
+	SRV_OVERLOAD_DROP,      // close the socket without a response
+} srv_overload_policy_t;
+
+typedef
+enum srv_log_level {
+	SRV_LOG_REQUESTS = 0, // accepted connections, requests and per-request errors
+	SRV_LOG_ERRORS,       // per-request errors only
+	SRV_LOG_OFF,
+} srv_log_level_t;
+
+typedef
+struct srv_stats {
+	usz active_connections;
+	usz pending_connections;
+	usz rejected_connections;
+	usz dropped_connections;
+
+	usz file_cache_hits;
+	usz file_cache_misses;
+	usz file_cache_evictions;
+	usz file_cache_size;
+
+	usz template_cache_hits;
+	usz template_cache_misses;
+
+	usz markdown_cache_hits;
+	usz markdown_cache_misses;
+
+	usz dir_index_rebuilds;
+
+	usz page_cache_hits;
+	usz page_cache_misses;
+	usz page_cache_evictions;
+	usz page_cache_size;
+} srv_stats_t;
+
+// one listening socket with its own accept loop and its own share of the connection slots
+typedef
+struct shard {
+	server_t* server;
+	lt_socket_t* socket;
+	lt_thread_t* listen_thread;
+
+	u32 first_slot;
+	slot_pool_t slots;
+	accept_queue_t pending;
+
+	volatile usz rejected_count;
+	volatile usz dropped_count;
+
+	access_ring_t* log_ring;
+} shard_t;
+
+#ifdef SSL
+// hard deadline of a blocking ssl call. the ssl layer can not be interrupted, so once the deadline has
+// passed the guard thread shuts the socket down, which makes the call fail. fd is -1 while nothing is guarded.
+typedef
+struct io_guard {
+	pthread_mutex_t lock;
+	int fd;
+	u64 deadline_msec;
+	b8 expired;
+} io_guard_t;
+
+// performs the ssl handshakes of new connections, so that slow clients hold one of these instead of a worker
+typedef
+struct handshaker {
+	server_t* server;
+	lt_thread_t* thread;
+	io_guard_t guard;
+	access_ring_t* log_ring;
+} handshaker_t;
+#endif
+
+typedef
+struct worker {
+	server_t* server;
+	lt_arena_t* arena;
+	lt_thread_t* thread;
+	lt_darr(connection_t*) expired;
+	access_ring_t* log_ring;
+#ifdef SSL
+	io_guard_t guard; // bounds the ssl reads of a request by its header deadline
+#endif
+} worker_t;
+
 typedef
 struct server {
 	u16 port;
 	usz max_connections;
 	usz max_request_memory;
+	usz worker_count;
+	usz listen_shards; // > 1 opens that many SO_REUSEPORT listening sockets
+	usz accept_queue_size;
+	srv_overload_policy_t overload_policy;
+	u32 retry_after_sec;
+
+	u32 header_timeout_msec; // time a client has to send a complete request, starting with its first byte
+	u32 keep_alive_timeout_msec; // time an idle connection is kept open, also applies before the first request
+	u32 max_keep_alive_requests; // requests served over one connection before it is closed
+
+	srv_log_level_t log_level;
+	access_log_sink_t log_sink;
+	lstr_t log_path; // ACCESS_LOG_FILE only
+	usz log_max_file_size; // size at which the log file is rotated, 0 to never rotate
+	usz log_rotate_count; // number of rotated files that are kept
+	usz log_ring_size; // records buffered per thread, more are dropped until the writer catches up
+
+	b8 no_file_cache;
+	usz file_cache_size;
+	usz file_cache_max_entry_size;
+	u32 template_revalidate_msec; // minimum time between checks of a template or markdown file for changes
+	b8 no_compiled_templates; // load the built-in templates from disk like any other, to edit them without rebuilding
+	usz page_cache_size; // memory used for pages of mappings with a cache policy
 	b8 (*on_request)(connection_t* c);
 	void (*on_unmapped_request)(connection_t* c);
 	void (*on_404)(connection_t* c);
@@ -87,22 +332,77 @@ struct server {
 	lstr_t cert_path;
 	lstr_t key_path;
 	lstr_t cert_chain_path;
+	usz handshake_threads;
+	usz handshake_queue_size; // connections waiting for a handshake thread, more are dropped
+	u32 handshake_timeout_msec; // total time a client has to complete the ssl handshake
 #endif
 
 	volatile b8 done;
-	lt_socket_t* socket;
-	lt_thread_t* listen_thread;
+	u64 start_time_nsec;
+	int epoll_fd;
+	shard_t* shards;
+	worker_t* workers;
 	connection_t* connections;
-	volatile u32 first_free;
+	timer_wheel_t timers;
+	b8 access_log_active;
+	access_log_t access_log;
+
+#ifdef SSL
+	handshaker_t* handshakers;
+	pthread_mutex_t handshake_lock;
+	pthread_cond_t handshake_ready;
+	connection_t** handshake_queue;
+	usz handshake_head;
+	usz handshake_count;
+	lt_thread_t* guard_thread;
+#endif
+
+	b8 fs_watcher_active;
+	fs_watcher_t fs_watcher; // inotify events for the file cache and the directory indexes
+
+	b8 file_cache_active;
+	file_cache_t file_cache;
+
+	template_cache_t template_cache;
+	template_cache_t markdown_cache; // rendered documents of RMAP_MARKDOWN mappings
+	dir_index_set_t dir_indexes; // directory listings of the file_tree stream
+	page_cache_t page_cache;
 
 	lt_darr(route_mapping_t) mappings;
+	route_table_t routes; // compiled from mappings by srv_start
 } server_t;
 
-#define SRV_DEFAULT_MAX_CONNECTIONS 32
+#define SRV_DEFAULT_MAX_CONNECTIONS 4096
 #define SRV_DEFAULT_MAX_REQUEST_MEMORY LT_MB(8)
+#define SRV_DEFAULT_ACCEPT_QUEUE_SIZE 1024
+#define SRV_DEFAULT_RETRY_AFTER_SEC 1
+#define SRV_DEFAULT_HEADER_TIMEOUT_MSEC 10000
+#define SRV_DEFAULT_KEEP_ALIVE_TIMEOUT_MSEC 5000
+#define SRV_DEFAULT_MAX_KEEP_ALIVE_REQUESTS 100
+#define SRV_DEFAULT_LOG_MAX_FILE_SIZE LT_MB(64)
+#define SRV_DEFAULT_LOG_ROTATE_COUNT 4
+#define SRV_DEFAULT_LOG_RING_SIZE 4096
+#define SRV_DEFAULT_FILE_CACHE_SIZE LT_MB(64)
+#define SRV_DEFAULT_FILE_CACHE_MAX_ENTRY_SIZE LT_MB(1)
+#define SRV_DEFAULT_TEMPLATE_REVALIDATE_MSEC 1000
+#define SRV_DEFAULT_PAGE_CACHE_SIZE LT_MB(16)
+#define SRV_DEFAULT_PAGE_CACHE_TTL_MSEC 60000
+#define SRV_DEFAULT_MARKDOWN_TEMPLATE "templates/markdown.tmpl"
+#define SRV_DEFAULT_HANDSHAKE_THREADS 4
+#define SRV_DEFAULT_HANDSHAKE_QUEUE_SIZE 256
+#define SRV_DEFAULT_HANDSHAKE_TIMEOUT_MSEC 5000
+
+// maximum time a worker waits on a socket that stopped delivering/accepting data mid-message
+#define SRV_IO_TIMEOUT_MSEC 5000
+#define SRV_STREAM_CHUNK_SIZE LT_KB(16)
+#define SRV_RECV_BUFFER_SIZE LT_KB(16)
+#define SRV_SEND_BUFFER_SIZE LT_KB(32)
+#define SRV_IOV_BUFFER_SIZE LT_KB(1)
+#define SRV_IOV_STREAM_THRESHOLD LT_KB(64) // uncached template output past this size is streamed
 
 typedef
 struct variable {
+	variable_t* next;
 	lstr_t key;
 	lstr_t val;
 } variable_t;
@@ -111,9 +411,16 @@ void srv_set_var(connection_t* conn, lstr_t key, lstr_t val);
 void srv_set_var_moved(connection_t* conn, lstr_t key, lstr_t val);
 lstr_t* srv_get_var(connection_t* conn, lstr_t key);
 
+void srv_log_error(connection_t* conn, lstr_t msg, lstr_t subject, lt_err_t err);
+
 void srv_start(server_t* server);
 void srv_stop(server_t* server);
 
+void srv_get_stats(server_t* server, srv_stats_t out_stats[static 1]);
+
+void srv_purge_pages(server_t* server, lstr_t route);
+void srv_purge_all_pages(server_t* server);
+
 b8 srv_handle_mapped_request(server_t* server, connection_t* conn);
 
 void srv_handle_dir_mapping(connection_t* conn, lstr_t route, lstr_t target, lstr_t mime_type_override);
@@ -121,9 +428,67 @@ void srv_handle_dir_mapping(connection_t* conn, lstr_t route, lstr_t target, lst
 void srv_map_(server_t* server, route_mapping_t mapping);
 
 #define srv_map(server, route_, target_, args...) srv_map_((server), (route_mapping_t){ .route = CLSTR(route_), .target = CLSTR(target_), args })
+#define srv_route(server, route_, handler_, args...) srv_map_((server), (route_mapping_t){ .type = RMAP_HANDLER, .route = CLSTR(route_), .handler = (handler_), args })
 
 void srv_map_file(server_t* server, lstr_t route, lstr_t target);
 void srv_map_dir(server_t* server, lstr_t route, lstr_t target);
 void srv_map_page(server_t* server, lstr_t route, lstr_t target);
 
+// mdpage.c
+
+lt_err_t srv_respond_markdown(connection_t* conn, lstr_t path, lstr_t link_base, lstr_t template);
+void srv_handle_markdown_mapping(connection_t* conn, route_mapping_t* m);
+
+// response.c
+
+typedef
+enum request_status {
+	REQUEST_NONE = 0,  // nothing received since the last request
+	REQUEST_PARTIAL,   // the start of a request was received, waiting for the rest
+	REQUEST_READY,     // a complete request can be parsed
+	REQUEST_TOO_LARGE, // the request head does not fit into the receive buffer
+	REQUEST_CLOSED,    // the client closed the connection or the read failed
+} request_status_t;
+
+isz conn_recv(connection_t* conn, void* data, usz size);
+isz conn_send(connection_t* conn, const void* data, usz size);
+isz conn_recv_buffered(connection_t* conn, void* data, usz size);
+request_status_t conn_recv_request(connection_t* conn);
+request_status_t conn_buffered_request(connection_t* conn);
+b8 conn_flush(connection_t* conn);
+void conn_free_buffers(connection_t* conn);
+
+void srv_respond_file(connection_t* conn, int fd, u64 offset, u64 size);
+void srv_respond_cached(connection_t* conn, file_cache_entry_t* entry);
+void srv_respond_page(connection_t* conn, page_cache_entry_t* entry);
+void srv_release_body(connection_t* conn);
+
+b8 srv_respond_iov(connection_t* conn);
+void srv_iov_ref(connection_t* conn, const void* data, usz len);
+isz srv_iov_write(connection_t* conn, const void* data, usz len);
+void srv_iov_hold(connection_t* conn, compiled_template_t* compiled);
+
+b8 srv_stream_begin(connection_t* conn, response_stream_t stream[static 1]);
+isz srv_stream_write(response_stream_t stream[static 1], const void* data, usz len);
+lt_err_t srv_stream_end(response_stream_t stream[static 1]);
+
+lt_err_t srv_send_response(connection_t* conn);
+
+// conditional.c
+
+void srv_set_validators(connection_t* conn, lstr_t etag, i64 mtime_sec);
+b8 srv_not_modified(connection_t* conn, lstr_t etag, i64 mtime_sec);
+b8 srv_etag_template(connection_t* conn, lstr_t template_path);
+b8 srv_parse_http_date(lstr_t str, i64 out_sec[static 1]);
+
+// range.c
+
+#define SRV_MAX_RANGES 16
+
+void srv_apply_range(connection_t* conn, lstr_t etag, i64 mtime_sec);
+
+// static.c
+
+lt_err_t srv_respond_static(connection_t* conn, lstr_t path);
+
 #endif
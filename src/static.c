@@ -0,0 +1,264 @@
+#include <lt/io.h>
+#include <lt/str.h>
+#include <lt/ctype.h>
+
+#include "server.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+typedef
+struct static_file {
+	lstr_t path;
+	u64 generation;
+	file_cache_entry_t* entry;
+	int fd;
+	u64 size;
+	u64 inode;
+	u64 mtime_nsec;
+} static_file_t;
+
+static
+lt_err_t open_file(lstr_t path, static_file_t out_file[static 1]) {
+	char cpath[LT_PATH_MAX];
+	if (path.len >= sizeof(cpath)) {
+		return LT_ERR_OVERFLOW;
+	}
+	memcpy(cpath, path.str, path.len);
+	cpath[path.len] = 0;
+
+	// symbolic links are never followed
+	int fd = open(cpath, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+	if (fd < 0) {
+		if (errno == ENOENT || errno == ENOTDIR || errno == ELOOP) {
+			return LT_ERR_NOT_FOUND;
+		}
+		return lt_errno();
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		lt_err_t err = lt_errno();
+		close(fd);
+		return err;
+	}
+	if (!S_ISREG(st.st_mode)) {
+		close(fd);
+		return LT_ERR_NOT_FOUND;
+	}
+
+	*out_file = (static_file_t) {
+			.path = path,
+			.entry = NULL,
+			.fd = fd,
+			.size = st.st_size,
+			.inode = st.st_ino,
+			.mtime_nsec = (u64)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec };
+	return LT_SUCCESS;
+}
+
+static
+lt_err_t static_open(server_t server[static 1], lstr_t path, static_file_t out_file[static 1]) {
+	lt_err_t err;
+
+	if (!server->file_cache_active) {
+		return open_file(path, out_file);
+	}
+
+	file_cache_t* cache = &server->file_cache;
+
+	file_cache_entry_t* entry = file_cache_get(cache, path);
+	if (entry) {
+		if (entry->missing) {
+			file_cache_release(cache, entry);
+			return LT_ERR_NOT_FOUND;
+		}
+
+		*out_file = (static_file_t) {
+				.path = path,
+				.entry = entry,
+				.fd = -1,
+				.size = entry->data.len,
+				.inode = entry->inode,
+				.mtime_nsec = entry->mtime_nsec };
+		return LT_SUCCESS;
+	}
+
+	u64 generation = file_cache_generation(cache);
+	if ((err = open_file(path, out_file))) {
+		// remembering misses saves an open() for every request of a sidecar that does not exist
+		if (err == LT_ERR_NOT_FOUND) {
+			file_cache_mark_missing(cache, path, generation);
+		}
+		return err;
+	}
+
+	// the file is only loaded into the cache once its contents are actually needed
+	out_file->generation = generation;
+	return LT_SUCCESS;
+}
+
+static
+void static_close(server_t server[static 1], static_file_t file[static 1]) {
+	if (file->entry) {
+		file_cache_release(&server->file_cache, file->entry);
+	}
+	else {
+		close(file->fd);
+	}
+}
+
+// hands the file over to the response, which closes it once it is sent
+static
+void static_respond(connection_t* conn, static_file_t file[static 1]) {
+	server_t* server = conn->server;
+
+	if (!file->entry && server->file_cache_active) {
+		// files that are too large for the cache keep using the sendfile path
+		file->entry = file_cache_load(&server->file_cache, file->path, file->fd, file->generation);
+		if (file->entry) {
+			close(file->fd);
+			file->fd = -1;
+		}
+	}
+
+	if (file->entry) {
+		srv_respond_cached(conn, file->entry);
+	}
+	else {
+		srv_respond_file(conn, file->fd, 0, file->size);
+	}
+}
+
+#define ENCODING_GZIP 1
+#define ENCODING_BR 2
+
+typedef
+struct content_encoding {
+	u8 flag;
+	lstr_t name;
+	lstr_t suffix;
+} content_encoding_t;
+
+// in order of preference
+static const content_encoding_t encodings[] = {
+	{ ENCODING_BR, CLSTR("br"), CLSTR(".br") },
+	{ ENCODING_GZIP, CLSTR("gzip"), CLSTR(".gz") },
+};
+
+static
+b8 qvalue_is_zero(lstr_t params) {
+	for (char* it = params.str, *end = it + params.len; it < end; ++it) {
+		if (*it != 'q' && *it != 'Q') {
+			continue;
+		}
+		++it;
+		while (it < end && lt_is_space(*it)) {
+			++it;
+		}
+		if (it >= end || *it++ != '=') {
+			continue;
+		}
+		while (it < end && lt_is_space(*it)) {
+			++it;
+		}
+		// anything but '0', '0.', '0.0', '0.00' and '0.000' is a nonzero weight
+		if (it >= end || *it++ != '0') {
+			return 0;
+		}
+		if (it < end && *it == '.') {
+			++it;
+		}
+		while (it < end && *it == '0') {
+			++it;
+		}
+		return it >= end || *it == ',' || *it == ';' || lt_is_space(*it);
+	}
+	return 0;
+}
+
+static
+u8 accepted_encodings(connection_t* conn) {
+	lstr_t* header = lt_http_find_header(&conn->request, CLSTR("Accept-Encoding"));
+	if (!header) {
+		return 0;
+	}
+
+	u8 accepted = 0;
+	for (char* it = header->str, *end = it + header->len; it < end;) {
+		char* start = it;
+		while (it < end && *it != ',') {
+			++it;
+		}
+		lstr_t coding = lt_lstrim(lt_lsfrom_range(start, it++));
+
+		lstr_t name = lt_lstrim(lt_lssplit(coding, ';'));
+		if (qvalue_is_zero(LSTR(coding.str + name.len, coding.len - name.len))) {
+			continue;
+		}
+
+		if (lt_lseq(name, CLSTR("*"))) {
+			accepted |= ENCODING_GZIP | ENCODING_BR;
+			continue;
+		}
+		for (usz i = 0; i < sizeof(encodings) / sizeof(*encodings); ++i) {
+			if (lt_lseq_nocase(name, encodings[i].name)) {
+				accepted |= encodings[i].flag;
+			}
+		}
+	}
+	return accepted;
+}
+
+// serves a file below a mapping target, preferring precompressed '.br'/'.gz' sidecars when the client
+// accepts them and they are at least as new as the original
+lt_err_t srv_respond_static(connection_t* conn, lstr_t path) {
+	lt_err_t err;
+	server_t* server = conn->server;
+
+	static_file_t file;
+	if ((err = static_open(server, path, &file))) {
+		return err;
+	}
+
+	lt_http_add_header(&conn->response, CLSTR("Vary"), CLSTR("Accept-Encoding"));
+
+	u8 accepted = accepted_encodings(conn);
+	for (usz i = 0; accepted && i < sizeof(encodings) / sizeof(*encodings); ++i) {
+		const content_encoding_t* enc = &encodings[i];
+		if (!(accepted & enc->flag)) {
+			continue;
+		}
+
+		static_file_t sidecar;
+		lstr_t sidecar_path = lt_lsbuild(&conn->arena->interf, "%S%S", path, enc->suffix);
+		if (static_open(server, sidecar_path, &sidecar)) {
+			continue;
+		}
+		if (sidecar.mtime_nsec < file.mtime_nsec) {
+			static_close(server, &sidecar);
+			continue;
+		}
+
+		static_close(server, &file);
+		file = sidecar;
+		lt_http_add_header(&conn->response, CLSTR("Content-Encoding"), enc->name);
+		break;
+	}
+
+	// every sidecar has its own inode, so each encoding gets a distinct strong ETag
+	lstr_t etag = lt_lsbuild(&conn->arena->interf, "\"%hq-%hq-%hq\"", file.inode, file.size, file.mtime_nsec);
+	i64 mtime_sec = file.mtime_nsec / 1000000000;
+	srv_set_validators(conn, etag, mtime_sec);
+
+	if (srv_not_modified(conn, etag, mtime_sec)) {
+		static_close(server, &file);
+		return LT_SUCCESS;
+	}
+
+	static_respond(conn, &file);
+	srv_apply_range(conn, etag, mtime_sec);
+	return LT_SUCCESS;
+}
@@ -1,279 +1,303 @@
 #include <lt/strstream.h>
 #include <lt/mem.h>
-#include <lt/ctype.h>
-#include <lt/elf.h>
 #include <lt/str.h>
 #include <lt/io.h>
-#include <lt/debug.h>
-#include <lt/html.h>
 
 #include "server.h"
 #include "template.h"
+#include "htmlescape.h"
 
-static
-void skip_space(char** it, char* end) {
-	while (*it < end && lt_is_space(**it)) {
-		++*it;
-	}
-}
+#include <sys/stat.h>
+#include <errno.h>
 
-static
-lstr_t consume_name(char** it, char* end) {
-	char* start = *it;
-	while (*it < end && (lt_is_ident_body(**it) || **it == '-')) {
-		++*it;
-	}
-	return lt_lsfrom_range(start, *it);
-}
+#define CACHE_BUCKET_COUNT 256
+
+extern const compiled_entry_t __start_compiled_templates[] __attribute__((weak));
+extern const compiled_entry_t __stop_compiled_templates[] __attribute__((weak));
 
 static
-lstr_t consume_identifier(char** it, char* end) {
-	char* start = *it;
-	while (*it < end && lt_is_ident_body(**it)) {
-		++*it;
+lstr_t strip_dot_slash(lstr_t path) {
+	while (path.len >= 2 && path.str[0] == '.' && path.str[1] == '/') {
+		path.str += 2;
+		path.len -= 2;
 	}
-	return lt_lsfrom_range(start, *it);
+	return path;
 }
 
-static
-lstr_t consume_attrib_val(char** it, char* end) {
-	if (*it >= end) {
-		lt_werrf("unexpected end-of-file\n");
-		return NLSTR();
-	}
-	if (**it != '"') {
-		lt_werrf("expected quotes around attribute value\n");
-		return NLSTR();
+// returns the ahead-of-time compiled version of a template file, if it was built with one. the compiled
+// version always takes precedence over the file on disk, unless server->no_compiled_templates is set.
+const compiled_entry_t* template_find_compiled(connection_t* conn, lstr_t path) {
+	if (conn->server->no_compiled_templates) {
+		return NULL;
 	}
 
-	char* start = ++*it;
-	while (*it < end && **it != '"') {
-		++*it;
+	path = strip_dot_slash(path);
+	for (const compiled_entry_t* it = __start_compiled_templates; it < __stop_compiled_templates; ++it) {
+		if (lt_lseq(it->path, path)) {
+			return it;
+		}
 	}
-	return lt_lsfrom_range(start, (*it)++);
+	return NULL;
 }
 
-static
-lstr_t consume_string(char** it, char* end) {
-	if (*it >= end) {
-		lt_werrf("unexpected end-of-file\n");
-		return NLSTR();
+// for data that lives as long as the program, which scatter list responses can reference without a hold
+void template_write_static(lt_write_fn_t callb, void* usr, connection_t* conn, const void* data, usz len) {
+	if (callb == (lt_write_fn_t)srv_iov_write && usr == conn) {
+		srv_iov_ref(conn, data, len);
 	}
-	if (**it != '"') {
-		lt_werrf("expected quotes around string value\n");
-		return NLSTR();
+	else {
+		callb(usr, data, len);
 	}
+}
 
-	char* start = ++*it;
-	while (*it < end && **it != '"') {
-		++*it;
+// writes a template made by template_from_text and releases it. scatter list responses reference
+// the text and hold the template until they are sent instead.
+void template_write_text(lt_write_fn_t callb, void* usr, connection_t* conn, compiled_template_t* text) {
+	lstr_t str = text->ops[0].str;
+	if (callb == (lt_write_fn_t)srv_iov_write && usr == conn) {
+		srv_iov_ref(conn, str.str, str.len);
+		srv_iov_hold(conn, text);
+		return;
 	}
-	return lt_lsfrom_range(start, (*it)++);
+	callb(usr, str.str, str.len);
+	template_cache_release(text);
 }
 
+typedef struct include_frame include_frame_t;
+
+typedef
+struct include_frame {
+	const include_frame_t* parent;
+	const compiled_template_t* compiled;
+	usz depth;
+	b8 by_ref; // static text is referenced in the response scatter list instead of written
+} include_frame_t;
+
+static
+void exec_ops(lt_write_fn_t callb, void* usr, const include_frame_t frame[static 1], connection_t* conn);
+
 static
-void consume_and_write_text(lt_write_fn_t callb, void* usr, char** it, char* end) {
-	if (*it >= end) {
-		lt_werrf("unexpected end-of-file\n");
+void exec_include(lt_write_fn_t callb, void* usr, const include_frame_t parent[static 1], lstr_t path, connection_t* conn) {
+	if (parent->depth >= TEMPLATE_MAX_INCLUDE_DEPTH) {
+		srv_log_error(conn, CLSTR("include depth limit reached at"), path, LT_SUCCESS);
 		return;
 	}
-	if (**it != '[') {
-		lt_werrf("expected '[' around text body\n");
+
+	compiled_template_t* compiled = template_cache_get(conn, path);
+	if (!compiled) {
 		return;
 	}
-	++*it;
 
-	while (*it < end && **it != ']') {
-		char c = *(*it)++;
-		if (c == '\n') {
-			lt_writes(callb, usr, "<br>");
+	for (const include_frame_t* it = parent; it; it = it->parent) {
+		const compiled_template_t* ancestor = it->compiled;
+		if (ancestor->hash == compiled->hash && lt_lseq(ancestor->path, compiled->path)) {
+			srv_log_error(conn, CLSTR("include cycle skipped at"), path, LT_SUCCESS);
+			goto done;
 		}
-		else if (c == '\t') {
-			while (*it < end && **it == '\t') {
-				++*it;
+	}
+
+	include_frame_t frame = { .parent = parent, .compiled = compiled, .depth = parent->depth + 1, .by_ref = parent->by_ref };
+	exec_ops(callb, usr, &frame, conn);
+
+	if (frame.by_ref) {
+		srv_iov_hold(conn, compiled);
+		return;
+	}
+done:
+	template_cache_release(compiled);
+}
+
+static
+void exec_ops(lt_write_fn_t callb, void* usr, const include_frame_t frame[static 1], connection_t* conn) {
+	const compiled_template_t* compiled = frame->compiled;
+
+	for (const template_op_t* op = compiled->ops, *end = op + compiled->op_count; op < end; ++op) {
+		switch (op->type) {
+		case TMPL_OP_TEXT:
+			if (frame->by_ref) {
+				srv_iov_ref(conn, op->str.str, op->str.len);
 			}
-			if (*it >= end || lt_is_space(**it)) {
-				lt_writes(callb, usr, " ");
+			else {
+				callb(usr, op->str.str, op->str.len);
 			}
-		}
-		else {
-			lt_write_htmlencoded_char8(callb, usr, c);
+			break;
+
+		case TMPL_OP_READ: {
+			lstr_t* val = srv_get_var(conn, op->str);
+			html_write_escaped(callb, usr, val ? *val : op->def);
+		}	break;
+
+		case TMPL_OP_PARAM: {
+			lstr_t* val = uri_find_param(&conn->uri, op->str);
+			html_write_escaped(callb, usr, val ? *val : op->def);
+		}	break;
+
+		case TMPL_OP_CALL:
+			op->fn(callb, usr, conn);
+			break;
+
+		case TMPL_OP_INCLUDE:
+			exec_include(callb, usr, frame, op->str, conn);
+			break;
 		}
 	}
-	++*it;
 }
 
-isz template_render(lt_write_fn_t callb, void* usr, lstr_t template, connection_t* conn) {
-	for (char* it = template.str, *end = it + template.len; it < end;) {
-		skip_space(&it, end);
-		if (it >= end) {
-			return it - template.str;
-		}
+void template_exec(lt_write_fn_t callb, void* usr, const compiled_template_t compiled[static 1], connection_t* conn) {
+	include_frame_t frame = { .parent = NULL, .compiled = compiled, .depth = 0 };
+	exec_ops(callb, usr, &frame, conn);
+}
 
-		if (*it == '[') {
-			consume_and_write_text(callb, usr, &it, end);
-			continue;
-		}
-		else if (*it == '}') {
-			return it - template.str;
-		}
-		else if (!lt_is_ident_body(*it)) {
-			lt_werrf("unexpected character '%c'\n", *it);
-			return -LT_ERR_INVALID_SYNTAX;
-		}
+lt_err_t template_cache_create(template_cache_t out_cache[static 1], u64 revalidate_msec) {
+	lt_mzero(out_cache, sizeof(*out_cache));
+	out_cache->revalidate_msec = revalidate_msec;
 
-		lstr_t elem_name = consume_name(&it, end);
+	out_cache->buckets = lt_malloc(lt_libc_heap, CACHE_BUCKET_COUNT * sizeof(compiled_template_t*));
+	if (!out_cache->buckets) {
+		return LT_ERR_OUT_OF_MEMORY;
+	}
+	lt_mzero(out_cache->buckets, CACHE_BUCKET_COUNT * sizeof(compiled_template_t*));
+	out_cache->bucket_mask = CACHE_BUCKET_COUNT - 1;
 
-		if (lt_lseq(elem_name, CLSTR("call"))) {
-			skip_space(&it, end);
-			lstr_t name = consume_identifier(&it, end);
-			skip_space(&it, end);
-			if (it >= end || *it++ != ';') {
-				lt_werrf("expected ';' after stream name\n");
-				return -LT_ERR_INVALID_SYNTAX;
-			}
+	pthread_rwlock_init(&out_cache->lock, NULL);
+	return LT_SUCCESS;
+}
 
-			lstr_t symname = lt_lsbuild(lt_libc_heap, "__template_stream_%S", name);
-			lt_elf64_sym_t* sym = lt_elf64_sym_by_name(lt_debug_executable, symname);
-			if (!sym) {
-				lt_werrf("unknown stream function '%S'\n", name);
-				return -LT_ERR_INVALID_SYNTAX;
-			}
-			else {
-				usz sym_addr = (usz)sym->value + lt_debug_load_addr;
-				((stream_fn_t)sym_addr)(callb, usr, conn);
-			}
-			lt_mfree(lt_libc_heap, symname.str);
-			continue;
+void template_cache_destroy(template_cache_t cache[static 1]) {
+	for (usz i = 0; i <= cache->bucket_mask; ++i) {
+		for (compiled_template_t* it = cache->buckets[i], *next; it; it = next) {
+			next = it->next;
+			template_cache_release(it);
 		}
-		else if (lt_lseq(elem_name, CLSTR("include"))) {
-			skip_space(&it, end);
-			lstr_t path = consume_string(&it, end);
-			skip_space(&it, end);
-			if (it >= end || *it++ != ';') {
-				lt_werrf("expected ';' after include path\n");
-				return -LT_ERR_INVALID_SYNTAX;
-			}
+	}
+	lt_mfree(lt_libc_heap, cache->buckets);
+	pthread_rwlock_destroy(&cache->lock);
+}
 
-			lstr_t subtemplate;
-			if (lt_freadallp_utf8(path, &subtemplate, lt_libc_heap)) {
-				lt_werrf("failed to include template file '%S'\n", path);
-				continue;
-			}
+void template_cache_release(compiled_template_t* compiled) {
+	if (__atomic_sub_fetch(&compiled->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+		template_destroy(compiled);
+	}
+}
 
-			template_render(callb, usr, subtemplate, conn);
-			lt_mfree(lt_libc_heap, subtemplate.str);
-			continue;
-		}
-		else if (lt_lseq(elem_name, CLSTR("write"))) {
-			skip_space(&it, end);
-			lstr_t text = consume_string(&it, end);
-			skip_space(&it, end);
-			if (it >= end || *it++ != ';') {
-				lt_werrf("expected ';' after write argument\n");
-				return -LT_ERR_INVALID_SYNTAX;
-			}
-			lt_writels(callb, usr, text);
-			continue;
-		}
-		else if (lt_lseq(elem_name, CLSTR("read"))) {
-			skip_space(&it, end);
-			lstr_t name = consume_string(&it, end);
-			skip_space(&it, end);
-			lstr_t def = NLSTR();
-			if (it < end && *it == ',') {
-				++it;
-				skip_space(&it, end);
-				def = consume_string(&it, end);
-				skip_space(&it, end);
-			}
-			if (it >= end || *it++ != ';') {
-				lt_werrf("expected ';' after read key\n");
-				return -LT_ERR_INVALID_SYNTAX;
-			}
-			lstr_t* val = srv_get_var(conn, name);
-			lt_write_htmlencoded(callb, usr, val ? *val : def);
-			continue;
-		}
-		else if (lt_lseq(elem_name, CLSTR("param"))) {
-			skip_space(&it, end);
-			lstr_t name = consume_string(&it, end);
-			skip_space(&it, end);
-			lstr_t def = NLSTR();
-			if (it < end && *it == ',') {
-				++it;
-				skip_space(&it, end);
-				def = consume_string(&it, end);
-				skip_space(&it, end);
-			}
-			if (it >= end || *it++ != ';') {
-				lt_werrf("expected ';' after param name\n");
-				return -LT_ERR_INVALID_SYNTAX;
-			}
-			lstr_t* val = uri_find_param(&conn->uri, name);
-			lt_write_htmlencoded(callb, usr, val ? *val : def);
-			continue;
-		}
+static
+compiled_template_t** find_compiled(template_cache_t cache[static 1], u32 hash, lstr_t path) {
+	compiled_template_t** it = &cache->buckets[hash & cache->bucket_mask];
+	while (*it && ((*it)->hash != hash || !lt_lseq((*it)->path, path))) {
+		it = &(*it)->next;
+	}
+	return it;
+}
 
-		lt_io_printf(callb, usr, "<%S", elem_name);
+// looks up key, loading path through load if it is not cached or changed on disk since. the
+// returned reference has to be released with template_cache_release.
+// returns LT_ERR_NOT_FOUND without logging anything if path does not exist.
+lt_err_t template_cache_load(template_cache_t cache[static 1], lstr_t key, lstr_t path, template_load_fn_t load, void* usr, compiled_template_t* out[static 1]) {
+	u32 hash = lt_hashls(key);
+	u64 now_msec = timer_now_msec();
 
-		skip_space(&it, end);
-		while (it < end && lt_is_ident_body(*it)) {
-			lstr_t attrib = consume_name(&it, end);
-			skip_space(&it, end);
+	// recently validated entries are returned without touching the filesystem
+	pthread_rwlock_rdlock(&cache->lock);
+	compiled_template_t* compiled = *find_compiled(cache, hash, key);
+	if (compiled && now_msec - __atomic_load_n(&compiled->validated_msec, __ATOMIC_RELAXED) < cache->revalidate_msec) {
+		__atomic_add_fetch(&compiled->refs, 1, __ATOMIC_RELAXED);
+		pthread_rwlock_unlock(&cache->lock);
+		__atomic_add_fetch(&cache->hits, 1, __ATOMIC_RELAXED);
+		*out = compiled;
+		return LT_SUCCESS;
+	}
+	pthread_rwlock_unlock(&cache->lock);
 
-			lt_io_printf(callb, usr, " %S", attrib);
+	char cpath[LT_PATH_MAX];
+	if (path.len >= sizeof(cpath)) {
+		return LT_ERR_NOT_FOUND;
+	}
+	memcpy(cpath, path.str, path.len);
+	cpath[path.len] = 0;
 
-			if (it >= end) {
-				lt_werrf("unexpected end-of-file\n");
-				return -LT_ERR_INVALID_SYNTAX;
-			}
-			if (*it != '=') {
-				continue;
-			}
-			++it;
-			skip_space(&it, end);
+	struct stat st;
+	if (stat(cpath, &st) < 0) {
+		return errno == ENOENT || errno == ENOTDIR ? LT_ERR_NOT_FOUND : LT_ERR_UNKNOWN;
+	}
+	if (!S_ISREG(st.st_mode)) {
+		return LT_ERR_NOT_FOUND;
+	}
+	u64 mtime_nsec = (u64)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
 
-			lstr_t val = consume_attrib_val(&it, end);
-			skip_space(&it, end);
+	pthread_rwlock_rdlock(&cache->lock);
+	compiled = *find_compiled(cache, hash, key);
+	if (compiled && compiled->mtime_nsec == mtime_nsec && compiled->size == (u64)st.st_size && compiled->inode == (u64)st.st_ino) {
+		__atomic_store_n(&compiled->validated_msec, now_msec, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&compiled->refs, 1, __ATOMIC_RELAXED);
+		pthread_rwlock_unlock(&cache->lock);
+		__atomic_add_fetch(&cache->hits, 1, __ATOMIC_RELAXED);
+		*out = compiled;
+		return LT_SUCCESS;
+	}
+	pthread_rwlock_unlock(&cache->lock);
+	__atomic_add_fetch(&cache->misses, 1, __ATOMIC_RELAXED);
 
-			lt_writes(callb, usr, "=\"");
-			lt_write_htmlencoded(callb, usr, val);
-			lt_writes(callb, usr, "\"");
-		}
+	lt_err_t err;
+	lstr_t source;
+	if ((err = lt_freadallp_utf8(path, &source, lt_libc_heap))) {
+		return err;
+	}
+	compiled = load(source, usr);
+	lt_mfree(lt_libc_heap, source.str);
+	if (!compiled) {
+		return LT_ERR_INVALID_SYNTAX;
+	}
 
-		if (it >= end) {
-			lt_werrf("unexpected end-of-file\n");
-			return -LT_ERR_INVALID_SYNTAX;
-		}
+	compiled->path = lt_strdup(lt_libc_heap, key);
+	compiled->hash = hash;
+	compiled->inode = st.st_ino;
+	compiled->size = st.st_size;
+	compiled->mtime_nsec = mtime_nsec;
+	compiled->validated_msec = now_msec;
+	compiled->refs = 2; // one for the cache, one for the caller
 
-		lt_writes(callb, usr, ">");
+	// if another thread loaded the same file in the meantime, the later one replaces it
+	pthread_rwlock_wrlock(&cache->lock);
+	compiled_template_t** slot = find_compiled(cache, hash, key);
+	compiled_template_t* old = *slot;
+	if (old) {
+		*slot = old->next;
+	}
+	compiled->next = cache->buckets[hash & cache->bucket_mask];
+	cache->buckets[hash & cache->bucket_mask] = compiled;
+	pthread_rwlock_unlock(&cache->lock);
 
-		char c = *it;
-		if (c == ';') {
-			if (!lt_lseq(elem_name, CLSTR("link")) && !lt_lseq(elem_name, CLSTR("br")) && !lt_lseq(elem_name, CLSTR("meta")) && !lt_lseq(elem_name, CLSTR("input"))) {
-				lt_io_printf(callb, usr, "</%S>", elem_name);
-			}
-			++it;
-			continue;
-		}
-		else if (c == '{') {
-			++it;
-			it += template_render(callb, usr, lt_lsfrom_range(it, end), conn);
-			skip_space(&it, end);
-			if (it >= end || *it != '}') {
-				lt_werrf("expected '}' after element body\n", *it);
-				return -LT_ERR_INVALID_SYNTAX;
-			}
-			++it;
-			lt_io_printf(callb, usr, "</%S>", elem_name);
-		}
-		else if (c == '[') {
-			consume_and_write_text(callb, usr, &it, end);
-			lt_io_printf(callb, usr, "</%S>", elem_name);
-		}
+	if (old) {
+		template_cache_release(old);
 	}
+	*out = compiled;
+	return LT_SUCCESS;
+}
 
+static
+compiled_template_t* load_template(lstr_t source, void* usr) {
+	return template_compile(source, 1);
+}
+
+// returns a reference that has to be released with template_cache_release, or NULL if the file
+// can not be read, which is logged for conn.
+compiled_template_t* template_cache_get(connection_t* conn, lstr_t path) {
+	lt_err_t err;
+	compiled_template_t* compiled;
+	if ((err = template_cache_load(&conn->server->template_cache, path, path, load_template, NULL, &compiled))) {
+		srv_log_error(conn, CLSTR("failed to load template file"), path, err);
+		return NULL;
+	}
+	return compiled;
+}
+
+isz template_render(lt_write_fn_t callb, void* usr, lstr_t template, connection_t* conn) {
+	compiled_template_t* compiled = template_compile(template, 1);
+	if (!compiled) {
+		return -LT_ERR_OUT_OF_MEMORY;
+	}
+	template_exec(callb, usr, compiled, conn);
+	template_destroy(compiled);
 	return template.len;
 }
 
@@ -284,3 +308,53 @@ lstr_t template_render_str(lstr_t template, connection_t* conn) {
 	return ss.str;
 }
 
+
+lt_err_t template_render_file(lt_write_fn_t callb, void* usr, lstr_t path, connection_t* conn) {
+	const compiled_entry_t* aot = template_find_compiled(conn, path);
+	if (aot) {
+		aot->fn(callb, usr, conn);
+		return LT_SUCCESS;
+	}
+
+	compiled_template_t* compiled = template_cache_get(conn, path);
+	if (!compiled) {
+		return LT_ERR_NOT_FOUND;
+	}
+	template_exec(callb, usr, compiled, conn);
+	template_cache_release(compiled);
+	return LT_SUCCESS;
+}
+
+lstr_t template_render_file_str(lstr_t path, connection_t* conn) {
+	lt_strstream_t ss;
+	LT_ASSERT(lt_strstream_create(&ss, &conn->arena->interf) == LT_SUCCESS);
+	template_render_file((lt_write_fn_t)lt_strstream_write, &ss, path, conn);
+	return ss.str;
+}
+
+// renders into a scatter list response body, see srv_respond_iov. output past stream_threshold bytes
+// is streamed instead of being collected, 0 collects everything that fits into arena memory.
+lt_err_t template_render_file_iov(lstr_t path, connection_t* conn, u64 stream_threshold) {
+	if (!srv_respond_iov(conn)) {
+		return LT_ERR_OUT_OF_MEMORY;
+	}
+	conn->response_iov->stream_threshold = stream_threshold;
+
+	const compiled_entry_t* aot = template_find_compiled(conn, path);
+	if (aot) {
+		aot->fn((lt_write_fn_t)srv_iov_write, conn, conn);
+		return LT_SUCCESS;
+	}
+
+	// the empty body is dropped again, so that the caller can respond with a 404 instead
+	compiled_template_t* compiled = template_cache_get(conn, path);
+	if (!compiled) {
+		srv_release_body(conn);
+		return LT_ERR_NOT_FOUND;
+	}
+
+	include_frame_t frame = { .parent = NULL, .compiled = compiled, .depth = 0, .by_ref = 1 };
+	exec_ops((lt_write_fn_t)srv_iov_write, conn, &frame, conn);
+	srv_iov_hold(conn, compiled);
+	return LT_SUCCESS;
+}
@@ -3,17 +3,134 @@
 
 #include <lt/io.h>
 
+#include <pthread.h>
+
 typedef struct connection connection_t;
 
 typedef void (*stream_fn_t)(lt_write_fn_t callb, void* usr, connection_t* conn);
 
-#define template_stream(name) void __template_stream_##name(lt_write_fn_t __callb, void* __usr, connection_t* conn)
+typedef
+struct stream_entry {
+	lstr_t name;
+	stream_fn_t fn;
+} stream_entry_t;
+
+// every stream function places an entry in the template_streams section, the linker provides
+// the bounds. this keeps 'call' working in stripped builds.
+#define template_stream(name_) \
+	void __template_stream_##name_(lt_write_fn_t __callb, void* __usr, connection_t* conn); \
+	__attribute__((used, section("template_streams"), aligned(sizeof(void*)))) \
+	static const stream_entry_t __template_stream_entry_##name_ = { \
+			.name = { .len = sizeof(#name_) - 1, .str = #name_ }, \
+			.fn = __template_stream_##name_ }; \
+	void __template_stream_##name_(lt_write_fn_t __callb, void* __usr, connection_t* conn)
+
+typedef
+struct compiled_entry {
+	lstr_t path;
+	stream_fn_t fn;
+	u64 hash; // of the template source and the sources of the compiled templates it includes
+} compiled_entry_t;
+
+// templates compiled ahead of time by tools/tmplc register themselves the same way, by path
+#define template_compiled(path_, hash_, name_) \
+	static void name_(lt_write_fn_t __callb, void* __usr, connection_t* conn); \
+	__attribute__((used, section("compiled_templates"), aligned(sizeof(void*)))) \
+	static const compiled_entry_t name_##_entry = { \
+			.path = { .len = sizeof(path_) - 1, .str = path_ }, \
+			.fn = name_, \
+			.hash = hash_ }; \
+	static void name_(lt_write_fn_t __callb, void* __usr, connection_t* conn)
+
 #define echo(...) lt_io_printf(__callb, __usr, __VA_ARGS__)
 
+typedef
+enum template_op_type {
+	TMPL_OP_TEXT,    // static output, str
+	TMPL_OP_READ,    // html-encoded server variable str, or def if it is not set
+	TMPL_OP_PARAM,   // html-encoded uri parameter str, or def if it is not set
+	TMPL_OP_CALL,    // stream function fn, named str
+	TMPL_OP_INCLUDE, // template file str
+} template_op_type_t;
+
+typedef
+struct template_op {
+	template_op_type_t type;
+	lstr_t str;
+	lstr_t def;
+	stream_fn_t fn;
+} template_op_t;
+
+typedef struct compiled_template compiled_template_t;
+
+// the result of parsing a template once. all static output, including tags and attributes,
+// is merged into as few TMPL_OP_TEXT runs as possible.
+typedef
+struct compiled_template {
+	compiled_template_t* next;
+	u32 hash;
+	volatile u32 refs;
+
+	lstr_t path;
+	u64 inode;
+	u64 size;
+	u64 mtime_nsec;
+	volatile u64 validated_msec; // last time the file was stat'ed
+
+	char* data; // static text runs, followed by the strings referenced by ops
+	template_op_t* ops;
+	usz op_count;
+	usz error_count; // diagnostics reported by template_compile, everything up to the first error is kept
+} compiled_template_t;
+
+#define TEMPLATE_MAX_INCLUDE_DEPTH 32
+
+// compiled templates by path, shared by all workers. a file is stat'ed at most once every
+// revalidate_msec, and recompiled when its mtime, size or inode changed.
+typedef
+struct template_cache {
+	pthread_rwlock_t lock;
+	compiled_template_t** buckets;
+	usz bucket_mask;
+
+	u64 revalidate_msec;
+
+	volatile usz hits;
+	volatile usz misses;
+} template_cache_t;
+
+// template_compile.c
+
+stream_fn_t template_find_stream(lstr_t name);
+
+compiled_template_t* template_compile(lstr_t template, b8 resolve_calls);
+compiled_template_t* template_from_text(lstr_t text);
+void template_destroy(compiled_template_t* compiled);
+
+// template.c
+
+const compiled_entry_t* template_find_compiled(connection_t* conn, lstr_t path);
+void template_write_static(lt_write_fn_t callb, void* usr, connection_t* conn, const void* data, usz len);
+void template_write_text(lt_write_fn_t callb, void* usr, connection_t* conn, compiled_template_t* text);
+
+void template_exec(lt_write_fn_t callb, void* usr, const compiled_template_t compiled[static 1], connection_t* conn);
+
+lt_err_t template_cache_create(template_cache_t out_cache[static 1], u64 revalidate_msec);
+void template_cache_destroy(template_cache_t cache[static 1]);
+typedef compiled_template_t* (*template_load_fn_t)(lstr_t source, void* usr);
+
+lt_err_t template_cache_load(template_cache_t cache[static 1], lstr_t key, lstr_t path, template_load_fn_t load, void* usr, compiled_template_t* out[static 1]);
+compiled_template_t* template_cache_get(connection_t* conn, lstr_t path);
+void template_cache_release(compiled_template_t* compiled);
+
 isz template_render(lt_write_fn_t callb, void* usr, lstr_t template, connection_t* conn);
 lstr_t template_render_str(lstr_t template, connection_t* conn);
 
-#define template_render_child(path) template_render(__callb, __usr, (path), conn);
+lt_err_t template_render_file(lt_write_fn_t callb, void* usr, lstr_t path, connection_t* conn);
+lstr_t template_render_file_str(lstr_t path, connection_t* conn);
+lt_err_t template_render_file_iov(lstr_t path, connection_t* conn, u64 stream_threshold);
+
+#define template_render_child(path) template_render_file(__callb, __usr, (path), conn);
 #define stream_invoke_child(name) __template_stream_##name(__callb, __usr, conn);
 
 #endif
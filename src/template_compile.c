@@ -0,0 +1,415 @@
+#include <lt/strstream.h>
+#include <lt/mem.h>
+#include <lt/ctype.h>
+#include <lt/str.h>
+#include <lt/io.h>
+#include <lt/html.h>
+#include <lt/darr.h>
+
+#include "template.h"
+
+// the template parser. it does not depend on the rest of the server, so that it can also be linked into
+// tools/tmplc for ahead-of-time compilation.
+
+extern const stream_entry_t __start_template_streams[] __attribute__((weak));
+extern const stream_entry_t __stop_template_streams[] __attribute__((weak));
+
+// only called while compiling, the resolved pointer is stored in the op
+stream_fn_t template_find_stream(lstr_t name) {
+	for (const stream_entry_t* it = __start_template_streams; it < __stop_template_streams; ++it) {
+		if (lt_lseq(it->name, name)) {
+			return it->fn;
+		}
+	}
+	return NULL;
+}
+
+typedef
+struct compiler {
+	lt_strstream_t text;
+	lt_darr(template_op_t) ops;
+	usz strings_size;
+	b8 resolve_calls;
+	usz error_count;
+} compiler_t;
+
+#define compile_error(cm, ...) ((cm)->error_count++, lt_werrf(__VA_ARGS__))
+
+// static output is appended to the text buffer and merged into the previous run if possible
+static
+isz emit_text(compiler_t* c, const void* data, usz len) {
+	if (!len) {
+		return 0;
+	}
+	lt_strstream_write(&c->text, data, len);
+
+	usz count = lt_darr_count(c->ops);
+	if (count && c->ops[count - 1].type == TMPL_OP_TEXT) {
+		c->ops[count - 1].str.len += len;
+	}
+	else {
+		lt_darr_push(c->ops, (template_op_t){ .type = TMPL_OP_TEXT, .str = LSTR(NULL, len) });
+	}
+	return len;
+}
+
+static
+void emit_op(compiler_t* c, template_op_type_t type, lstr_t str, lstr_t def, stream_fn_t fn) {
+	c->strings_size += str.len + def.len;
+	lt_darr_push(c->ops, (template_op_t){ .type = type, .str = str, .def = def, .fn = fn });
+}
+
+static
+void skip_space(char** it, char* end) {
+	while (*it < end && lt_is_space(**it)) {
+		++*it;
+	}
+}
+
+static
+lstr_t consume_name(char** it, char* end) {
+	char* start = *it;
+	while (*it < end && (lt_is_ident_body(**it) || **it == '-')) {
+		++*it;
+	}
+	return lt_lsfrom_range(start, *it);
+}
+
+static
+lstr_t consume_identifier(char** it, char* end) {
+	char* start = *it;
+	while (*it < end && lt_is_ident_body(**it)) {
+		++*it;
+	}
+	return lt_lsfrom_range(start, *it);
+}
+
+static
+lstr_t consume_attrib_val(compiler_t* cm, char** it, char* end) {
+	if (*it >= end) {
+		compile_error(cm, "unexpected end-of-file\n");
+		return NLSTR();
+	}
+	if (**it != '"') {
+		compile_error(cm, "expected quotes around attribute value\n");
+		return NLSTR();
+	}
+
+	char* start = ++*it;
+	while (*it < end && **it != '"') {
+		++*it;
+	}
+	return lt_lsfrom_range(start, (*it)++);
+}
+
+static
+lstr_t consume_string(compiler_t* cm, char** it, char* end) {
+	if (*it >= end) {
+		compile_error(cm, "unexpected end-of-file\n");
+		return NLSTR();
+	}
+	if (**it != '"') {
+		compile_error(cm, "expected quotes around string value\n");
+		return NLSTR();
+	}
+
+	char* start = ++*it;
+	while (*it < end && **it != '"') {
+		++*it;
+	}
+	return lt_lsfrom_range(start, (*it)++);
+}
+
+static
+void consume_and_write_text(compiler_t* cm, lt_write_fn_t callb, void* usr, char** it, char* end) {
+	if (*it >= end) {
+		compile_error(cm, "unexpected end-of-file\n");
+		return;
+	}
+	if (**it != '[') {
+		compile_error(cm, "expected '[' around text body\n");
+		return;
+	}
+	++*it;
+
+	while (*it < end && **it != ']') {
+		char c = *(*it)++;
+		if (c == '\n') {
+			lt_writes(callb, usr, "<br>");
+		}
+		else if (c == '\t') {
+			while (*it < end && **it == '\t') {
+				++*it;
+			}
+			if (*it >= end || lt_is_space(**it)) {
+				lt_writes(callb, usr, " ");
+			}
+		}
+		else {
+			lt_write_htmlencoded_char8(callb, usr, c);
+		}
+	}
+	++*it;
+}
+
+static
+isz compile_block(compiler_t* cm, lstr_t template) {
+	lt_write_fn_t callb = (lt_write_fn_t)emit_text;
+	void* usr = cm;
+
+	for (char* it = template.str, *end = it + template.len; it < end;) {
+		skip_space(&it, end);
+		if (it >= end) {
+			return it - template.str;
+		}
+
+		if (*it == '[') {
+			consume_and_write_text(cm, callb, usr, &it, end);
+			continue;
+		}
+		else if (*it == '}') {
+			return it - template.str;
+		}
+		else if (!lt_is_ident_body(*it)) {
+			compile_error(cm, "unexpected character '%c'\n", *it);
+			return -LT_ERR_INVALID_SYNTAX;
+		}
+
+		lstr_t elem_name = consume_name(&it, end);
+
+		if (lt_lseq(elem_name, CLSTR("call"))) {
+			skip_space(&it, end);
+			lstr_t name = consume_identifier(&it, end);
+			skip_space(&it, end);
+			if (it >= end || *it++ != ';') {
+				compile_error(cm, "expected ';' after stream name\n");
+				return -LT_ERR_INVALID_SYNTAX;
+			}
+
+			stream_fn_t fn = NULL;
+			if (cm->resolve_calls && !(fn = template_find_stream(name))) {
+				compile_error(cm, "unknown stream function '%S'\n", name);
+				return -LT_ERR_INVALID_SYNTAX;
+			}
+			emit_op(cm, TMPL_OP_CALL, name, NLSTR(), fn);
+			continue;
+		}
+		else if (lt_lseq(elem_name, CLSTR("include"))) {
+			skip_space(&it, end);
+			lstr_t path = consume_string(cm, &it, end);
+			skip_space(&it, end);
+			if (it >= end || *it++ != ';') {
+				compile_error(cm, "expected ';' after include path\n");
+				return -LT_ERR_INVALID_SYNTAX;
+			}
+
+			// resolved at render time, so that includes are recompiled independently of their parents
+			emit_op(cm, TMPL_OP_INCLUDE, path, NLSTR(), NULL);
+			continue;
+		}
+		else if (lt_lseq(elem_name, CLSTR("write"))) {
+			skip_space(&it, end);
+			lstr_t text = consume_string(cm, &it, end);
+			skip_space(&it, end);
+			if (it >= end || *it++ != ';') {
+				compile_error(cm, "expected ';' after write argument\n");
+				return -LT_ERR_INVALID_SYNTAX;
+			}
+			lt_writels(callb, usr, text);
+			continue;
+		}
+		else if (lt_lseq(elem_name, CLSTR("read"))) {
+			skip_space(&it, end);
+			lstr_t name = consume_string(cm, &it, end);
+			skip_space(&it, end);
+			lstr_t def = NLSTR();
+			if (it < end && *it == ',') {
+				++it;
+				skip_space(&it, end);
+				def = consume_string(cm, &it, end);
+				skip_space(&it, end);
+			}
+			if (it >= end || *it++ != ';') {
+				compile_error(cm, "expected ';' after read key\n");
+				return -LT_ERR_INVALID_SYNTAX;
+			}
+			emit_op(cm, TMPL_OP_READ, name, def, NULL);
+			continue;
+		}
+		else if (lt_lseq(elem_name, CLSTR("param"))) {
+			skip_space(&it, end);
+			lstr_t name = consume_string(cm, &it, end);
+			skip_space(&it, end);
+			lstr_t def = NLSTR();
+			if (it < end && *it == ',') {
+				++it;
+				skip_space(&it, end);
+				def = consume_string(cm, &it, end);
+				skip_space(&it, end);
+			}
+			if (it >= end || *it++ != ';') {
+				compile_error(cm, "expected ';' after param name\n");
+				return -LT_ERR_INVALID_SYNTAX;
+			}
+			emit_op(cm, TMPL_OP_PARAM, name, def, NULL);
+			continue;
+		}
+
+		lt_io_printf(callb, usr, "<%S", elem_name);
+
+		skip_space(&it, end);
+		while (it < end && lt_is_ident_body(*it)) {
+			lstr_t attrib = consume_name(&it, end);
+			skip_space(&it, end);
+
+			lt_io_printf(callb, usr, " %S", attrib);
+
+			if (it >= end) {
+				compile_error(cm, "unexpected end-of-file\n");
+				return -LT_ERR_INVALID_SYNTAX;
+			}
+			if (*it != '=') {
+				continue;
+			}
+			++it;
+			skip_space(&it, end);
+
+			lstr_t val = consume_attrib_val(cm, &it, end);
+			skip_space(&it, end);
+
+			lt_writes(callb, usr, "=\"");
+			lt_write_htmlencoded(callb, usr, val);
+			lt_writes(callb, usr, "\"");
+		}
+
+		if (it >= end) {
+			compile_error(cm, "unexpected end-of-file\n");
+			return -LT_ERR_INVALID_SYNTAX;
+		}
+
+		lt_writes(callb, usr, ">");
+
+		char c = *it;
+		if (c == ';') {
+			if (!lt_lseq(elem_name, CLSTR("link")) && !lt_lseq(elem_name, CLSTR("br")) && !lt_lseq(elem_name, CLSTR("meta")) && !lt_lseq(elem_name, CLSTR("input"))) {
+				lt_io_printf(callb, usr, "</%S>", elem_name);
+			}
+			++it;
+			continue;
+		}
+		else if (c == '{') {
+			++it;
+			isz len = compile_block(cm, lt_lsfrom_range(it, end));
+			if (len < 0) {
+				return len;
+			}
+			it += len;
+			skip_space(&it, end);
+			if (it >= end || *it != '}') {
+				compile_error(cm, "expected '}' after element body\n");
+				return -LT_ERR_INVALID_SYNTAX;
+			}
+			++it;
+			lt_io_printf(callb, usr, "</%S>", elem_name);
+		}
+		else if (c == '[') {
+			consume_and_write_text(cm, callb, usr, &it, end);
+			lt_io_printf(callb, usr, "</%S>", elem_name);
+		}
+	}
+
+	return template.len;
+}
+
+static
+lstr_t copy_string(char** it, lstr_t str) {
+	if (!str.str) {
+		return str;
+	}
+	memcpy(*it, str.str, str.len);
+	str.str = *it;
+	*it += str.len;
+	return str;
+}
+
+// compile errors are reported once here. like the interpreter this replaces, everything up to the
+// error is still rendered. without resolve_calls, call ops only carry the name of the stream function.
+compiled_template_t* template_compile(lstr_t template, b8 resolve_calls) {
+	compiler_t c = { .strings_size = 0, .resolve_calls = resolve_calls };
+	LT_ASSERT(lt_strstream_create(&c.text, lt_libc_heap) == LT_SUCCESS);
+	c.ops = lt_darr_create(template_op_t, 64, lt_libc_heap);
+	LT_ASSERT(c.ops != NULL);
+
+	compile_block(&c, template);
+
+	compiled_template_t* compiled = lt_malloc(lt_libc_heap, sizeof(compiled_template_t));
+	usz op_count = lt_darr_count(c.ops);
+	char* data = lt_malloc(lt_libc_heap, c.text.str.len + c.strings_size + 1);
+	template_op_t* ops = lt_malloc(lt_libc_heap, op_count * sizeof(template_op_t) + 1);
+	if (!compiled || !data || !ops) {
+		if (compiled) lt_mfree(lt_libc_heap, compiled);
+		if (data) lt_mfree(lt_libc_heap, data);
+		if (ops) lt_mfree(lt_libc_heap, ops);
+		compiled = NULL;
+		goto done;
+	}
+
+	memcpy(data, c.text.str.str, c.text.str.len);
+	char* text_it = data;
+	char* strings_it = data + c.text.str.len;
+
+	for (usz i = 0; i < op_count; ++i) {
+		template_op_t op = c.ops[i];
+		if (op.type == TMPL_OP_TEXT) {
+			// text runs are stored back to back, in order
+			op.str.str = text_it;
+			text_it += op.str.len;
+		}
+		else {
+			op.str = copy_string(&strings_it, op.str);
+			op.def = copy_string(&strings_it, op.def);
+		}
+		ops[i] = op;
+	}
+
+	*compiled = (compiled_template_t){
+			.data = data,
+			.ops = ops,
+			.op_count = op_count,
+			.error_count = c.error_count };
+
+done:
+	lt_darr_destroy(c.ops);
+	lt_strstream_destroy(&c.text);
+	return compiled;
+}
+
+// wraps text allocated from lt_libc_heap in a template made of a single text run, for output that is
+// shared between responses like a template is. takes ownership of text.
+compiled_template_t* template_from_text(lstr_t text) {
+	compiled_template_t* compiled = lt_malloc(lt_libc_heap, sizeof(compiled_template_t));
+	template_op_t* op = lt_malloc(lt_libc_heap, sizeof(template_op_t));
+	if (!compiled || !op) {
+		if (compiled) lt_mfree(lt_libc_heap, compiled);
+		if (op) lt_mfree(lt_libc_heap, op);
+		lt_mfree(lt_libc_heap, text.str);
+		return NULL;
+	}
+
+	*op = (template_op_t){ .type = TMPL_OP_TEXT, .str = text };
+	*compiled = (compiled_template_t){
+			.data = text.str,
+			.ops = op,
+			.op_count = 1,
+			.refs = 1 };
+	return compiled;
+}
+
+void template_destroy(compiled_template_t* compiled) {
+	if (compiled->path.str) {
+		lt_mfree(lt_libc_heap, compiled->path.str);
+	}
+	lt_mfree(lt_libc_heap, compiled->data);
+	lt_mfree(lt_libc_heap, compiled->ops);
+	lt_mfree(lt_libc_heap, compiled);
+}
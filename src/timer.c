@@ -0,0 +1,148 @@
+#include <lt/mem.h>
+
+#include "timer.h"
+
+#include <time.h>
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+
+u64 timer_now_msec(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (u64)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// for measuring durations, unlike access_log_time_nsec it never steps backwards
+u64 timer_now_nsec(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (u64)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void timer_wheel_create(timer_wheel_t out_wheel[static 1], u64 tick_msec) {
+	pthread_mutex_init(&out_wheel->lock, NULL);
+	out_wheel->tick_msec = tick_msec;
+	out_wheel->current_tick = timer_now_msec() / tick_msec;
+
+	for (usz i = 0; i < TIMER_WHEEL_LEVELS; ++i) {
+		for (usz j = 0; j < TIMER_WHEEL_SLOTS; ++j) {
+			wheel_timer_t* head = &out_wheel->slots[i][j];
+			head->next = head;
+			head->prev = head;
+		}
+	}
+}
+
+void timer_wheel_destroy(timer_wheel_t wheel[static 1]) {
+	pthread_mutex_destroy(&wheel->lock);
+}
+
+static
+void unlink_timer(wheel_timer_t timer[static 1]) {
+	timer->prev->next = timer->next;
+	timer->next->prev = timer->prev;
+	timer->next = NULL;
+	timer->prev = NULL;
+}
+
+static
+void insert_timer(timer_wheel_t wheel[static 1], wheel_timer_t timer[static 1]) {
+	u64 expires = timer->expires_tick;
+	u64 delta = expires > wheel->current_tick ? expires - wheel->current_tick : 0;
+
+	wheel_timer_t* head;
+	if (delta < TIMER_WHEEL_SLOTS) {
+		// timers that are already due go into the slot that is processed next
+		head = &wheel->slots[0][(delta ? expires : wheel->current_tick) & SLOT_MASK];
+	}
+	else {
+		usz level = 1;
+		while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (u64)1 << ((level + 1) * TIMER_WHEEL_BITS)) {
+			++level;
+		}
+		// anything beyond the range of the top level waits in its last slot and is cascaded again later
+		u64 max_delta = ((u64)1 << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS)) - 1;
+		if (delta > max_delta) {
+			expires = wheel->current_tick + max_delta;
+		}
+		head = &wheel->slots[level][(expires >> (level * TIMER_WHEEL_BITS)) & SLOT_MASK];
+	}
+
+	timer->next = head;
+	timer->prev = head->prev;
+	head->prev->next = timer;
+	head->prev = timer;
+}
+
+void timer_wheel_schedule(timer_wheel_t wheel[static 1], wheel_timer_t timer[static 1], u64 expires_msec) {
+	pthread_mutex_lock(&wheel->lock);
+	if (timer->prev) {
+		unlink_timer(timer);
+	}
+	__atomic_store_n(&timer->expires_tick, (expires_msec + wheel->tick_msec - 1) / wheel->tick_msec, __ATOMIC_RELEASE);
+	insert_timer(wheel, timer);
+	pthread_mutex_unlock(&wheel->lock);
+}
+
+void timer_wheel_cancel(timer_wheel_t wheel[static 1], wheel_timer_t timer[static 1]) {
+	pthread_mutex_lock(&wheel->lock);
+	if (timer->prev) {
+		unlink_timer(timer);
+	}
+	pthread_mutex_unlock(&wheel->lock);
+}
+
+// moves every timer of an upper level slot down to where it belongs now
+static
+usz cascade(timer_wheel_t wheel[static 1], usz level) {
+	usz index = (wheel->current_tick >> (level * TIMER_WHEEL_BITS)) & SLOT_MASK;
+	wheel_timer_t* head = &wheel->slots[level][index];
+
+	wheel_timer_t* it = head->next;
+	head->next = head;
+	head->prev = head;
+
+	while (it != head) {
+		wheel_timer_t* next = it->next;
+		insert_timer(wheel, it);
+		it = next;
+	}
+	return index;
+}
+
+// advances the wheel to the current time and calls 'callb' for every timer that has expired. expired
+// timers are unscheduled before the callback runs. the callback is invoked with the wheel locked, so
+// it must not schedule or cancel timers itself.
+// only one thread advances the wheel at a time, concurrent callers return immediately.
+usz timer_wheel_expire(timer_wheel_t wheel[static 1], timer_expire_fn_t callb, void* usr) {
+	if (pthread_mutex_trylock(&wheel->lock) != 0) {
+		return 0;
+	}
+
+	usz count = 0;
+	u64 now_tick = timer_now_msec() / wheel->tick_msec;
+
+	while (wheel->current_tick <= now_tick) {
+		usz index = wheel->current_tick & SLOT_MASK;
+		for (usz level = 1; !index && level < TIMER_WHEEL_LEVELS; ++level) {
+			index = cascade(wheel, level);
+		}
+		index = wheel->current_tick & SLOT_MASK;
+
+		wheel_timer_t* head = &wheel->slots[0][index];
+		while (head->next != head) {
+			wheel_timer_t* timer = head->next;
+			unlink_timer(timer);
+			callb(timer, usr);
+			++count;
+		}
+
+		if (wheel->current_tick == now_tick) {
+			break;
+		}
+		++wheel->current_tick;
+	}
+
+	pthread_mutex_unlock(&wheel->lock);
+	return count;
+}
@@ -0,0 +1,51 @@
+#ifndef TIMER_H
+#define TIMER_H 1
+
+#include <lt/lt.h>
+
+#include <pthread.h>
+
+// timer.c
+
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+
+typedef struct wheel_timer wheel_timer_t;
+
+typedef
+struct wheel_timer {
+	wheel_timer_t* next;
+	wheel_timer_t* prev; // NULL while the timer is not scheduled
+	volatile u64 expires_tick;
+} wheel_timer_t;
+
+typedef void (*timer_expire_fn_t)(wheel_timer_t* timer, void* usr);
+
+// hierarchical timing wheel, every level covers TIMER_WHEEL_SLOTS times the range of the one below.
+// scheduling and canceling are O(1), timers on the upper levels are cascaded down as their slot comes up.
+typedef
+struct timer_wheel {
+	pthread_mutex_t lock;
+	u64 tick_msec;
+	u64 current_tick;
+	wheel_timer_t slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS]; // list sentinels
+} timer_wheel_t;
+
+void timer_wheel_create(timer_wheel_t out_wheel[static 1], u64 tick_msec);
+void timer_wheel_destroy(timer_wheel_t wheel[static 1]);
+
+void timer_wheel_schedule(timer_wheel_t wheel[static 1], wheel_timer_t timer[static 1], u64 expires_msec);
+void timer_wheel_cancel(timer_wheel_t wheel[static 1], wheel_timer_t timer[static 1]);
+
+usz timer_wheel_expire(timer_wheel_t wheel[static 1], timer_expire_fn_t callb, void* usr);
+
+u64 timer_now_msec(void);
+u64 timer_now_nsec(void);
+
+static LT_INLINE
+b8 timer_expired(const wheel_timer_t timer[static 1], const timer_wheel_t wheel[static 1]) {
+	return __atomic_load_n(&timer->expires_tick, __ATOMIC_ACQUIRE) * wheel->tick_msec <= timer_now_msec();
+}
+
+#endif
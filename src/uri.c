@@ -1,131 +1,316 @@
 #include <lt/str.h>
-#include <lt/io.h>
-#include <lt/strstream.h>
 #include <lt/mem.h>
 
 #include "server.h"
+#include "bytescan.h"
 
-lstr_t urlencode(lstr_t str) {
-	lt_strstream_t ss;
-	LT_ASSERT(lt_strstream_create(&ss, lt_libc_heap) == LT_SUCCESS);
+// components are sliced out of the request line. only those containing escapes are decoded, into
+// memory from the given allocator, everything else points into the request.
 
-	return ss.str;
+static byte_set_t unreserved_chars;
+static byte_set_t query_escape_chars;
+
+__attribute__((constructor))
+static
+void init_uri_chars(void) {
+	byte_set_init(&unreserved_chars, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_.~");
+	byte_set_init(&query_escape_chars, "%+");
+}
+
+static
+isz hex_digit(char c) {
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+static LT_INLINE
+usz find_escape(const char* str, usz len, b8 plus_is_space) {
+	if (plus_is_space) {
+		return byte_set_span(&query_escape_chars, str, len);
+	}
+	return byte_find(str, len, '%');
 }
 
-lstr_t urldecode(lstr_t str) {
-	lt_strstream_t ss;
-	LT_ASSERT(lt_strstream_create(&ss, lt_libc_heap) == LT_SUCCESS);
+// decodes str into out, which has to fit str.len bytes, and returns the decoded length.
+// malformed escapes are copied as they are and counted in invalid_escapes.
+static
+usz decode_into(char* out, lstr_t str, b8 plus_is_space, usz invalid_escapes[static 1]) {
+	char* out_it = out;
 
 	for (char* it = str.str, *end = it + str.len; it < end;) {
+		usz clean = find_escape(it, end - it, plus_is_space);
+		memcpy(out_it, it, clean);
+		out_it += clean;
+		it += clean;
+		if (it >= end) {
+			break;
+		}
+
 		char c = *it++;
-		if (c != '%') {
-			lt_strstream_writec(&ss, c);
+		if (c == '+') {
+			*out_it++ = ' ';
 			continue;
 		}
 
 		if (it + 2 > end) {
-			lt_werrf("url encoded escape sequence broken by end-of-string\n");
-			break;
+			++*invalid_escapes;
+			*out_it++ = '%';
+			continue;
 		}
 
-		lstr_t enc = LSTR(it, 2);
-		u64 dec;
-		if (lt_lshextou(enc, &dec) != LT_SUCCESS) {
-			lt_werrf("invalid url encoded escape sequence '%%%S'\n", enc);
-			lt_strstream_writec(&ss, '%');
-			lt_strstream_writels(&ss, enc);
-		}
-		else {
-			lt_strstream_writec(&ss, (u8)dec);
+		isz hi = hex_digit(it[0]), lo = hex_digit(it[1]);
+		if (hi < 0 || lo < 0) {
+			++*invalid_escapes;
+			*out_it++ = '%';
+			continue;
 		}
-
+		*out_it++ = (hi << 4) | lo;
 		it += 2;
 	}
 
-	return ss.str;
+	return out_it - out;
 }
 
-lstr_t resolve(lstr_t str) {
-	lt_strstream_t ss;
-	LT_ASSERT(lt_strstream_create(&ss, lt_libc_heap) == LT_SUCCESS);
+// returns str itself if it contains no escapes
+static
+lstr_t decode_component(lstr_t str, b8 plus_is_space, lt_alloc_t* alloc, usz invalid_escapes[static 1]) {
+	usz clean = find_escape(str.str, str.len, plus_is_space);
+	if (clean == str.len) {
+		return str;
+	}
 
-	char* it = str.str, *end = it + str.len;
-	for (;;) {
-		lstr_t dir = lt_lssplit(lt_lsfrom_range(it, end), '/');
+	char* out = lt_malloc(alloc, str.len);
+	if (!out) {
+		return NLSTR();
+	}
+	memcpy(out, str.str, clean);
+	usz len = clean + decode_into(out + clean, LSTR(str.str + clean, str.len - clean), plus_is_space, invalid_escapes);
+	return LSTR(out, len);
+}
 
-		if (dir.len && !lt_lseq(dir, CLSTR(".")) && !lt_lseq(dir, CLSTR(".."))) {
-			lt_strstream_writec(&ss, '/');
-			lt_strstream_writels(&ss, dir);
-		}
-		it += dir.len + 1;
+// returns str itself if every character is unreserved
+lstr_t urlencode(lstr_t str, lt_alloc_t* alloc) {
+	static const char hex[] = "0123456789ABCDEF";
 
+	usz clean = byte_set_span_members(&unreserved_chars, str.str, str.len);
+	if (clean == str.len) {
+		return str;
+	}
+
+	char* out = lt_malloc(alloc, clean + (str.len - clean) * 3);
+	if (!out) {
+		return NLSTR();
+	}
+	char* out_it = out;
+
+	for (char* it = str.str, *end = it + str.len; it < end;) {
+		memcpy(out_it, it, clean);
+		out_it += clean;
+		it += clean;
 		if (it >= end) {
 			break;
 		}
-	}
 
-	if (!ss.str.len) {
-		lt_strstream_writec(&ss, '/');
+		u8 c = *it++;
+		*out_it++ = '%';
+		*out_it++ = hex[c >> 4];
+		*out_it++ = hex[c & 0x0F];
+
+		clean = byte_set_span_members(&unreserved_chars, it, end - it);
 	}
 
-	return ss.str;
+	return lt_lsfrom_range(out, out_it);
 }
 
-uri_t parse_uri(lstr_t str) {
-	lstr_t page = lt_lssplit(str, '?');
-	lstr_t query = NLSTR();
-	if (page.len != str.len) {
-		query = LSTR(str.str + page.len + 1, str.len - page.len - 1);
-	}
-	page = urldecode(page);
-
-	uri_t uri = {
-			.page = resolve(page),
-			.query = query,
-			.param_count = 0 };
+// returns str itself if it contains no escapes
+lstr_t urldecode(lstr_t str, lt_alloc_t* alloc) {
+	usz invalid_escapes = 0;
+	return decode_component(str, 0, alloc, &invalid_escapes);
+}
 
-	lt_mfree(lt_libc_heap, page.str);
+// collapses repeated slashes and resolves '.' and '..' segments, '..' stops at the root.
+// path has to start with a slash, the result is never longer than the input.
+static
+usz resolve_in_place(char* path, usz len) {
+	usz out_len = 0;
 
-	// This does not handle ?asdf&fdsa=2
-	for (char* it = query.str, *end = it + query.len; it < end;) {
-		char* key_start = it;
-		while (it < end && *it != '=') {
-			++it;
+	for (usz i = 0; i < len;) {
+		while (i < len && path[i] == '/') {
+			++i;
 		}
-		lstr_t key = lt_lsfrom_range(key_start, it++);
+		usz start = i;
+		while (i < len && path[i] != '/') {
+			++i;
+		}
+		usz seg_len = i - start;
 
-		char* val_start = it;
-		while (it < end && *it != '&') {
-			++it;
+		if (!seg_len || (seg_len == 1 && path[start] == '.')) {
+			continue;
+		}
+		if (seg_len == 2 && path[start] == '.' && path[start + 1] == '.') {
+			while (out_len && path[--out_len] != '/') {}
+			continue;
 		}
-		lstr_t val = lt_lsfrom_range(val_start, it++);
 
-		uri.params[uri.param_count] = urldecode(key);
-		uri.param_vals[uri.param_count++] = urldecode(val);
+		path[out_len++] = '/';
+		memmove(path + out_len, path + start, seg_len);
+		out_len += seg_len;
+	}
 
-		if (uri.param_count == MAX_URI_PARAMS) {
-			lt_werrf("max uri param limit reached, dropped trailing data\n");
-			break;
+	if (!out_len) {
+		path[out_len++] = '/';
+	}
+	return out_len;
+}
+
+// true if resolve_in_place would not change the path
+static
+b8 is_canonical(lstr_t path) {
+	if (!path.len || path.str[0] != '/') {
+		return 0;
+	}
+	if (path.len == 1) {
+		return 1;
+	}
+
+	for (char* it = path.str, *end = it + path.len; it < end;) {
+		char* seg = ++it; // skip the slash
+		it += byte_find(it, end - it, '/');
+		usz seg_len = it - seg;
+		if (!seg_len || (seg_len == 1 && seg[0] == '.') || (seg_len == 2 && seg[0] == '.' && seg[1] == '.')) {
+			return 0;
 		}
 	}
+	return 1;
+}
 
-	return uri;
+static
+u32 hash_nocase(lstr_t str) {
+	u32 hash = 2166136261;
+	for (usz i = 0; i < str.len; ++i) {
+		u8 c = str.str[i];
+		if (c >= 'A' && c <= 'Z') {
+			c += 'a' - 'A';
+		}
+		hash = (hash ^ c) * 16777619;
+	}
+	return hash;
 }
 
-void free_uri(const uri_t* uri) {
-	lt_mfree(lt_libc_heap, uri->page.str);
+static
+lt_err_t build_param_index(uri_t uri[static 1], lt_alloc_t* alloc) {
+	usz size = 16;
+	while (size < uri->param_count * 2) {
+		size <<= 1;
+	}
+
+	uri->param_index = lt_malloc(alloc, size * sizeof(u32));
+	if (!uri->param_index) {
+		return LT_ERR_OUT_OF_MEMORY;
+	}
+	lt_mzero(uri->param_index, size * sizeof(u32));
+	uri->param_index_mask = size - 1;
+
+	// inserted in order, so the first of several equal keys is found first
 	for (usz i = 0; i < uri->param_count; ++i) {
-		lt_mfree(lt_libc_heap, uri->params[i].str);
-		lt_mfree(lt_libc_heap, uri->param_vals[i].str);
+		usz slot = uri->params[i].hash & uri->param_index_mask;
+		while (uri->param_index[slot]) {
+			slot = (slot + 1) & uri->param_index_mask;
+		}
+		uri->param_index[slot] = i + 1;
+	}
+	return LT_SUCCESS;
+}
+
+lt_err_t parse_uri(uri_t out[static 1], lstr_t str, lt_alloc_t* alloc) {
+	*out = (uri_t){0};
+
+	usz page_len = byte_find(str.str, str.len, '?');
+	lstr_t page = LSTR(str.str, page_len);
+	if (page_len != str.len) {
+		out->query = LSTR(str.str + page_len + 1, str.len - page_len - 1);
+	}
+
+	// the page is only copied if it has to be decoded or resolved
+	if (byte_find(page.str, page.len, '%') == page.len && is_canonical(page)) {
+		out->page = page;
+	}
+	else {
+		char* buf = lt_malloc(alloc, page.len + 1);
+		if (!buf) {
+			return LT_ERR_OUT_OF_MEMORY;
+		}
+		buf[0] = '/';
+		usz len = 1 + decode_into(buf + 1, page, 0, &out->invalid_escapes);
+		out->page = LSTR(buf, resolve_in_place(buf, len));
 	}
+
+	lstr_t query = out->query;
+	if (!query.len) {
+		return LT_SUCCESS;
+	}
+
+	usz max_params = 1;
+	for (usz i = 0; (i += byte_find(query.str + i, query.len - i, '&')) < query.len; ++i) {
+		++max_params;
+	}
+	out->params = lt_malloc(alloc, max_params * sizeof(uri_param_t));
+	if (!out->params) {
+		return LT_ERR_OUT_OF_MEMORY;
+	}
+
+	for (char* it = query.str, *end = it + query.len; it < end; ++it) {
+		char* pair_start = it;
+		it += byte_find(it, end - it, '&');
+		lstr_t pair = lt_lsfrom_range(pair_start, it);
+		if (!pair.len) {
+			continue;
+		}
+
+		// a key without '=' has an empty value
+		usz key_len = byte_find(pair.str, pair.len, '=');
+		lstr_t key = LSTR(pair.str, key_len);
+		lstr_t val = key_len < pair.len ? LSTR(pair.str + key_len + 1, pair.len - key_len - 1) : CLSTR("");
+
+		key = decode_component(key, 1, alloc, &out->invalid_escapes);
+		val = decode_component(val, 1, alloc, &out->invalid_escapes);
+		if (!key.str || !val.str) {
+			return LT_ERR_OUT_OF_MEMORY;
+		}
+
+		out->params[out->param_count++] = (uri_param_t){
+				.key = key,
+				.val = val,
+				.hash = hash_nocase(key) };
+	}
+
+	if (out->param_count > URI_PARAM_SCAN_LIMIT) {
+		return build_param_index(out, alloc);
+	}
+	return LT_SUCCESS;
 }
 
+// parameter names are compared case-insensitively, the first of several equal ones is returned
 lstr_t* uri_find_param(uri_t* uri, lstr_t param) {
-	for (usz i = 0; i < uri->param_count; ++i) {
-		if (lt_lseq_nocase(uri->params[i], param)) {
-			return &uri->param_vals[i];
+	u32 hash = hash_nocase(param);
+
+	if (!uri->param_index) {
+		for (usz i = 0; i < uri->param_count; ++i) {
+			uri_param_t* p = &uri->params[i];
+			if (p->hash == hash && lt_lseq_nocase(p->key, param)) {
+				return &p->val;
+			}
 		}
+		return NULL;
 	}
 
+	for (usz slot = hash & uri->param_index_mask; uri->param_index[slot]; slot = (slot + 1) & uri->param_index_mask) {
+		uri_param_t* p = &uri->params[uri->param_index[slot] - 1];
+		if (p->hash == hash && lt_lseq_nocase(p->key, param)) {
+			return &p->val;
+		}
+	}
 	return NULL;
 }
@@ -0,0 +1,95 @@
+// Decodes the binary access log written with server.log_sink = ACCESS_LOG_FILE.
+// Records are printed in the same format as the stderr sink.
+//
+// Usage: logdecode [file...]
+//
+// Reads stdin if no file is given. Rotated files can be passed oldest first to get one continuous log.
+
+#include <lt/io.h>
+#include <lt/str.h>
+
+#include "../src/accesslog.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static
+isz write_stdout(void* usr, const void* data, usz len) {
+	const u8* it = data;
+	for (usz remain = len; remain;) {
+		isz res = write(STDOUT_FILENO, it, remain);
+		if (res < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		it += res;
+		remain -= res;
+	}
+	return len;
+}
+
+static
+isz read_full(int fd, void* data, usz size) {
+	u8* it = data;
+	usz total = 0;
+	while (total < size) {
+		isz res = read(fd, it + total, size - total);
+		if (res < 0 && errno == EINTR) {
+			continue;
+		}
+		if (res <= 0) {
+			return res < 0 ? res : (isz)total;
+		}
+		total += res;
+	}
+	return total;
+}
+
+static
+b8 decode(int fd, lstr_t name) {
+	char magic[8];
+	if (read_full(fd, magic, sizeof(magic)) != sizeof(magic) || memcmp(magic, ACCESS_LOG_MAGIC, sizeof(magic)) != 0) {
+		lt_werrf("'%S' is not an access log\n", name);
+		return 0;
+	}
+
+	access_record_t record;
+	isz res;
+	while ((res = read_full(fd, &record, sizeof(record))) == sizeof(record)) {
+		access_record_write(write_stdout, NULL, &record);
+	}
+
+	if (res < 0) {
+		lt_werrf("failed to read '%S': %S\n", name, lt_err_str(lt_errno()));
+		return 0;
+	}
+	if (res > 0) {
+		lt_werrf("'%S' ends with a truncated record\n", name);
+	}
+	return 1;
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		return decode(STDIN_FILENO, CLSTR("stdin")) ? 0 : 1;
+	}
+
+	int ret = 0;
+	for (int i = 1; i < argc; ++i) {
+		lstr_t name = lt_lsfroms(argv[i]);
+		int fd = open(argv[i], O_RDONLY);
+		if (fd < 0) {
+			lt_werrf("failed to open '%S': %S\n", name, lt_err_str(lt_errno()));
+			ret = 1;
+			continue;
+		}
+		if (!decode(fd, name)) {
+			ret = 1;
+		}
+		close(fd);
+	}
+	return ret;
+}
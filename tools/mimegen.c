@@ -0,0 +1,204 @@
+// Generates the perfect hash table used by mime.c from mime.tbl.
+//
+// Usage: mimegen <mime.tbl> <output.c>
+//
+// Keys are hashed into buckets, and every bucket gets a seed for which its keys land in distinct free slots.
+// A lookup is then one bucket read and one slot compare, see mime_type_or_default.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/mime.h"
+
+#define MAX_ENTRIES 4096
+#define MAX_SEED 0xFFFF
+
+typedef
+struct entry {
+	char* ext;
+	char* mime;
+	u32 bucket;
+	u32 slot;
+} entry_t;
+
+static entry_t entries[MAX_ENTRIES];
+static usz entry_count = 0;
+
+static
+usz next_pow2(usz val) {
+	usz pow = 1;
+	while (pow < val) {
+		pow <<= 1;
+	}
+	return pow;
+}
+
+static
+char* trim(char* str) {
+	while (*str == ' ' || *str == '\t') {
+		++str;
+	}
+	char* end = str + strlen(str);
+	while (end > str && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\n' || end[-1] == '\r')) {
+		*--end = 0;
+	}
+	return str;
+}
+
+static
+void parse_table(FILE* file, const char* path) {
+	char line[512];
+	for (usz line_num = 1; fgets(line, sizeof(line), file); ++line_num) {
+		char* it = trim(line);
+		if (!*it || *it == '#') {
+			continue;
+		}
+
+		char* sep = strpbrk(it, " \t");
+		if (!sep) {
+			fprintf(stderr, "%s:%zu: expected '<extension> <mime type>'\n", path, line_num);
+			exit(1);
+		}
+		*sep = 0;
+		char* ext = it, *mime = trim(sep + 1);
+
+		if (strlen(ext) > MIME_MAX_EXTENSION) {
+			fprintf(stderr, "%s:%zu: extension '%s' is longer than MIME_MAX_EXTENSION\n", path, line_num, ext);
+			exit(1);
+		}
+		for (char* c = ext; *c; ++c) {
+			if (*c >= 'A' && *c <= 'Z') {
+				fprintf(stderr, "%s:%zu: extension '%s' is not lowercase\n", path, line_num, ext);
+				exit(1);
+			}
+		}
+		for (usz i = 0; i < entry_count; ++i) {
+			if (strcmp(entries[i].ext, ext) == 0) {
+				fprintf(stderr, "%s:%zu: duplicate extension '%s'\n", path, line_num, ext);
+				exit(1);
+			}
+		}
+		if (entry_count >= MAX_ENTRIES) {
+			fprintf(stderr, "%s: too many entries\n", path);
+			exit(1);
+		}
+
+		entries[entry_count++] = (entry_t){ .ext = strdup(ext), .mime = strdup(mime) };
+	}
+}
+
+int main(int argc, char** argv) {
+	if (argc != 3) {
+		fprintf(stderr, "usage: mimegen <mime.tbl> <output.c>\n");
+		return 1;
+	}
+
+	FILE* in = fopen(argv[1], "r");
+	if (!in) {
+		perror(argv[1]);
+		return 1;
+	}
+	parse_table(in, argv[1]);
+	fclose(in);
+
+	usz bucket_count = next_pow2((entry_count + 1) / 2);
+	usz slot_count = next_pow2(entry_count) * 2;
+
+	u32* bucket_sizes = calloc(bucket_count, sizeof(u32));
+	u32* seeds = calloc(bucket_count, sizeof(u32));
+	u32* order = calloc(bucket_count, sizeof(u32));
+	entry_t** slots = calloc(slot_count, sizeof(entry_t*));
+
+	for (usz i = 0; i < entry_count; ++i) {
+		entries[i].bucket = mime_hash(entries[i].ext, strlen(entries[i].ext), 0) & (bucket_count - 1);
+		++bucket_sizes[entries[i].bucket];
+	}
+
+	// place the largest buckets first, while most slots are still free
+	for (usz i = 0; i < bucket_count; ++i) {
+		order[i] = i;
+	}
+	for (usz i = 1; i < bucket_count; ++i) {
+		for (usz j = i; j && bucket_sizes[order[j - 1]] < bucket_sizes[order[j]]; --j) {
+			u32 tmp = order[j];
+			order[j] = order[j - 1];
+			order[j - 1] = tmp;
+		}
+	}
+
+	for (usz i = 0; i < bucket_count && bucket_sizes[order[i]]; ++i) {
+		u32 bucket = order[i];
+
+		u32 seed = 1;
+		for (; seed <= MAX_SEED; ++seed) {
+			b8 collision = 0;
+
+			for (usz j = 0; j < entry_count && !collision; ++j) {
+				entry_t* e = &entries[j];
+				if (e->bucket != bucket) {
+					continue;
+				}
+				e->slot = mime_hash(e->ext, strlen(e->ext), seed) & (slot_count - 1);
+				if (slots[e->slot]) {
+					collision = 1;
+					break;
+				}
+				slots[e->slot] = e;
+			}
+
+			if (!collision) {
+				break;
+			}
+			// undo the partial placement
+			for (usz j = 0; j < entry_count; ++j) {
+				if (entries[j].bucket == bucket && slots[entries[j].slot] == &entries[j]) {
+					slots[entries[j].slot] = NULL;
+				}
+			}
+		}
+
+		if (seed > MAX_SEED) {
+			fprintf(stderr, "mimegen: no seed found for bucket %u, the table can not be hashed\n", bucket);
+			return 1;
+		}
+		seeds[bucket] = seed;
+	}
+
+	FILE* out = fopen(argv[2], "w");
+	if (!out) {
+		perror(argv[2]);
+		return 1;
+	}
+
+	fprintf(out, "// generated by tools/mimegen from %s, do not edit\n\n", argv[1]);
+	fprintf(out, "#define MIME_BUCKET_COUNT %zu\n", bucket_count);
+	fprintf(out, "#define MIME_SLOT_COUNT %zu\n\n", slot_count);
+
+	fprintf(out, "static const u16 mime_seeds[MIME_BUCKET_COUNT] = {");
+	for (usz i = 0; i < bucket_count; ++i) {
+		fprintf(out, "%s%u,", i % 16 ? " " : "\n\t", seeds[i]);
+	}
+	fprintf(out, "\n};\n\n");
+
+	fprintf(out, "static const mime_entry_t mime_slots[MIME_SLOT_COUNT] = {\n");
+	for (usz i = 0; i < slot_count; ++i) {
+		if (slots[i]) {
+			fprintf(out, "\t[%zu] = { CLSTR(\"%s\"), CLSTR(\"%s\") },\n", i, slots[i]->ext, slots[i]->mime);
+		}
+	}
+	fprintf(out, "};\n\n");
+
+	fprintf(out, "const mime_entry_t mime_table[] = {\n");
+	for (usz i = 0; i < entry_count; ++i) {
+		fprintf(out, "\t{ CLSTR(\"%s\"), CLSTR(\"%s\") },\n", entries[i].ext, entries[i].mime);
+	}
+	fprintf(out, "};\n\n");
+	fprintf(out, "const usz mime_table_count = %zu;\n", entry_count);
+
+	if (fclose(out) != 0) {
+		perror(argv[2]);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,270 @@
+// Compiles templates ahead of time into C functions that are linked into the server.
+//
+// Usage: tmplc <output.c> [template...]
+//
+// Every template becomes one function. Static output is emitted as constant arrays, read and param
+// become direct lookups, call becomes a direct call to the stream function. Includes of templates
+// that are part of the same run are direct calls too, anything else is rendered at runtime.
+// template_render_file picks up the compiled version of a path instead of compiling it at runtime.
+// Any diagnostic while parsing a template fails the build, instead of linking a partial template.
+
+#include <lt/io.h>
+#include <lt/mem.h>
+#include <lt/str.h>
+
+#include "../src/template.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MAX_TEMPLATES 1024
+
+typedef
+struct source {
+	lstr_t path;
+	compiled_template_t* compiled;
+	u8 visit_state;
+	u64 source_hash;
+	u64 hash; // source_hash combined with the hashes of the compiled templates it includes
+	b8 hashed;
+} source_t;
+
+static source_t sources[MAX_TEMPLATES];
+static usz source_count = 0;
+
+static
+lstr_t strip_dot_slash(lstr_t path) {
+	while (path.len >= 2 && path.str[0] == '.' && path.str[1] == '/') {
+		path.str += 2;
+		path.len -= 2;
+	}
+	return path;
+}
+
+static
+isz find_source(lstr_t path) {
+	path = strip_dot_slash(path);
+	for (usz i = 0; i < source_count; ++i) {
+		if (lt_lseq(sources[i].path, path)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+// direct calls between compiled templates would recurse forever on an include cycle
+static
+b8 check_cycles(usz index) {
+	source_t* src = &sources[index];
+	if (src->visit_state == 2) {
+		return 1;
+	}
+	if (src->visit_state == 1) {
+		fprintf(stderr, "tmplc: include cycle through '%.*s'\n", (int)src->path.len, src->path.str);
+		return 0;
+	}
+
+	src->visit_state = 1;
+	for (usz i = 0; i < src->compiled->op_count; ++i) {
+		template_op_t* op = &src->compiled->ops[i];
+		isz child = op->type == TMPL_OP_INCLUDE ? find_source(op->str) : -1;
+		if (child >= 0 && !check_cycles(child)) {
+			return 0;
+		}
+	}
+	src->visit_state = 2;
+	return 1;
+}
+
+#define FNV_OFFSET 0xCBF29CE484222325
+#define FNV_PRIME 0x100000001B3
+
+static
+u64 fnv1a(u64 hash, lstr_t str) {
+	for (usz i = 0; i < str.len; ++i) {
+		hash = (hash ^ (u8)str.str[i]) * FNV_PRIME;
+	}
+	return hash;
+}
+
+// identifies what the compiled function renders, for the ETags of srv_etag_template. only called
+// after check_cycles, so the recursion ends.
+static
+u64 combined_hash(usz index) {
+	source_t* src = &sources[index];
+	if (src->hashed) {
+		return src->hash;
+	}
+
+	u64 hash = src->source_hash;
+	for (usz i = 0; i < src->compiled->op_count; ++i) {
+		template_op_t* op = &src->compiled->ops[i];
+		isz child = op->type == TMPL_OP_INCLUDE ? find_source(op->str) : -1;
+		if (child >= 0) {
+			u64 child_hash = combined_hash(child);
+			hash = fnv1a(hash, LSTR((char*)&child_hash, sizeof(child_hash)));
+		}
+	}
+
+	src->hash = hash;
+	src->hashed = 1;
+	return hash;
+}
+
+static
+void write_literal(FILE* out, lstr_t str) {
+	fputc('"', out);
+	for (usz i = 0; i < str.len; ++i) {
+		u8 c = str.str[i];
+		if (c == '"' || c == '\\') {
+			fprintf(out, "\\%c", c);
+		}
+		else if (c == '\n') {
+			// keep the generated source readable
+			fprintf(out, "\\n\"\n\t\t\"");
+		}
+		else if (c == '\t') {
+			fprintf(out, "\\t");
+		}
+		else if (c < 0x20 || c >= 0x7F) {
+			fprintf(out, "\\%03o", c);
+		}
+		else {
+			fputc(c, out);
+		}
+	}
+	fputc('"', out);
+}
+
+static
+void write_lstr(FILE* out, lstr_t str) {
+	if (!str.str) {
+		fprintf(out, "NLSTR()");
+		return;
+	}
+	fprintf(out, "CLSTR(");
+	write_literal(out, str);
+	fprintf(out, ")");
+}
+
+static
+void write_template(FILE* out, usz index) {
+	source_t* src = &sources[index];
+	compiled_template_t* compiled = src->compiled;
+
+	for (usz i = 0; i < compiled->op_count; ++i) {
+		template_op_t* op = &compiled->ops[i];
+		if (op->type == TMPL_OP_TEXT) {
+			fprintf(out, "static const char tmpl_%zu_text_%zu[] =\n\t\t", index, i);
+			write_literal(out, op->str);
+			fprintf(out, ";\n");
+		}
+		else if (op->type == TMPL_OP_CALL) {
+			fprintf(out, "void __template_stream_%.*s(lt_write_fn_t __callb, void* __usr, connection_t* conn);\n", (int)op->str.len, op->str.str);
+		}
+	}
+
+	fprintf(out, "\ntemplate_compiled(");
+	write_literal(out, src->path);
+	fprintf(out, ", 0x%016llXull, tmpl_%zu) {\n", (unsigned long long)combined_hash(index), index);
+
+	for (usz i = 0; i < compiled->op_count; ++i) {
+		template_op_t* op = &compiled->ops[i];
+		switch (op->type) {
+		case TMPL_OP_TEXT:
+			fprintf(out, "\ttemplate_write_static(__callb, __usr, conn, tmpl_%zu_text_%zu, sizeof(tmpl_%zu_text_%zu) - 1);\n", index, i, index, i);
+			break;
+
+		case TMPL_OP_READ:
+		case TMPL_OP_PARAM:
+			fprintf(out, "\t{\n\t\tlstr_t* val = %s", op->type == TMPL_OP_READ ? "srv_get_var(conn, " : "uri_find_param(&conn->uri, ");
+			write_lstr(out, op->str);
+			fprintf(out, ");\n\t\thtml_write_escaped(__callb, __usr, val ? *val : ");
+			write_lstr(out, op->def);
+			fprintf(out, ");\n\t}\n");
+			break;
+
+		case TMPL_OP_CALL:
+			fprintf(out, "\t__template_stream_%.*s(__callb, __usr, conn);\n", (int)op->str.len, op->str.str);
+			break;
+
+		case TMPL_OP_INCLUDE: {
+			isz child = find_source(op->str);
+			if (child >= 0) {
+				fprintf(out, "\ttmpl_%zd(__callb, __usr, conn);\n", child);
+			}
+			else {
+				fprintf(out, "\ttemplate_render_file(__callb, __usr, ");
+				write_lstr(out, op->str);
+				fprintf(out, ", conn);\n");
+			}
+		}	break;
+		}
+	}
+	fprintf(out, "}\n\n");
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		fprintf(stderr, "usage: tmplc <output.c> [template...]\n");
+		return 1;
+	}
+
+	if (argc - 2 > MAX_TEMPLATES) {
+		fprintf(stderr, "tmplc: too many templates\n");
+		return 1;
+	}
+
+	for (int i = 2; i < argc; ++i) {
+		lstr_t path = strip_dot_slash(lt_lsfroms(argv[i]));
+
+		lstr_t data;
+		if (lt_freadallp_utf8(path, &data, lt_libc_heap)) {
+			fprintf(stderr, "tmplc: failed to read '%s'\n", argv[i]);
+			return 1;
+		}
+
+		// stream functions are resolved by the linker instead
+		compiled_template_t* compiled = template_compile(data, 0);
+		u64 source_hash = fnv1a(FNV_OFFSET, data);
+		lt_mfree(lt_libc_heap, data.str);
+		if (!compiled) {
+			fprintf(stderr, "tmplc: failed to compile '%s'\n", argv[i]);
+			return 1;
+		}
+		if (compiled->error_count) {
+			fprintf(stderr, "tmplc: '%s' has %zu error(s)\n", argv[i], compiled->error_count);
+			return 1;
+		}
+
+		sources[source_count++] = (source_t){ .path = path, .compiled = compiled, .source_hash = source_hash };
+	}
+
+	for (usz i = 0; i < source_count; ++i) {
+		if (!check_cycles(i)) {
+			return 1;
+		}
+	}
+
+	FILE* out = fopen(argv[1], "w");
+	if (!out) {
+		fprintf(stderr, "tmplc: failed to open '%s'\n", argv[1]);
+		return 1;
+	}
+
+	fprintf(out, "// generated by tools/tmplc, do not edit\n\n");
+	fprintf(out, "#include \"server.h\"\n");
+	fprintf(out, "#include \"htmlescape.h\"\n\n");
+
+	for (usz i = 0; i < source_count; ++i) {
+		fprintf(out, "static void tmpl_%zu(lt_write_fn_t __callb, void* __usr, connection_t* conn);\n", i);
+	}
+	fprintf(out, "\n");
+
+	for (usz i = 0; i < source_count; ++i) {
+		write_template(out, i);
+	}
+
+	fclose(out);
+	return 0;
+}